@@ -0,0 +1,710 @@
+//
+// Created by viking on 2025/4/6.
+//
+// 性能基准：ParseLine 吞吐、ProcessDirectory 入库速率、视场查询延迟（p50/p99）、不同星等极限下的读取量、
+// 多视场批量查询与逐个查询的对比、大视场紧凑结果与完整结果的对比、慢速转动时增量查询与从头查询的每帧延迟、格子缓存冷热两遍的查询延迟、
+// 异步引擎的并发查询吞吐、drawStarMap 渲染时间、整幅渲染与条带渲染的对比、查询后渲染与流式查询边查边渲染的
+// 端到端时间，以及图像序列逐帧渲染与三级流水线的持续帧率。
+// 星表由 SyntheticCatalog 按固定种子生成，结果写成 JSON，便于在版本之间对比。
+//
+// 用法：bench [--stars N] [--queries N] [--repeats N] [--quick] [--work-dir DIR] [--json PATH]
+//             [--redis-host HOST] [--redis-port PORT]
+// 只有显式给出 --redis-port 时才跑 Redis 相关的部分：入库前会 FLUSHDB，请使用专门的本地 redis-server。
+
+#include "async_query.h"
+#include "dataset.h"
+#include "draw.h"
+#include "metrics.h"
+#include "observer.h"
+#include "sequence.h"
+#include "synthetic_catalog.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE ""
+#endif
+
+namespace {
+    constexpr uint32_t CATALOG_SEED = 20250406;
+    constexpr uint32_t QUERY_SEED = 7;
+    constexpr double QUERY_EPOCH = 2025.0;   // 固定观测历元，结果不随运行时间变化
+    constexpr std::size_t CATALOG_FILES = 8;
+
+    struct Options {
+        std::size_t stars = 1000000;
+        std::size_t parse_lines = 200000;
+        std::size_t queries = 200;
+        int repeats = 3;
+        std::vector<double> fov_sizes = {1.0, 5.0, 10.0, 20.0};
+        std::vector<int> resolutions = {1024, 2048, 4096};
+        std::vector<double> magnitude_limits = {8.0, 10.0, 12.0};
+        std::string work_dir = "bench_work";
+        std::string json_path = "bench_results.json";
+        std::string redis_host = "127.0.0.1";
+        int redis_port = 0; // 0 表示跳过 Redis 部分
+    };
+
+    bool ParseArgs(int argc, char** argv, Options& opts) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> const char* {
+                if (i + 1 >= argc) throw std::invalid_argument("missing value for " + arg);
+                return argv[++i];
+            };
+            if (arg == "--stars") opts.stars = std::strtoull(value(), nullptr, 10);
+            else if (arg == "--queries") opts.queries = std::strtoull(value(), nullptr, 10);
+            else if (arg == "--repeats") opts.repeats = std::max(1, std::atoi(value()));
+            else if (arg == "--work-dir") opts.work_dir = value();
+            else if (arg == "--json") opts.json_path = value();
+            else if (arg == "--redis-host") opts.redis_host = value();
+            else if (arg == "--redis-port") opts.redis_port = std::atoi(value());
+            else if (arg == "--quick") {
+                opts.stars = 100000;
+                opts.parse_lines = 50000;
+                opts.queries = 50;
+                opts.repeats = 1;
+                opts.resolutions = {512, 1024};
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // --- 结果收集与 JSON 输出 ---
+    std::string JsonString(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    std::string JsonNumber(double v) {
+        std::ostringstream out;
+        out << std::setprecision(12) << v;
+        return out.str();
+    }
+
+    struct Result {
+        std::vector<std::pair<std::string, std::string>> fields; // 值已是 JSON 文本
+
+        Result& set(const std::string& key, const std::string& v) { fields.emplace_back(key, JsonString(v)); return *this; }
+        Result& set(const std::string& key, const char* v) { return set(key, std::string(v)); }
+        Result& set(const std::string& key, double v) { fields.emplace_back(key, JsonNumber(v)); return *this; }
+    };
+
+    std::string ToJson(const std::vector<std::pair<std::string, std::string>>& fields, const std::string& indent) {
+        std::string out = "{";
+        for (std::size_t i = 0; i < fields.size(); ++i) {
+            out += (i ? ", " : "") + JsonString(fields[i].first) + ": " + fields[i].second;
+        }
+        return indent + out + "}";
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    double SecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // 最近秩百分位
+    double Percentile(std::vector<double> values, double p) {
+        if (values.empty()) return 0.0;
+        std::sort(values.begin(), values.end());
+        std::size_t rank = static_cast<std::size_t>(std::ceil(p / 100.0 * values.size()));
+        return values[std::clamp<std::size_t>(rank, 1, values.size()) - 1];
+    }
+
+    // --- 视场样本 ---
+    struct Field {
+        const char* name;
+        double ra;
+        double dec;
+        double jitter; // 中心的随机偏移范围（度），0 表示全天随机
+    };
+
+    const Field FIELDS[] = {
+        {"galactic_center", SyntheticCatalog::GALACTIC_CENTER_RA, SyntheticCatalog::GALACTIC_CENTER_DEC, 2.0},
+        {"galactic_pole", SyntheticCatalog::GALACTIC_POLE_RA, SyntheticCatalog::GALACTIC_POLE_DEC, 2.0},
+        {"random", 0.0, 0.0, 0.0},
+    };
+
+    std::vector<std::pair<double, double>> FieldCenters(const Field& field, std::size_t count) {
+        std::mt19937 gen(QUERY_SEED);
+        std::uniform_real_distribution<> unit(0.0, 1.0);
+        std::vector<std::pair<double, double>> centers;
+        for (std::size_t i = 0; i < count; ++i) {
+            if (field.jitter == 0.0) {
+                centers.emplace_back(unit(gen) * 360.0, std::asin(unit(gen) * 2.0 - 1.0) * 180.0 / M_PI);
+            } else {
+                double ra = std::fmod(field.ra + (unit(gen) * 2.0 - 1.0) * field.jitter + 360.0, 360.0);
+                double dec = std::clamp(field.dec + (unit(gen) * 2.0 - 1.0) * field.jitter, -90.0, 90.0);
+                centers.emplace_back(ra, dec);
+            }
+        }
+        return centers;
+    }
+
+    // --- 各项基准 ---
+    void BenchParse(const Options& opts, std::vector<Result>& results) {
+        std::mt19937 gen(CATALOG_SEED);
+        std::vector<std::string> lines;
+        lines.reserve(opts.parse_lines);
+        for (std::size_t i = 0; i < opts.parse_lines; ++i) {
+            lines.push_back(SyntheticCatalog::MakeLine(gen, SyntheticCatalog::SkyModel::MilkyWay));
+        }
+
+        double best = 0.0;
+        double sink = 0.0;
+        for (int r = 0; r < opts.repeats; ++r) {
+            auto start = Clock::now();
+            for (const auto& line : lines) {
+                try {
+                    sink += Tycho2Dataset::ParseLine(line).V_mag;
+                } catch (const std::exception&) {
+                    sink += 1.0;
+                }
+            }
+            best = std::max(best, lines.size() / SecondsSince(start));
+        }
+        results.push_back(Result().set("benchmark", "parse_line").set("lines", static_cast<double>(lines.size()))
+                                  .set("lines_per_sec", best).set("checksum", sink));
+        std::cerr << "parse_line: " << static_cast<long long>(best) << " lines/s" << std::endl;
+    }
+
+    void BenchSnapshotBuild(const Options& opts, const std::string& catalog_dir, const std::string& snapshot_path,
+                            std::vector<Result>& results) {
+        Tycho2Dataset dataset;
+        auto start = Clock::now();
+        dataset.WriteSnapshot(catalog_dir, snapshot_path);
+        double seconds = SecondsSince(start);
+        results.push_back(Result().set("benchmark", "snapshot_build").set("stars", static_cast<double>(opts.stars))
+                                  .set("seconds", seconds).set("stars_per_sec", opts.stars / seconds));
+        std::cerr << "snapshot_build: " << seconds << " s" << std::endl;
+    }
+
+    void BenchIngest(const Options& opts, const std::string& catalog_dir, uint64_t catalog_bytes,
+                     StorageLayout layout, std::vector<Result>& results) {
+        {
+            RedisPool::Lease conn = RedisPool::Shared(opts.redis_host, opts.redis_port)->acquire();
+            if (!conn) throw std::runtime_error("Cannot connect to redis-server for ingest benchmark");
+            redisReply* reply = static_cast<redisReply*>(redisCommand(conn.get(), "FLUSHDB"));
+            if (reply == nullptr) throw std::runtime_error("FLUSHDB failed");
+            freeReplyObject(reply);
+        }
+
+        Tycho2Dataset dataset(opts.redis_host, opts.redis_port, 1000, layout);
+        auto start = Clock::now();
+        dataset.ProcessDirectory(catalog_dir);
+        double seconds = SecondsSince(start);
+        results.push_back(Result().set("benchmark", "ingest").set("layout", CellStore::LayoutName(layout))
+                                  .set("stars", static_cast<double>(opts.stars)).set("seconds", seconds)
+                                  .set("stars_per_sec", opts.stars / seconds)
+                                  .set("mb_per_sec", catalog_bytes / seconds / 1e6));
+        std::cerr << "ingest (" << CellStore::LayoutName(layout) << "): "
+                  << static_cast<long long>(opts.stars / seconds) << " stars/s" << std::endl;
+    }
+
+    // backend 为空指针时查询 Redis
+    void BenchQueries(const Options& opts, const std::string& backend, std::shared_ptr<const StarSnapshot> snapshot,
+                      bool multithreaded, std::vector<Result>& results) {
+        for (const Field& field : FIELDS) {
+            auto centers = FieldCenters(field, opts.queries);
+            for (double fov : opts.fov_sizes) {
+                std::vector<double> latencies;
+                latencies.reserve(centers.size());
+                double total_stars = 0.0;
+                for (const auto& [ra, dec] : centers) {
+                    observer obs(ra, dec, fov, fov, 0.0, 0.0, opts.redis_host, opts.redis_port);
+                    obs.setEpoch(QUERY_EPOCH);
+                    obs.useSnapshot(snapshot);
+                    auto start = Clock::now();
+                    std::vector<star> stars = multithreaded ? obs.FileterStarInViewMultithreaded(0)
+                                                            : obs.FileterStarInView();
+                    latencies.push_back(SecondsSince(start) * 1000.0);
+                    total_stars += static_cast<double>(stars.size());
+                }
+                results.push_back(Result().set("benchmark", "query").set("backend", backend)
+                                          .set("mode", multithreaded ? "multi" : "single")
+                                          .set("field", field.name).set("fov_deg", fov)
+                                          .set("queries", static_cast<double>(latencies.size()))
+                                          .set("mean_stars", total_stars / latencies.size())
+                                          .set("p50_ms", Percentile(latencies, 50.0))
+                                          .set("p99_ms", Percentile(latencies, 99.0)));
+            }
+        }
+        std::cerr << "query (" << backend << ", " << (multithreaded ? "multi" : "single") << "): done" << std::endl;
+    }
+
+    // 最宽的视场按不同星等极限查询，记录延迟和每次查询读取的字节数，看分层读取省掉多少数据
+    void BenchMagnitudeLimits(const Options& opts, const std::string& backend,
+                              std::shared_ptr<const StarSnapshot> snapshot, std::vector<Result>& results) {
+        Metrics::Counter& bytes_read = snapshot
+            ? Metrics::Registry::Global().counter("starsim_snapshot_bytes_read_total", "Bytes of snapshot records scanned")
+            : Metrics::Registry::Global().counter("starsim_redis_bytes_read_total", "Payload bytes in Redis replies");
+        const double fov = opts.fov_sizes.back();
+        for (const Field& field : FIELDS) {
+            auto centers = FieldCenters(field, opts.queries);
+            for (double magnitude_limit : {6.0, 8.0, 10.0, std::numeric_limits<double>::infinity()}) {
+                std::vector<double> latencies;
+                latencies.reserve(centers.size());
+                double total_stars = 0.0;
+                uint64_t bytes_before = bytes_read.value();
+                for (const auto& [ra, dec] : centers) {
+                    observer obs(ra, dec, fov, fov, 0.0, 0.0, opts.redis_host, opts.redis_port);
+                    obs.setEpoch(QUERY_EPOCH);
+                    obs.useSnapshot(snapshot);
+                    obs.setMagnitudeLimit(magnitude_limit);
+                    auto start = Clock::now();
+                    std::vector<star> stars = obs.FileterStarInView();
+                    latencies.push_back(SecondsSince(start) * 1000.0);
+                    total_stars += static_cast<double>(stars.size());
+                }
+                double bytes_per_query = static_cast<double>(bytes_read.value() - bytes_before) / centers.size();
+                results.push_back(Result().set("benchmark", "magnitude_limit").set("backend", backend)
+                                          .set("field", field.name).set("fov_deg", fov)
+                                          .set("magnitude_limit", std::isinf(magnitude_limit) ? 99.0 : magnitude_limit)
+                                          .set("queries", static_cast<double>(latencies.size()))
+                                          .set("mean_stars", total_stars / latencies.size())
+                                          .set("bytes_per_query", bytes_per_query)
+                                          .set("p50_ms", Percentile(latencies, 50.0)));
+            }
+        }
+        std::cerr << "magnitude limit (" << backend << "): done" << std::endl;
+    }
+
+    // 银心附近 grid × grid 块相互重叠的视场拼成的巡天区域：逐个查询，对比一次 FileterStarsInViews
+    void BenchBatchQueries(const Options& opts, const std::string& backend, std::shared_ptr<const StarSnapshot> snapshot,
+                           std::vector<Result>& results) {
+        const double tile = 4.0;
+        const double step = 3.5; // 相邻视场重叠 0.5°
+        for (int grid : {3, 6}) {
+            std::vector<observer> views;
+            for (int i = 0; i < grid; ++i) {
+                for (int j = 0; j < grid; ++j) {
+                    observer obs(SyntheticCatalog::GALACTIC_CENTER_RA + (i - grid / 2) * step,
+                                 SyntheticCatalog::GALACTIC_CENTER_DEC + (j - grid / 2) * step, tile, tile, 0.0, 0.0,
+                                 opts.redis_host, opts.redis_port);
+                    obs.setEpoch(QUERY_EPOCH);
+                    obs.useSnapshot(snapshot);
+                    views.push_back(obs);
+                }
+            }
+            std::vector<double> separate_seconds;
+            std::vector<double> batch_seconds;
+            double total_stars = 0.0;
+            for (int r = 0; r < opts.repeats; ++r) {
+                auto start = Clock::now();
+                for (observer& view : views) view.FileterStarInView();
+                separate_seconds.push_back(SecondsSince(start));
+                start = Clock::now();
+                std::vector<std::vector<star>> view_stars = observer::FileterStarsInViews(views, 1);
+                batch_seconds.push_back(SecondsSince(start));
+                total_stars = 0.0;
+                for (const auto& stars : view_stars) total_stars += static_cast<double>(stars.size());
+            }
+            results.push_back(Result().set("benchmark", "batch_query").set("backend", backend)
+                                      .set("views", static_cast<double>(views.size())).set("fov_deg", tile)
+                                      .set("total_stars", total_stars)
+                                      .set("separate_ms", Percentile(separate_seconds, 50.0) * 1000.0)
+                                      .set("batch_ms", Percentile(batch_seconds, 50.0) * 1000.0));
+        }
+        std::cerr << "batch query (" << backend << "): done" << std::endl;
+    }
+
+    // 银心的大视场：完整的 star 结果对比 FileterStarInViewCompact 的紧凑结果，记录延迟和结果占用的内存
+    void BenchCompactQueries(const Options& opts, const std::string& backend,
+                             std::shared_ptr<const StarSnapshot> snapshot, std::vector<Result>& results) {
+        const double fov = 30.0;
+        observer obs(SyntheticCatalog::GALACTIC_CENTER_RA, SyntheticCatalog::GALACTIC_CENTER_DEC, fov, fov, 0.0, 0.0,
+                     opts.redis_host, opts.redis_port);
+        obs.setEpoch(QUERY_EPOCH);
+        obs.useSnapshot(snapshot);
+        for (bool compact : {false, true}) {
+            std::vector<double> seconds;
+            double stars = 0.0;
+            double record_bytes = compact ? sizeof(compact_star) : sizeof(star);
+            for (int r = 0; r < opts.repeats; ++r) {
+                auto start = Clock::now();
+                stars = compact ? static_cast<double>(obs.FileterStarInViewCompact(0).size())
+                                : static_cast<double>(obs.FileterStarInViewMultithreaded(0).size());
+                seconds.push_back(SecondsSince(start));
+            }
+            const char* mode = compact ? "compact" : "full";
+            results.push_back(Result().set("benchmark", "compact_query").set("backend", backend).set("mode", mode)
+                                      .set("fov_deg", fov).set("stars", stars)
+                                      .set("result_mib", stars * record_bytes / (1024.0 * 1024.0))
+                                      .set("median_seconds", Percentile(seconds, 50.0)));
+        }
+        std::cerr << "compact query (" << backend << "): done" << std::endl;
+    }
+
+    // 跟踪目标时的慢速转动：视场从银心附近出发每帧沿赤经移动 SLEW_STEP，逐帧从头查询对比增量查询的每帧延迟
+    void BenchSlew(const Options& opts, const std::string& backend, std::shared_ptr<const StarSnapshot> snapshot,
+                   std::vector<Result>& results) {
+        constexpr double SLEW_STEP = 0.05; // 度/帧
+        const std::size_t frames = opts.queries;
+        for (double fov : {5.0, 20.0}) {
+            std::vector<double> full_ms;
+            std::vector<double> incremental_ms;
+            double mean_stars = 0.0;
+            for (bool incremental : {false, true}) {
+                observer obs(SyntheticCatalog::GALACTIC_CENTER_RA, SyntheticCatalog::GALACTIC_CENTER_DEC, fov, fov,
+                             0.0, 0.0, opts.redis_host, opts.redis_port);
+                obs.setEpoch(QUERY_EPOCH);
+                obs.useSnapshot(snapshot);
+                obs.FileterStarInViewIncremental(); // 第一帧读取整个视场，不计入
+                std::vector<double>& latencies = incremental ? incremental_ms : full_ms;
+                double stars = 0.0;
+                for (std::size_t f = 0; f < frames; ++f) {
+                    obs.setRa(obs.getRa() + SLEW_STEP);
+                    auto start = Clock::now();
+                    std::vector<star> visible = incremental ? obs.FileterStarInViewIncremental() : obs.FileterStarInView();
+                    latencies.push_back(SecondsSince(start) * 1000.0);
+                    stars += static_cast<double>(visible.size());
+                }
+                mean_stars = stars / static_cast<double>(frames);
+            }
+            results.push_back(Result().set("benchmark", "slew").set("backend", backend).set("fov_deg", fov)
+                                      .set("frames", static_cast<double>(frames)).set("step_deg", SLEW_STEP)
+                                      .set("mean_stars", mean_stars)
+                                      .set("full_p50_ms", Percentile(full_ms, 50.0))
+                                      .set("incremental_p50_ms", Percentile(incremental_ms, 50.0))
+                                      .set("incremental_p99_ms", Percentile(incremental_ms, 99.0)));
+        }
+        std::cerr << "slew (" << backend << "): done" << std::endl;
+    }
+
+    // 同一批视场查两遍，共用一个 TileCache：第一遍全部未命中，第二遍格子都在缓存里，记录两遍的延迟和命中率
+    void BenchCachedQueries(const Options& opts, const std::string& backend, std::vector<Result>& results) {
+        for (const Field& field : FIELDS) {
+            auto centers = FieldCenters(field, opts.queries);
+            for (double fov : opts.fov_sizes) {
+                auto cache = std::make_shared<TileCache>();
+                for (const char* pass : {"cold", "warm"}) {
+                    TileCache::Stats before = cache->stats();
+                    std::vector<double> latencies;
+                    latencies.reserve(centers.size());
+                    for (const auto& [ra, dec] : centers) {
+                        observer obs(ra, dec, fov, fov, 0.0, 0.0, opts.redis_host, opts.redis_port);
+                        obs.setEpoch(QUERY_EPOCH);
+                        obs.setTileCache(cache);
+                        auto start = Clock::now();
+                        obs.FileterStarInView();
+                        latencies.push_back(SecondsSince(start) * 1000.0);
+                    }
+                    TileCache::Stats after = cache->stats();
+                    double lookups = static_cast<double>(after.hits + after.misses - before.hits - before.misses);
+                    results.push_back(Result().set("benchmark", "cached_query").set("backend", backend)
+                                              .set("pass", pass).set("field", field.name).set("fov_deg", fov)
+                                              .set("queries", static_cast<double>(latencies.size()))
+                                              .set("hit_rate", lookups > 0 ? (after.hits - before.hits) / lookups : 0.0)
+                                              .set("cache_mib", after.bytes / 1048576.0)
+                                              .set("p50_ms", Percentile(latencies, 50.0))
+                                              .set("p99_ms", Percentile(latencies, 99.0)));
+                }
+            }
+        }
+        std::cerr << "cached query (" << backend << "): done" << std::endl;
+    }
+
+    void BenchRender(const Options& opts, std::shared_ptr<const StarSnapshot> snapshot, std::vector<Result>& results) {
+        // 银心方向 10°×10° 的视场，是合成星表里最密的区域
+        const double fov = 10.0;
+        observer obs(SyntheticCatalog::GALACTIC_CENTER_RA, SyntheticCatalog::GALACTIC_CENTER_DEC, fov, fov);
+        obs.setEpoch(QUERY_EPOCH);
+        obs.useSnapshot(snapshot);
+        std::vector<star> stars = obs.FileterStarInViewMultithreaded(0);
+
+        StarMapDrawer::RenderOptions render_options;
+        render_options.threads = 0;
+        render_options.gamma = obs.getGamma();
+        const std::string output = opts.work_dir + "/render.png";
+        for (int resolution : opts.resolutions) {
+            for (double magnitude_limit : opts.magnitude_limits) {
+                std::vector<double> seconds;
+                for (int r = 0; r < opts.repeats; ++r) {
+                    auto start = Clock::now();
+                    StarMapDrawer::drawStarMap(stars, output, resolution, resolution, obs.getRa(), obs.getDec(),
+                                               fov, fov, magnitude_limit, render_options);
+                    seconds.push_back(SecondsSince(start));
+                }
+                results.push_back(Result().set("benchmark", "render").set("field", "galactic_center")
+                                          .set("stars", static_cast<double>(stars.size()))
+                                          .set("resolution", resolution).set("magnitude_limit", magnitude_limit)
+                                          .set("median_seconds", Percentile(seconds, 50.0)));
+                std::cerr << "render " << resolution << "px mag<=" << magnitude_limit << ": "
+                          << Percentile(seconds, 50.0) << " s" << std::endl;
+            }
+        }
+    }
+
+    // 最大分辨率下整幅渲染与条带渲染（drawStarMapBanded）的对比，都写 PGM，记录耗时和累加缓冲区的大小
+    void BenchBandedRender(const Options& opts, std::shared_ptr<const StarSnapshot> snapshot,
+                           std::vector<Result>& results) {
+        const double fov = 10.0;
+        const int band_height = 256;
+        observer obs(SyntheticCatalog::GALACTIC_CENTER_RA, SyntheticCatalog::GALACTIC_CENTER_DEC, fov, fov);
+        obs.setEpoch(QUERY_EPOCH);
+        obs.useSnapshot(snapshot);
+        std::vector<star> stars = obs.FileterStarInViewMultithreaded(0);
+
+        StarMapDrawer::RenderOptions render_options;
+        render_options.threads = 0;
+        const int resolution = opts.resolutions.back();
+        const std::string output = opts.work_dir + "/render_banded.pgm";
+        for (bool banded : {false, true}) {
+            std::vector<double> seconds;
+            for (int r = 0; r < opts.repeats; ++r) {
+                auto start = Clock::now();
+                if (banded) {
+                    StarMapDrawer::drawStarMapBanded(stars, output, resolution, resolution, obs.getRa(), obs.getDec(),
+                                                     fov, fov, 12.0, render_options, band_height);
+                } else {
+                    StarMapDrawer::drawStarMap(stars, output, resolution, resolution, obs.getRa(), obs.getDec(),
+                                               fov, fov, 12.0, render_options);
+                }
+                seconds.push_back(SecondsSince(start));
+            }
+            const double buffer_rows = banded ? std::min(band_height, resolution) : resolution;
+            const char* mode = banded ? "banded" : "full";
+            results.push_back(Result().set("benchmark", "banded_render").set("mode", mode)
+                                      .set("field", "galactic_center").set("stars", static_cast<double>(stars.size()))
+                                      .set("resolution", resolution)
+                                      .set("buffer_mib", buffer_rows * resolution * sizeof(float) / (1024.0 * 1024.0))
+                                      .set("median_seconds", Percentile(seconds, 50.0)));
+            std::cerr << "banded render (" << mode << ", " << resolution << "px): " << Percentile(seconds, 50.0)
+                      << " s" << std::endl;
+        }
+    }
+
+    // 同一批视场一次性全部提交给 AsyncQueryEngine，记录总耗时、吞吐和每个查询从提交到交付的延迟
+    void BenchAsyncQueries(const Options& opts, const std::string& backend, std::vector<Result>& results) {
+        AsyncQueryEngine engine(opts.redis_host, opts.redis_port);
+        for (const Field& field : FIELDS) {
+            auto centers = FieldCenters(field, opts.queries);
+            for (double fov : opts.fov_sizes) {
+                std::vector<double> latencies(centers.size());
+                std::vector<std::future<std::vector<star>>> pending;
+                pending.reserve(centers.size());
+                auto start = Clock::now();
+                for (std::size_t i = 0; i < centers.size(); ++i) {
+                    observer obs(centers[i].first, centers[i].second, fov, fov, 0.0, 0.0, opts.redis_host,
+                                 opts.redis_port);
+                    obs.setEpoch(QUERY_EPOCH);
+                    auto submitted = Clock::now();
+                    auto promise = std::make_shared<std::promise<std::vector<star>>>();
+                    pending.push_back(promise->get_future());
+                    engine.submit(obs, [promise, submitted, &latency = latencies[i]](std::vector<star>&& stars,
+                                                                                     std::exception_ptr error) {
+                        latency = SecondsSince(submitted) * 1000.0;
+                        if (error) {
+                            promise->set_exception(error);
+                        } else {
+                            promise->set_value(std::move(stars));
+                        }
+                    });
+                }
+                double total_stars = 0.0;
+                for (auto& result : pending) total_stars += static_cast<double>(result.get().size());
+                double seconds = SecondsSince(start);
+                results.push_back(Result().set("benchmark", "async_query").set("backend", backend)
+                                          .set("field", field.name).set("fov_deg", fov)
+                                          .set("queries", static_cast<double>(centers.size()))
+                                          .set("mean_stars", total_stars / centers.size())
+                                          .set("queries_per_sec", centers.size() / seconds)
+                                          .set("p50_ms", Percentile(latencies, 50.0))
+                                          .set("p99_ms", Percentile(latencies, 99.0)));
+            }
+        }
+        std::cerr << "async query (" << backend << "): done" << std::endl;
+    }
+
+    // 查询加渲染的端到端时间：先查完再渲染，对比把 StreamStarsInView 的各批直接交给 Accumulator
+    void BenchPipeline(const Options& opts, const std::string& backend, std::shared_ptr<const StarSnapshot> snapshot,
+                       std::vector<Result>& results) {
+        const double fov = 10.0;
+        const int resolution = opts.resolutions.back();
+        StarMapDrawer::RenderOptions render_options;
+        render_options.threads = 0;
+        const std::string output = opts.work_dir + "/pipeline.png";
+        for (bool streaming : {false, true}) {
+            std::vector<double> seconds;
+            std::size_t star_count = 0;
+            for (int r = 0; r < opts.repeats; ++r) {
+                observer obs(SyntheticCatalog::GALACTIC_CENTER_RA, SyntheticCatalog::GALACTIC_CENTER_DEC, fov, fov,
+                             0.0, 0.0, opts.redis_host, opts.redis_port);
+                obs.setEpoch(QUERY_EPOCH);
+                obs.useSnapshot(snapshot);
+                auto start = Clock::now();
+                if (streaming) {
+                    StarMapDrawer::Accumulator accumulator(resolution, resolution, obs.getRa(), obs.getDec(), fov,
+                                                           fov, 12.0, render_options);
+                    star_count = obs.StreamStarsInView(
+                        [&accumulator](std::vector<star>&& stars) { accumulator.add(std::move(stars)); }, 0);
+                    accumulator.finish(output);
+                } else {
+                    std::vector<star> stars = obs.FileterStarInViewMultithreaded(0);
+                    star_count = stars.size();
+                    StarMapDrawer::drawStarMap(stars, output, resolution, resolution, obs.getRa(), obs.getDec(),
+                                               fov, fov, 12.0, render_options);
+                }
+                seconds.push_back(SecondsSince(start));
+            }
+            const char* mode = streaming ? "streaming" : "sequential";
+            results.push_back(Result().set("benchmark", "pipeline").set("backend", backend).set("mode", mode)
+                                      .set("field", "galactic_center").set("stars", static_cast<double>(star_count))
+                                      .set("resolution", resolution)
+                                      .set("median_seconds", Percentile(seconds, 50.0)));
+            std::cerr << "pipeline (" << backend << ", " << mode << "): " << Percentile(seconds, 50.0) << " s"
+                      << std::endl;
+        }
+    }
+
+    // 沿赤经慢速转动的图像序列：逐帧依次查询、渲染、编码，对比 StarSequence 的三级流水线，记录持续帧率和各阶段耗时
+    void BenchSequence(const Options& opts, const std::string& backend, std::shared_ptr<const StarSnapshot> snapshot,
+                       std::vector<Result>& results) {
+        const double fov = 10.0;
+        const std::size_t frames = std::max<std::size_t>(opts.queries / 2, 4);
+        std::vector<StarSequence::Pose> trajectory;
+        for (std::size_t f = 0; f < frames; ++f) {
+            trajectory.push_back(StarSequence::Pose{SyntheticCatalog::GALACTIC_CENTER_RA + 0.05 * f,
+                                                    SyntheticCatalog::GALACTIC_CENTER_DEC, 0.0});
+        }
+        StarSequence::Options sequence_options;
+        sequence_options.imageWidth = sequence_options.imageHeight = opts.resolutions.back();
+        sequence_options.render.threads = 0;
+        sequence_options.outputPattern = opts.work_dir + "/sequence/frame_%05d.png";
+        for (bool pipelined : {false, true}) {
+            observer obs(trajectory.front().ra, trajectory.front().dec, fov, fov, 0.0, 0.0, opts.redis_host,
+                         opts.redis_port);
+            obs.setEpoch(QUERY_EPOCH);
+            obs.useSnapshot(snapshot);
+            sequence_options.pipelined = pipelined;
+            StarSequence::Stats stats = StarSequence::RenderSequence(obs, trajectory, sequence_options);
+            const char* mode = pipelined ? "pipelined" : "sequential";
+            results.push_back(Result().set("benchmark", "sequence").set("backend", backend).set("mode", mode)
+                                      .set("frames", static_cast<double>(stats.framesWritten))
+                                      .set("resolution", sequence_options.imageWidth)
+                                      .set("fps", static_cast<double>(stats.framesWritten) / stats.wallSeconds)
+                                      .set("query_ms_per_frame", stats.querySeconds * 1000.0 / frames)
+                                      .set("render_ms_per_frame", stats.renderSeconds * 1000.0 / frames)
+                                      .set("encode_ms_per_frame", stats.encodeSeconds * 1000.0 / frames));
+            std::cerr << "sequence (" << backend << ", " << mode << "): "
+                      << static_cast<double>(stats.framesWritten) / stats.wallSeconds << " fps" << std::endl;
+        }
+    }
+
+    std::string Timestamp() {
+        std::time_t now = std::time(nullptr);
+        char text[32];
+        std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        return text;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        if (!ParseArgs(argc, argv, opts)) return 2;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+
+    std::vector<Result> results;
+    try {
+        const std::string catalog_dir = opts.work_dir + "/catalog";
+        const std::string snapshot_path = opts.work_dir + "/catalog.snap";
+        std::filesystem::create_directories(catalog_dir);
+
+        BenchParse(opts, results);
+
+        std::cerr << "generating " << opts.stars << " synthetic stars in " << catalog_dir << std::endl;
+        uint64_t catalog_bytes = SyntheticCatalog::WriteCatalog(catalog_dir, opts.stars, CATALOG_FILES, CATALOG_SEED,
+                                                                SyntheticCatalog::SkyModel::MilkyWay);
+
+        BenchSnapshotBuild(opts, catalog_dir, snapshot_path, results);
+        std::shared_ptr<const StarSnapshot> snapshot = StarSnapshot::Open(snapshot_path);
+        if (!snapshot) return 1;
+        BenchQueries(opts, "snapshot", snapshot, false, results);
+        BenchQueries(opts, "snapshot", snapshot, true, results);
+        BenchMagnitudeLimits(opts, "snapshot", snapshot, results);
+        BenchBatchQueries(opts, "snapshot", snapshot, results);
+        BenchCompactQueries(opts, "snapshot", snapshot, results);
+        BenchSlew(opts, "snapshot", snapshot, results);
+
+        if (opts.redis_port != 0) {
+            for (StorageLayout layout : {StorageLayout::Hash, StorageLayout::PackedCells}) {
+                BenchIngest(opts, catalog_dir, catalog_bytes, layout, results);
+                BenchQueries(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, false, results);
+                BenchQueries(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, true, results);
+                BenchCachedQueries(opts, std::string("redis-") + CellStore::LayoutName(layout), results);
+                BenchMagnitudeLimits(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, results);
+                BenchBatchQueries(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, results);
+                BenchCompactQueries(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, results);
+                BenchSlew(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, results);
+                BenchAsyncQueries(opts, std::string("redis-") + CellStore::LayoutName(layout), results);
+                BenchPipeline(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, results);
+                BenchSequence(opts, std::string("redis-") + CellStore::LayoutName(layout), nullptr, results);
+            }
+        } else {
+            std::cerr << "redis benchmarks skipped (pass --redis-port to enable)" << std::endl;
+        }
+
+        BenchRender(opts, snapshot, results);
+        BenchBandedRender(opts, snapshot, results);
+        BenchPipeline(opts, "snapshot", snapshot, results);
+        BenchSequence(opts, "snapshot", snapshot, results);
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(opts.json_path, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write " << opts.json_path << std::endl;
+        return 1;
+    }
+    out << "{\n";
+    out << "  \"schema\": 1,\n";
+    out << "  \"timestamp\": " << JsonString(Timestamp()) << ",\n";
+    out << "  \"build_type\": " << JsonString(BENCH_BUILD_TYPE) << ",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"config\": " << ToJson({{"stars", JsonNumber(static_cast<double>(opts.stars))},
+                                      {"queries", JsonNumber(static_cast<double>(opts.queries))},
+                                      {"repeats", JsonNumber(opts.repeats)},
+                                      {"catalog_seed", JsonNumber(CATALOG_SEED)},
+                                      {"query_epoch", JsonNumber(QUERY_EPOCH)},
+                                      {"redis", opts.redis_port != 0 ? "true" : "false"}}, "") << ",\n";
+    out << "  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        out << ToJson(results[i].fields, "    ") << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n";
+    // 整个运行期间累计的库内指标：各阶段耗时分布、扫描/返回星数、Redis 往返次数等
+    out << "  \"metrics\": " << Metrics::Registry::Global().toJson() << "\n}\n";
+    std::cerr << "results written to " << opts.json_path << std::endl;
+    return 0;
+}
@@ -0,0 +1,153 @@
+//
+// Created by viking on 2025/3/25.
+//
+// ParseLine 微基准：对比改写前基于 substr/trim/stod 的解析器和现在的 string_view/from_chars 解析器
+
+#include "dataset.h"
+#include "synthetic_catalog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    volatile double g_sink = 0.0;
+
+    // --- 改写前的 ParseLine，原样保留作为基线 ---
+    struct FieldSpec {
+        size_t start;
+        size_t length;
+        enum { INT, DOUBLE, CHAR } type;
+        double scale;
+    };
+
+    const std::vector<std::pair<std::string, FieldSpec>> FIELD_DEFS = {
+        {"TYC1",    {0,   4, FieldSpec::INT,    1}},
+        {"TYC2",    {5,   5, FieldSpec::INT,    1}},
+        {"TYC3",    {11,  2, FieldSpec::INT,    1}},
+        {"mRAdeg",  {15, 13, FieldSpec::DOUBLE, 1}},
+        {"mDEdeg",  {28, 13, FieldSpec::DOUBLE, 1}},
+        {"pmRA",    {41,  8, FieldSpec::DOUBLE, 0.001}},
+        {"pmDE",    {49,  8, FieldSpec::DOUBLE, 0.001}},
+        {"mepRA",   {75,  8, FieldSpec::DOUBLE, 1}},
+        {"mepDE",   {83,  8, FieldSpec::DOUBLE, 1}},
+        {"BT",      {110, 7, FieldSpec::DOUBLE, 1}},
+        {"VT",      {123, 7, FieldSpec::DOUBLE, 1}},
+    };
+
+    void trim(std::string& s) {
+        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
+            return !std::isspace(ch);
+        }));
+        s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
+            return !std::isspace(ch);
+        }).base(), s.end());
+    }
+
+    Tycho2Entry LegacyParseLine(const std::string& line) {
+        Tycho2Entry entry;
+
+        for (const auto& [name, spec] : FIELD_DEFS) {
+            if (spec.start + spec.length > line.length()) {
+                throw std::out_of_range("Field " + name + " out of line boundary");
+            }
+
+            std::string raw = line.substr(spec.start, spec.length);
+            trim(raw);
+
+            try {
+                if (spec.type == FieldSpec::INT) {
+                    int val = raw.empty() ? 0 : std::stoi(raw);
+                    if (name == "TYC1") entry.TYC1 = val;
+                    else if (name == "TYC2") entry.TYC2 = val;
+                    else if (name == "TYC3") entry.TYC3 = (val == 0) ? 1 : val;
+                } else if (spec.type == FieldSpec::DOUBLE) {
+                    double val = raw.empty() ? 0.0 : std::stod(raw) * spec.scale;
+                    if (name == "mRAdeg") entry.mRAdeg = val;
+                    else if (name == "mDEdeg") entry.mDEdeg = val;
+                    else if (name == "pmRA") entry.pmRA = val;
+                    else if (name == "pmDE") entry.pmDE = val;
+                    else if (name == "mepRA") entry.mepRA = val;
+                    else if (name == "mepDE") entry.mepDE = val;
+                    else if (name == "BT") entry.BT = val;
+                    else if (name == "VT") entry.VT = val;
+                }
+            } catch (...) {
+                throw std::runtime_error("Invalid " + name + " value: " + raw);
+            }
+        }
+
+        if (entry.BT > 0 && entry.VT > 0) {
+            double BV = entry.BT - entry.VT;
+            entry.V_mag = entry.VT - 0.090 * BV;
+        } else {
+            entry.V_mag = 99.9;
+        }
+
+        entry.TYC_ID = std::to_string(entry.TYC1) + "-"
+                     + std::to_string(entry.TYC2) + "-"
+                     + std::to_string(entry.TYC3);
+        return entry;
+    }
+
+    bool SameEntry(const Tycho2Entry& a, const Tycho2Entry& b) {
+        return a.TYC1 == b.TYC1 && a.TYC2 == b.TYC2 && a.TYC3 == b.TYC3 && a.TYC_ID == b.TYC_ID &&
+               a.mRAdeg == b.mRAdeg && a.mDEdeg == b.mDEdeg && a.pmRA == b.pmRA && a.pmDE == b.pmDE &&
+               a.mepRA == b.mepRA && a.mepDE == b.mepDE && a.BT == b.BT && a.VT == b.VT && a.V_mag == b.V_mag;
+    }
+
+    // 解析全部行若干遍，返回每秒行数；sink 防止结果被优化掉
+    template <typename Parser>
+    double LinesPerSecond(const std::vector<std::string>& lines, int rounds, Parser parse, double& sink) {
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            for (const auto& line : lines) {
+                try {
+                    sink += parse(line).V_mag;
+                } catch (const std::exception&) {
+                    sink += 1.0;
+                }
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(lines.size()) * rounds / elapsed.count();
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t line_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    const int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    std::mt19937 gen(20250325);
+    std::vector<std::string> lines;
+    lines.reserve(line_count);
+    for (size_t i = 0; i < line_count; ++i) {
+        lines.push_back(SyntheticCatalog::MakeLine(gen));
+    }
+
+    // 先确认两种解析器结果一致（包括抛异常的行）
+    for (const auto& line : lines) {
+        bool legacy_ok = true, fast_ok = true;
+        Tycho2Entry legacy{}, fast{};
+        try { legacy = LegacyParseLine(line); } catch (const std::exception&) { legacy_ok = false; }
+        try { fast = Tycho2Dataset::ParseLine(line); } catch (const std::exception&) { fast_ok = false; }
+        if (legacy_ok != fast_ok || (legacy_ok && !SameEntry(legacy, fast))) {
+            std::cerr << "Parser mismatch on line: " << line << std::endl;
+            return 1;
+        }
+    }
+
+    double sink = 0.0;
+    double legacy_rate = LinesPerSecond(lines, rounds, LegacyParseLine, sink);
+    double fast_rate = LinesPerSecond(lines, rounds, [](const std::string& line) {
+        return Tycho2Dataset::ParseLine(line);
+    }, sink);
+
+    std::cout << "lines: " << lines.size() << " x " << rounds << " rounds" << std::endl;
+    std::cout << "legacy ParseLine: " << static_cast<long long>(legacy_rate) << " lines/s" << std::endl;
+    std::cout << "ParseLine:        " << static_cast<long long>(fast_rate) << " lines/s" << std::endl;
+    std::cout << "speedup:          " << fast_rate / legacy_rate << "x" << std::endl;
+    g_sink = sink;
+    return 0;
+}
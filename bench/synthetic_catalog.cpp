@@ -0,0 +1,100 @@
+//
+// Created by viking on 2025/3/25.
+//
+
+#include "synthetic_catalog.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace SyntheticCatalog {
+
+namespace {
+    constexpr double DEG = M_PI / 180.0;
+    constexpr double GALACTIC_PLANE_SIGMA = 5.0; // 银纬分布的标准差（度）
+    constexpr double NCP_GALACTIC_LONGITUDE = 122.93192; // 北天极的银经（度）
+
+    // 银道坐标转赤道坐标（J2000）
+    void GalacticToEquatorial(double l, double b, double& ra, double& dec) {
+        const double sin_dp = std::sin(GALACTIC_POLE_DEC * DEG);
+        const double cos_dp = std::cos(GALACTIC_POLE_DEC * DEG);
+        const double dl = (NCP_GALACTIC_LONGITUDE - l) * DEG;
+        const double sin_b = std::sin(b * DEG);
+        const double cos_b = std::cos(b * DEG);
+        double sin_dec = sin_b * sin_dp + cos_b * cos_dp * std::cos(dl);
+        dec = std::asin(std::clamp(sin_dec, -1.0, 1.0)) / DEG;
+        double y = cos_b * std::sin(dl);
+        double x = sin_b * cos_dp - cos_b * sin_dp * std::cos(dl);
+        ra = std::fmod(GALACTIC_POLE_RA + std::atan2(y, x) / DEG + 360.0, 360.0);
+    }
+}
+
+std::string MakeLine(std::mt19937& gen, SkyModel model, double blank_bt_fraction) {
+    std::uniform_real_distribution<> unit(0.0, 1.0);
+    std::uniform_int_distribution<> tyc1(1, 9537);
+    std::uniform_int_distribution<> tyc2(1, 12121);
+    std::uniform_int_distribution<> tyc3(1, 3);
+
+    double ra;
+    double dec;
+    if (model == SkyModel::MilkyWay && unit(gen) < 0.5) {
+        // 银盘成分：银经上越靠近银心越密，银纬高斯分布
+        std::normal_distribution<> lat(0.0, GALACTIC_PLANE_SIGMA);
+        std::normal_distribution<> lon(0.0, 60.0);
+        GalacticToEquatorial(std::fmod(lon(gen) + 360.0, 360.0), std::clamp(lat(gen), -90.0, 90.0), ra, dec);
+    } else {
+        // 天球上均匀分布
+        ra = unit(gen) * 360.0;
+        dec = std::asin(unit(gen) * 2.0 - 1.0) * 180.0 / M_PI;
+    }
+    // 定宽字段保留 8 位小数，避免舍入到 360.00000000
+    ra = std::min(ra, 359.99999999);
+    double pm_ra = (unit(gen) - 0.5) * 100.0;
+    double pm_de = (unit(gen) - 0.5) * 100.0;
+    double ep_ra = 1940.0 + unit(gen) * 50.0;
+    double ep_de = 1940.0 + unit(gen) * 50.0;
+    // 星等分布偏向暗星，与真实星表接近
+    double vt = 16.0 - 10.0 * std::pow(unit(gen), 3.0);
+    double bt = vt + unit(gen) * 1.5;
+    bool no_bt = unit(gen) < blank_bt_fraction;
+
+    char bt_text[8];
+    if (no_bt) {
+        std::snprintf(bt_text, sizeof(bt_text), "      ");
+    } else {
+        std::snprintf(bt_text, sizeof(bt_text), "%6.3f", bt);
+    }
+
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "%04d %05d %d| |%12.8f|%12.8f|%7.1f|%7.1f| 68| 73| 1.7| 1.8|%7.2f|%7.2f| 4|1.0|1.0|0.9|1.0|"
+                  "%s|0.158|%6.3f|0.223|999| |         |%12.8f|%12.8f|1.67|1.54| 88.0|100.8| |-0.2",
+                  tyc1(gen), tyc2(gen), tyc3(gen), ra, dec, pm_ra, pm_de, ep_ra, ep_de,
+                  bt_text, vt, ra, dec);
+    return line;
+}
+
+uint64_t WriteCatalog(const std::string& dir, std::size_t star_count, std::size_t file_count,
+                      uint32_t seed, SkyModel model) {
+    std::mt19937 gen(seed);
+    file_count = std::max<std::size_t>(file_count, 1);
+    uint64_t bytes = 0;
+    for (std::size_t f = 0; f < file_count; ++f) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/tyc2.dat.%02zu", f);
+        std::ofstream out(dir + name, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Failed to create " + dir + name);
+        std::size_t lines = star_count / file_count + (f < star_count % file_count ? 1 : 0);
+        for (std::size_t i = 0; i < lines; ++i) {
+            std::string line = MakeLine(gen, model, 0.0);
+            line += '\n';
+            out.write(line.data(), static_cast<std::streamsize>(line.size()));
+            bytes += line.size();
+        }
+    }
+    return bytes;
+}
+
+}
@@ -0,0 +1,36 @@
+//
+// Created by viking on 2025/3/25.
+//
+
+#ifndef SYNTHETIC_CATALOG_H
+#define SYNTHETIC_CATALOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+// 生成与 tyc2.dat 逐字节同格式的合成星表行，固定种子下结果可复现
+namespace SyntheticCatalog {
+    // 星在天球上的分布
+    enum class SkyModel {
+        Uniform,   // 全天均匀
+        MilkyWay,  // 一半均匀，一半集中在银道面附近（银纬高斯分布，σ = 5°），银心方向最密
+    };
+
+    // 银心和北银极的赤道坐标（J2000，度），基准测试用它们选密集和稀疏的视场
+    constexpr double GALACTIC_CENTER_RA = 266.40499;
+    constexpr double GALACTIC_CENTER_DEC = -28.93617;
+    constexpr double GALACTIC_POLE_RA = 192.85948;
+    constexpr double GALACTIC_POLE_DEC = 27.12825;
+
+    // 单行，不含换行符；默认约 5% 的星缺 BT（ParseLine 会拒绝这些行）
+    std::string MakeLine(std::mt19937& gen, SkyModel model = SkyModel::Uniform, double blank_bt_fraction = 0.05);
+
+    // 写 file_count 个 tyc2.dat.NN 文件到 dir（目录需已存在），共 star_count 行，返回写入的字节数。
+    // 不生成缺 BT 的行，入库计时不会被解析错误的输出干扰
+    uint64_t WriteCatalog(const std::string& dir, std::size_t star_count, std::size_t file_count,
+                          uint32_t seed, SkyModel model);
+}
+
+#endif //SYNTHETIC_CATALOG_H
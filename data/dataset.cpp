@@ -3,7 +3,13 @@
 //
 
 #include "dataset.h"
+#include <sky_grid.h>
+#include <star_snapshot.h>
+#include <fov_kernel.h>
+#include <executor.h>
+#include <metrics.h>
 #include <glob.h>
+#include <cctype>
 #include <cstring>
 #include <thread>
 #include <stdexcept>
@@ -13,31 +19,80 @@
 #include <chrono>
 #include <iomanip>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
 #include <atomic>
+#include <charconv>
 #include <cmath>
+#include <cstdio>
+#include <limits>
 
 namespace {
-    // 字段定义 (字节位置从0开始计算)
-    struct FieldSpec {
-        size_t start;
-        size_t length;
-        enum { INT, DOUBLE, CHAR } type;
-        double scale;
+    // 字段定义 (字节位置从0开始计算)，偏移和长度在编译期确定
+    template <size_t Start, size_t Length>
+    struct Field {
+        static constexpr size_t start = Start;
+        static constexpr size_t length = Length;
     };
 
-    const std::vector<std::pair<std::string, FieldSpec>> FIELD_DEFS = {
-        {"TYC1",    {0,   4, FieldSpec::INT,    1}},
-        {"TYC2",    {5,   5, FieldSpec::INT,    1}},     // 修正长度
-        {"TYC3",    {11,  2, FieldSpec::INT,    1}},     // 修正位置
-        {"mRAdeg",  {15, 13, FieldSpec::DOUBLE, 1}},
-        {"mDEdeg",  {28, 13, FieldSpec::DOUBLE, 1}},
-        {"pmRA",    {41,  8, FieldSpec::DOUBLE, 0.001}}, // 单位：mas/yr
-        {"pmDE",    {49,  8, FieldSpec::DOUBLE, 0.001}}, // 单位：mas/yr
-        {"mepRA",   {75,  8, FieldSpec::DOUBLE, 1}},
-        {"mepDE",   {83,  8, FieldSpec::DOUBLE, 1}},
-        {"BT",      {110, 7, FieldSpec::DOUBLE, 1}},
-        {"VT",      {123, 7, FieldSpec::DOUBLE, 1}},
-    };
+    using TYC1_FIELD   = Field<0,   4>;
+    using TYC2_FIELD   = Field<5,   5>;     // 修正长度
+    using TYC3_FIELD   = Field<11,  2>;     // 修正位置
+    using MRADEG_FIELD = Field<15, 13>;
+    using MDEDEG_FIELD = Field<28, 13>;
+    using PMRA_FIELD   = Field<41,  8>;     // 单位：mas/yr
+    using PMDE_FIELD   = Field<49,  8>;     // 单位：mas/yr
+    using MEPRA_FIELD  = Field<75,  8>;
+    using MEPDE_FIELD  = Field<83,  8>;
+    using BT_FIELD     = Field<110, 7>;
+    using VT_FIELD     = Field<123, 7>;
+
+    constexpr double PM_SCALE = 0.001;
+
+    // 取出字段并去掉两端空白，不复制
+    template <typename F>
+    std::string_view FieldView(std::string_view line, const char* name) {
+        if (F::start + F::length > line.length()) {
+            throw std::out_of_range(std::string("Field ") + name + " out of line boundary");
+        }
+        std::string_view raw = line.substr(F::start, F::length);
+        while (!raw.empty() && std::isspace(static_cast<unsigned char>(raw.front()))) raw.remove_prefix(1);
+        while (!raw.empty() && std::isspace(static_cast<unsigned char>(raw.back()))) raw.remove_suffix(1);
+        return raw;
+    }
+
+    // 与 std::stoi/std::stod 一致：空字段为 0，只解析开头的数字，后面的分隔符 '|' 忽略，没有数字则报错
+    template <typename T>
+    T ParseNumber(std::string_view raw, const char* name) {
+        if (raw.empty()) return T{};
+        const char* first = raw.data();
+        const char* last = raw.data() + raw.size();
+        if (*first == '+') {
+            ++first;
+            // std::stod 不接受 "+-5" 这样的双重符号，from_chars 会把去掉 '+' 后的 "-5" 当成负数
+            if (first != last && (*first == '+' || *first == '-')) {
+                throw std::runtime_error(std::string("Invalid ") + name + " value: " + std::string(raw));
+            }
+        }
+        T val{};
+        auto [ptr, ec] = std::from_chars(first, last, val);
+        if (ec != std::errc()) {
+            throw std::runtime_error(std::string("Invalid ") + name + " value: " + std::string(raw));
+        }
+        return val;
+    }
+
+    template <typename F>
+    int ParseIntField(std::string_view line, const char* name) {
+        return ParseNumber<int>(FieldView<F>(line, name), name);
+    }
+
+    template <typename F>
+    double ParseDoubleField(std::string_view line, const char* name, double scale = 1.0) {
+        return ParseNumber<double>(FieldView<F>(line, name), name) * scale;
+    }
 
     std::vector<std::string> Glob(const std::string& pattern) {
         glob_t glob_result = {};
@@ -56,26 +111,37 @@ namespace {
         return files;
     }
 
-    void trim(std::string& s) {
-        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-            return !std::isspace(ch);
-        }));
-        s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
-            return !std::isspace(ch);
-        }).base(), s.end());
+    // 入库和快照构建的指标，第一次用到时注册
+    struct IngestMetrics {
+        Metrics::Counter& bytes_read;
+        Metrics::Counter& lines;
+        Metrics::Counter& parse_errors;
+        Metrics::Counter& redis_roundtrips;
+        Metrics::Histogram& chunk_seconds;
+    };
+
+    IngestMetrics& ingest_metrics() {
+        static IngestMetrics metrics{
+            Metrics::Registry::Global().counter("starsim_ingest_bytes_read_total", "Catalog bytes consumed by ingest and snapshot builds"),
+            Metrics::Registry::Global().counter("starsim_ingest_lines_total", "Catalog lines handed to the parser"),
+            Metrics::Registry::Global().counter("starsim_parse_errors_total", "Catalog lines rejected by the parser"),
+            Metrics::Registry::Global().counter("starsim_redis_roundtrips_total", "Redis replies read, one per pipelined command"),
+            Metrics::Registry::Global().histogram("starsim_ingest_chunk_seconds", "Wall time to parse and write one input chunk"),
+        };
+        return metrics;
     }
 
-    // 进度条相关变量
-    std::atomic<size_t> total_lines_processed(0); // 已处理的总行数
-    std::atomic<size_t> total_lines_to_process(0); // 需要处理的总行数
+    // 进度条相关变量，按已消费的字节数计算进度，不需要预先数行
+    std::atomic<size_t> total_bytes_processed(0); // 已处理的字节数
+    std::atomic<size_t> total_bytes_to_process(0); // 需要处理的总字节数
     std::mutex progress_mutex;
 
     // 进度条更新函数
     void UpdateProgress() {
         static auto start_time = std::chrono::steady_clock::now();
         auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
-        size_t processed = total_lines_processed.load();
-        size_t total = total_lines_to_process.load();
+        size_t processed = total_bytes_processed.load();
+        size_t total = total_bytes_to_process.load();
 
         if (total == 0) return;
 
@@ -86,32 +152,95 @@ namespace {
         std::cout << "[" << std::string(static_cast<int>(bar_width * progress), '#')
                   << std::string(bar_width - static_cast<int>(bar_width * progress), ' ')
                   << "] " << std::setprecision(2) << std::fixed << progress * 100 << "% ("
-                  << processed << "/" << total << ") - "
+                  << processed / (1024 * 1024) << "/" << total / (1024 * 1024) << " MiB) - "
                   << "Elapsed: " << elapsed << "s - "
-                  << "ETA: " << static_cast<int>(elapsed / progress - elapsed) << "s\r";
+                  << "ETA: " << (progress > 0 ? static_cast<int>(elapsed / progress - elapsed) : 0) << "s\r";
         std::cout.flush();
     }
 
-    // 统计文件总行数
-    size_t CountLines(const std::string& file_path) {
-        std::ifstream fin(file_path);
-        if (!fin) return 0;
+    constexpr size_t INGEST_CHUNK_BYTES = 4 * 1024 * 1024; // 每个任务处理的字节数，按换行对齐
+
+    // 只读 mmap 一个输入文件
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) throw std::runtime_error("Failed to open: " + path);
+            struct stat st {};
+            if (fstat(fd, &st) != 0) {
+                close(fd);
+                throw std::runtime_error("Failed to stat: " + path);
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ > 0) {
+                data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data_ == MAP_FAILED) {
+                    close(fd);
+                    throw std::runtime_error("Failed to mmap: " + path);
+                }
+                madvise(data_, size_, MADV_SEQUENTIAL);
+            }
+            close(fd);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
 
-        size_t count = 0;
-        std::string line;
-        while (std::getline(fin, line)) {
-            count++;
+        ~MappedFile() {
+            if (data_ != nullptr) munmap(data_, size_);
         }
-        return count;
-    }
 
-    // 统计所有文件总行数
-    void CountTotalLines(const std::vector<std::string>& files) {
-        size_t total = 0;
-        for (const auto& file : files) {
-            total += CountLines(file);
+        std::string_view view() const {
+            return data_ != nullptr ? std::string_view(static_cast<const char*>(data_), size_) : std::string_view();
+        }
+
+    private:
+        void* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // 把所有输入文件 mmap 并切成按换行对齐的块，块与文件个数无关，一个大文件也能均匀分给所有线程
+    class ChunkedInput {
+    public:
+        explicit ChunkedInput(const std::vector<std::string>& files) {
+            for (const auto& file : files) {
+                files_.push_back(std::make_unique<MappedFile>(file));
+                std::string_view data = files_.back()->view();
+                total_bytes_ += data.size();
+                while (!data.empty()) {
+                    size_t end = std::min(INGEST_CHUNK_BYTES, data.size());
+                    if (end < data.size()) {
+                        size_t newline = data.find('\n', end - 1);
+                        end = newline == std::string_view::npos ? data.size() : newline + 1;
+                    }
+                    chunks_.push_back(data.substr(0, end));
+                    data.remove_prefix(end);
+                }
+            }
+        }
+
+        size_t chunkCount() const { return chunks_.size(); }
+        std::string_view chunk(size_t i) const { return chunks_[i]; }
+        size_t totalBytes() const { return total_bytes_; }
+
+    private:
+        std::vector<std::unique_ptr<MappedFile>> files_;
+        std::vector<std::string_view> chunks_;
+        size_t total_bytes_ = 0;
+    };
+
+    // 块内逐行回调，与 std::getline 一样以 '\n' 分行，末尾的换行不产生空行；处理完记入字节数和行数
+    template <typename Fn>
+    void ForEachLine(std::string_view chunk, Fn&& fn) {
+        ingest_metrics().bytes_read.add(chunk.size());
+        size_t lines = 0;
+        while (!chunk.empty()) {
+            size_t newline = chunk.find('\n');
+            fn(chunk.substr(0, newline));
+            chunk.remove_prefix(newline == std::string_view::npos ? chunk.size() : newline + 1);
+            ++lines;
         }
-        total_lines_to_process.store(total);
+        ingest_metrics().lines.add(lines);
     }
 
     // 记录数据库当前状态
@@ -130,10 +259,9 @@ namespace {
             return;
         }
 
-        redisReply* reply;
+        redisReply* reply = nullptr;
         if (redisGetReply(c, (void**)&reply) != REDIS_OK) {
             std::cerr << "Redis error: " << c->errstr << std::endl;
-            freeReplyObject(reply);
             return;
         }
 
@@ -147,13 +275,16 @@ namespace {
         fout << "----------------------------------------" << std::endl;
     }
 
-    // 获取当前年份作为临时观测时间
-    int getCurrentYear() {
-        auto now = std::chrono::system_clock::now();
-        std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-        std::tm now_tm;
-        localtime_r(&now_c, &now_tm);
-        return now_tm.tm_year + 1900;
+    // 入库只保存平均位置、自行和平均历元，观测历元的位置由 observer 查询时推算。
+    // ParseLine 里 pmRA/pmDE 乘了 0.001，单位是角秒/年；pmRA 是 μα* = μα·cosδ，
+    // 这里换回毫角秒/年并除以 cosδ，查询时只需要乘法，不用再算三角函数
+    catalog_star ToCatalogStar(const Tycho2Entry& entry) {
+        double cos_dec = std::cos(entry.mDEdeg * M_PI / 180.0);
+        double pm_ra = cos_dec > 1e-9 ? entry.pmRA * 1000.0 / cos_dec : 0.0;
+        return catalog_star{entry.mRAdeg, entry.mDEdeg, static_cast<float>(entry.V_mag),
+                            static_cast<float>(pm_ra), static_cast<float>(entry.pmDE * 1000.0),
+                            static_cast<float>(entry.mepRA), static_cast<float>(entry.mepDE),
+                            static_cast<float>(entry.BV)};
     }
 }
 
@@ -161,201 +292,387 @@ void Tycho2Dataset::ProcessDirectory(const std::string& data_dir) {
     const std::string pattern = data_dir + "/tyc2.dat.*";
 
     try {
-        std::vector<std::thread> workers;
         auto files = Glob(pattern);
+        ChunkedInput input(files);
 
-        // 连接到 Redis
-        redisContext* c = redisConnect(redis_host_.c_str(), redis_port_);
-        if (c == nullptr || c->err) {
-            std::lock_guard<std::mutex> lock(io_mutex_);
-            std::cerr << "Redis connection error: "
-                      << (c ? c->errstr : "can't allocate context")
-                      << std::endl;
+        // 从连接池借控制连接，连接失败时连接池已打印错误
+        RedisPool::Lease control = redis_pool_->acquire(Executor::Instance());
+        if (!control) {
             return;
         }
+        redisContext* c = control.get();
 
         // 记录数据库当前状态
         // LogDatabaseStatus(c, "database_status_before_insertion.log");
 
-        // 统计总行数
-        CountTotalLines(files);
-
-        // 启动进度条更新线程
-        std::thread progress_thread([&]() { // 使用引用捕获
-            while (total_lines_processed.load() < total_lines_to_process.load()) {
-                UpdateProgress();
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // 先撤下上一次入库的划分和布局标识，再删除或改写格子：入库期间（以及入库中途失败时）observer
+        // 退回全库扫描，不会通过旧索引读到空的或写了一半的格子
+        redisReply* untag_reply = static_cast<redisReply*>(
+            redisCommand(c, "DEL %s %s", SkyGrid::GRID_KEY, CellStore::LAYOUT_KEY));
+        ingest_metrics().redis_roundtrips.add();
+        if (untag_reply == nullptr || untag_reply->type == REDIS_REPLY_ERROR) {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            std::cerr << "Redis error: " << (untag_reply ? untag_reply->str : c->errstr) << std::endl;
+            if (untag_reply) freeReplyObject(untag_reply);
+            return;
+        }
+        freeReplyObject(untag_reply);
+
+        // APPEND 不是幂等的，重新入库前先清掉旧的格子二进制串
+        if (layout_ == StorageLayout::PackedCells) {
+            for (int cell = 0; cell < SkyGrid::CellCount(); ++cell) {
+                // 一条 DEL 删掉格子的所有星等层
+                std::string keys[CellStore::MAGNITUDE_LAYER_COUNT];
+                const char* argv[CellStore::MAGNITUDE_LAYER_COUNT + 1] = {"DEL"};
+                size_t argvlen[CellStore::MAGNITUDE_LAYER_COUNT + 1] = {3};
+                for (int layer = 0; layer < CellStore::MAGNITUDE_LAYER_COUNT; ++layer) {
+                    keys[layer] = CellStore::BlobKey(cell, layer);
+                    argv[layer + 1] = keys[layer].data();
+                    argvlen[layer + 1] = keys[layer].size();
+                }
+                redisAppendCommandArgv(c, CellStore::MAGNITUDE_LAYER_COUNT + 1, argv, argvlen);
             }
-            UpdateProgress(); // 最后一次更新
-            std::cout << std::endl;
-        });
-
-        // 获取当前年份作为临时观测时间
-        int currentYear = getCurrentYear();
+            if (!ReadBatchReplies(c, SkyGrid::CellCount())) {
+                return;
+            }
+        }
 
-        for (const auto& file : files) {
-            workers.emplace_back([this, file, currentYear] {
-                ProcessFile(file, currentYear);
+        total_bytes_to_process.store(input.totalBytes());
+        total_bytes_processed.store(0);
+
+        // verbose 时启动进度条更新线程，否则进度只体现在指标里
+        std::atomic<bool> ingest_done(false);
+        std::thread progress_thread;
+        if (Metrics::Verbose()) {
+            progress_thread = std::thread([&]() { // 使用引用捕获
+                while (!ingest_done.load()) {
+                    UpdateProgress();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                UpdateProgress(); // 最后一次更新
+                std::cout << std::endl;
             });
         }
-
-        for (auto& t : workers) {
-            t.join();
+        auto stop_progress = [&] {
+            ingest_done.store(true);
+            if (progress_thread.joinable()) progress_thread.join();
+        };
+
+        // 写入期间把控制连接还回去，连接池再小也不会让写入任务饿死
+        control.release();
+
+        // 每块输入一个任务，提交到进程级 Executor。连接在提交线程上从连接池借好交给任务，写完立即归还；
+        // 没有空余名额时提交线程帮 Executor 执行任务而不是阻塞，同时写入的块不超过连接池大小，
+        // 任务里也不会占着工作线程等连接。
+        // 任何一块没写全（借不到连接、连接出错、Redis 回复错误）都记下来，最后不发布天区索引
+        std::atomic<bool> write_failed(false);
+        Executor& executor = Executor::Instance();
+        TaskGroup tasks(executor);
+        try {
+            for (size_t i = 0; i < input.chunkCount(); ++i) {
+                auto conn = std::make_shared<RedisPool::Lease>(redis_pool_->acquire(executor));
+                if (!*conn) {
+                    write_failed.store(true);
+                    break;
+                }
+                tasks.run([this, &input, &write_failed, conn, i] {
+                    // 移到任务的局部变量里，写入抛出异常时随展开析构，回复没读完的连接不会还回池里
+                    RedisPool::Lease worker_conn = std::move(*conn);
+                    Metrics::ScopedTimer timer(ingest_metrics().chunk_seconds);
+                    if (!ProcessChunk(worker_conn.get(), input.chunk(i))) {
+                        write_failed.store(true);
+                    }
+                    worker_conn.release();
+                    total_bytes_processed.fetch_add(input.chunk(i).size(), std::memory_order_relaxed);
+                });
+            }
+            tasks.wait();
+        } catch (...) {
+            stop_progress();
+            throw;
         }
+        stop_progress();
 
-        progress_thread.join();
+        // 所有格子写完后再写划分标识，observer 见到它才会走天区索引；没写全的库不标识，查询退回全库扫描
+        if (write_failed.load()) {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            std::cerr << "Ingest incomplete, sky cell index not published" << std::endl;
+            return;
+        }
+        control = redis_pool_->acquire(executor);
+        if (!control) {
+            return;
+        }
+        c = control.get();
+        // 入库代数与划分标识一起写入，observer 的格子缓存和增量查询据此丢开上一次入库的格子
+        const std::string generation = std::to_string(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+        redisReply* grid_reply = static_cast<redisReply*>(
+            redisCommand(c, "MSET %s %s %s %s %s %s", CellStore::LAYOUT_KEY, CellStore::LayoutName(layout_),
+                         CellStore::GENERATION_KEY, generation.c_str(), SkyGrid::GRID_KEY, SkyGrid::GRID_TAG));
+        ingest_metrics().redis_roundtrips.add();
+        if (grid_reply == nullptr) {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            std::cerr << "Redis error: " << c->errstr << std::endl;
+        } else {
+            freeReplyObject(grid_reply);
+        }
 
         // 记录数据库插入后的状态
         LogDatabaseStatus(c, "database_status_after_insertion.log");
-
-        redisFree(c);
     } catch (const std::exception& e) {
         std::lock_guard<std::mutex> lock(io_mutex_);
         std::cerr << "Error: " << e.what() << std::endl;
     }
 }
 
-void Tycho2Dataset::ProcessFile(const std::string& file_path, int currentYear) {
-    redisContext* c = redisConnect(redis_host_.c_str(), redis_port_);
-    if (c == nullptr || c->err) {
-        std::lock_guard<std::mutex> lock(io_mutex_);
-        std::cerr << "Redis connection error: "
-                  << (c ? c->errstr : "can't allocate context")
-                  << std::endl;
-        return;
-    }
+void Tycho2Dataset::WriteSnapshot(const std::string& data_dir, const std::string& snapshot_path) {
+    using namespace StarSnapshotFormat;
+    const std::string pattern = data_dir + "/tyc2.dat.*";
 
-    std::ifstream fin(file_path);
-    if (!fin) {
+    try {
+        auto files = Glob(pattern);
+
+        ChunkedInput input(files);
+
+        // 与 ProcessDirectory 相同的每块一个任务，结果按块分开存放，合并顺序与线程调度无关
+        std::vector<std::vector<std::pair<int, catalog_star>>> worker_stars(input.chunkCount());
+        TaskGroup tasks;
+        for (size_t i = 0; i < input.chunkCount(); ++i) {
+            tasks.run([this, &input, &stars = worker_stars[i], i] {
+                ForEachLine(input.chunk(i), [&](std::string_view line) {
+                    try {
+                        Tycho2Entry entry = ParseLine(line);
+                        stars.emplace_back(SkyGrid::CellOf(entry.mRAdeg, entry.mDEdeg), ToCatalogStar(entry));
+                    } catch (const std::exception& e) {
+                        ingest_metrics().parse_errors.add();
+                        std::lock_guard<std::mutex> lock(io_mutex_);
+                        std::cerr << "Parse error: " << e.what() << "\nLine: " << line << std::endl;
+                    }
+                });
+            });
+        }
+        tasks.wait();
+
+        // 按格子计数排序
+        const int cell_count = SkyGrid::CellCount();
+        std::vector<uint64_t> cell_offsets(cell_count + 1, 0);
+        for (const auto& stars : worker_stars) {
+            for (const auto& [cell, s] : stars) cell_offsets[cell + 1]++;
+        }
+        for (int cell = 0; cell < cell_count; ++cell) {
+            cell_offsets[cell + 1] += cell_offsets[cell];
+        }
+        std::vector<catalog_star> records(cell_offsets[cell_count]);
+        std::vector<uint64_t> cursor(cell_offsets.begin(), cell_offsets.end() - 1);
+        for (const auto& stars : worker_stars) {
+            for (const auto& [cell, s] : stars) records[cursor[cell]++] = s;
+        }
+        // 格子内从亮到暗排，带星等极限的查询只读每个格子的前缀
+        for (int cell = 0; cell < cell_count; ++cell) {
+            std::stable_sort(records.begin() + cell_offsets[cell], records.begin() + cell_offsets[cell + 1],
+                             [](const catalog_star& a, const catalog_star& b) { return a.magnitude < b.magnitude; });
+        }
+        std::vector<unit_vector> vectors(records.size());
+        for (size_t i = 0; i < records.size(); ++i) {
+            vectors[i] = FovKernel::UnitVector(records[i].ra, records[i].dec);
+        }
+
+        SnapshotHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.cell_count = static_cast<uint32_t>(cell_count);
+        header.star_count = records.size();
+        std::strncpy(header.grid_tag, SkyGrid::GRID_TAG, sizeof(header.grid_tag) - 1);
+
+        // 先写临时文件再 rename，正在 mmap 旧快照的进程不会读到写了一半的文件
+        const std::string tmp_path = snapshot_path + ".tmp";
+        {
+            std::ofstream fout(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!fout) throw std::runtime_error("Failed to create snapshot: " + tmp_path);
+            fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            fout.write(reinterpret_cast<const char*>(cell_offsets.data()), cell_offsets.size() * sizeof(uint64_t));
+            fout.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(catalog_star));
+            fout.write(reinterpret_cast<const char*>(vectors.data()), vectors.size() * sizeof(unit_vector));
+            if (!fout) throw std::runtime_error("Failed to write snapshot: " + tmp_path);
+        }
+        if (std::rename(tmp_path.c_str(), snapshot_path.c_str()) != 0) {
+            throw std::runtime_error("Failed to rename snapshot to " + snapshot_path);
+        }
+
+        if (Metrics::Verbose()) {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            std::cout << "Snapshot written to " << snapshot_path << " (" << records.size() << " stars)" << std::endl;
+        }
+    } catch (const std::exception& e) {
         std::lock_guard<std::mutex> lock(io_mutex_);
-        std::cerr << "Failed to open: " << file_path << std::endl;
-        redisFree(c);
-        return;
+        std::cerr << "Error: " << e.what() << std::endl;
     }
+}
 
+bool Tycho2Dataset::ProcessChunk(redisContext* c, std::string_view chunk) {
+    bool ok = true;
     std::vector<std::string> redis_cmds;
     redis_cmds.reserve(batch_size_);
-    std::string line;
+    std::unordered_map<int, std::string> cell_blobs; // PackedCells 布局：格子 × 层数 + 层 -> 待追加的记录
+    size_t buffered_stars = 0;
 
-    while (std::getline(fin, line)) {
+    ForEachLine(chunk, [&](std::string_view line) {
         try {
             Tycho2Entry entry = ParseLine(line);
 
-            // 1. 根据星历把星的赤经赤纬调整到现在的位置
-            double deltaT_ra = currentYear - entry.mepRA;
-            double deltaT_de = currentYear - entry.mepDE;
-
-            // pmRA 和 pmDE 的单位是 milliarcseconds/year，需要转换为 degrees/year
-            double pmRA_deg_per_year = entry.pmRA / 3600000.0;
-            double pmDE_deg_per_year = entry.pmDE / 3600000.0;
-
-            entry.mRAdeg += pmRA_deg_per_year * deltaT_ra;
-            entry.mDEdeg += pmDE_deg_per_year * deltaT_de;
-
-            // 将赤经归一化到 0-360 度
-            while (entry.mRAdeg < 0) entry.mRAdeg += 360.0;
-            while (entry.mRAdeg >= 360.0) entry.mRAdeg -= 360.0;
+            // 1. 保留平均位置和自行，按平均位置所在的格子入库
+            catalog_star record = ToCatalogStar(entry);
+            int cell = SkyGrid::CellOf(record.ra, record.dec);
+
+            if (layout_ == StorageLayout::PackedCells) {
+                // 2'. 按格子和星等层攒成二进制记录，一次 APPEND 写入一层的新星；层是嵌套的，星写进它所在的各层
+                for (int layer = CellStore::LayerOf(record.magnitude); layer < CellStore::MAGNITUDE_LAYER_COUNT; ++layer) {
+                    CellStore::AppendRecord(cell_blobs[cell * CellStore::MAGNITUDE_LAYER_COUNT + layer], record);
+                }
+                if (++buffered_stars >= batch_size_) {
+                    ok = FlushRedisBatch(c, cell_blobs) && ok;
+                    buffered_stars = 0;
+                }
+                return;
+            }
 
-            // 2. 存到数据库里面的星只需要3个条目：赤经、赤纬、星等
+            // 2. 存到数据库里面的星：平均位置、星等、自行、平均历元
+            std::string magnitude = std::to_string(entry.V_mag);
             std::string cmd =
                 "HSET " + entry.TYC_ID +
-                " ra " + std::to_string(entry.mRAdeg) +
-                " dec " + std::to_string(entry.mDEdeg) +
-                " magnitude " + std::to_string(entry.V_mag);
+                " ra " + std::to_string(record.ra) +
+                " dec " + std::to_string(record.dec) +
+                " magnitude " + magnitude +
+                " pmra " + std::to_string(record.pm_ra) +
+                " pmdec " + std::to_string(record.pm_dec) +
+                " epra " + std::to_string(record.epoch_ra) +
+                " epdec " + std::to_string(record.epoch_dec) +
+                " bv " + std::to_string(record.color_index);
 
             redis_cmds.push_back(cmd);
 
-            if (redis_cmds.size() >= batch_size_) {
-                FlushRedisBatch(c, redis_cmds);
+            // 3. 同时把星登记到所在天区格子包含它的各星等层，查询时按格子取星。分层按查询时读回的文本星等，
+            //    与查询端的星等过滤一致
+            for (int layer = CellStore::LayerOf(static_cast<float>(std::stod(magnitude)));
+                 layer < CellStore::MAGNITUDE_LAYER_COUNT; ++layer) {
+                redis_cmds.push_back("SADD " + CellStore::CellKey(cell, layer) + " " + entry.TYC_ID);
             }
 
-            // 更新已处理行数
-            total_lines_processed.fetch_add(1, std::memory_order_relaxed);
+            if (redis_cmds.size() >= batch_size_) {
+                ok = FlushRedisBatch(c, redis_cmds) && ok;
+            }
         } catch (const std::exception& e) {
+            ingest_metrics().parse_errors.add();
             std::lock_guard<std::mutex> lock(io_mutex_);
             std::cerr << "Parse error: " << e.what()
                       << "\nLine: " << line << std::endl;
         }
-    }
+    });
 
     // 刷新剩余数据
     if (!redis_cmds.empty()) {
-        FlushRedisBatch(c, redis_cmds);
+        ok = FlushRedisBatch(c, redis_cmds) && ok;
     }
-
-    redisFree(c);
+    if (!cell_blobs.empty()) {
+        ok = FlushRedisBatch(c, cell_blobs) && ok;
+    }
+    return ok;
 }
 
-Tycho2Entry Tycho2Dataset::ParseLine(const std::string& line) {
+Tycho2Entry Tycho2Dataset::ParseLine(std::string_view line) {
     Tycho2Entry entry;
 
-    for (const auto& [name, spec] : FIELD_DEFS) {
-        if (spec.start + spec.length > line.length()) {
-            throw std::out_of_range("Field " + name + " out of line boundary");
-        }
-
-        std::string raw = line.substr(spec.start, spec.length);
-        trim(raw); // 需要实现trim函数去除空格
-
-        try {
-            if (spec.type == FieldSpec::INT) {
-                int val = raw.empty() ? 0 : std::stoi(raw);
-                if (name == "TYC1") entry.TYC1 = val;
-                else if (name == "TYC2") entry.TYC2 = val;
-                else if (name == "TYC3") entry.TYC3 = (val == 0) ? 1 : val; // 处理空值
-            } else if (spec.type == FieldSpec::DOUBLE) {
-                double val = raw.empty() ? 0.0 : std::stod(raw) * spec.scale;
-                if (name == "mRAdeg") entry.mRAdeg = val;
-                else if (name == "mDEdeg") entry.mDEdeg = val;
-                else if (name == "pmRA") entry.pmRA = val;
-                else if (name == "pmDE") entry.pmDE = val;
-                else if (name == "mepRA") entry.mepRA = val;
-                else if (name == "mepDE") entry.mepDE = val;
-                else if (name == "BT") entry.BT = val;
-                else if (name == "VT") entry.VT = val;
-            }
-        } catch (...) {
-            throw std::runtime_error("Invalid " + name + " value: " + raw);
-        }
-    }
+    entry.TYC1 = ParseIntField<TYC1_FIELD>(line, "TYC1");
+    entry.TYC2 = ParseIntField<TYC2_FIELD>(line, "TYC2");
+    entry.TYC3 = ParseIntField<TYC3_FIELD>(line, "TYC3");
+    if (entry.TYC3 == 0) entry.TYC3 = 1; // 处理空值
+    entry.mRAdeg = ParseDoubleField<MRADEG_FIELD>(line, "mRAdeg");
+    entry.mDEdeg = ParseDoubleField<MDEDEG_FIELD>(line, "mDEdeg");
+    entry.pmRA = ParseDoubleField<PMRA_FIELD>(line, "pmRA", PM_SCALE);
+    entry.pmDE = ParseDoubleField<PMDE_FIELD>(line, "pmDE", PM_SCALE);
+    entry.mepRA = ParseDoubleField<MEPRA_FIELD>(line, "mepRA");
+    entry.mepDE = ParseDoubleField<MEPDE_FIELD>(line, "mepDE");
+    entry.BT = ParseDoubleField<BT_FIELD>(line, "BT");
+    entry.VT = ParseDoubleField<VT_FIELD>(line, "VT");
 
     // 计算可视星等
     if (entry.BT > 0 && entry.VT > 0) {
         double BV = entry.BT - entry.VT;
         entry.V_mag = entry.VT - 0.090 * BV;
+        entry.BV = 0.850 * BV; // Tycho 到 Johnson 的近似换算
     } else {
         entry.V_mag = 99.9; // 无效值标记
+        entry.BV = std::numeric_limits<double>::quiet_NaN();
     }
 
-    // 生成标准TYC标识
-    entry.TYC_ID = std::to_string(entry.TYC1) + "-"
-                 + std::to_string(entry.TYC2) + "-"
-                 + std::to_string(entry.TYC3);
+    // 生成标准TYC标识，最长 "9537-12121-3"，在 std::string 的短字符串缓冲内，不分配内存
+    constexpr int INT_CHARS = 11; // int 最长 "-2147483648"
+    char id[3 * INT_CHARS + 2];
+    char* p = std::to_chars(id, id + INT_CHARS, entry.TYC1).ptr;
+    *p++ = '-';
+    p = std::to_chars(p, p + INT_CHARS, entry.TYC2).ptr;
+    *p++ = '-';
+    p = std::to_chars(p, p + INT_CHARS, entry.TYC3).ptr;
+    entry.TYC_ID.assign(id, p);
 
     return entry;
 }
 
-void Tycho2Dataset::FlushRedisBatch(redisContext* c,
+bool Tycho2Dataset::FlushRedisBatch(redisContext* c,
                                   std::vector<std::string>& cmds) {
     for (const auto& cmd : cmds) {
         if (redisAppendCommand(c, cmd.c_str()) != REDIS_OK) {
             std::lock_guard<std::mutex> lock(io_mutex_);
             std::cerr << "Redis append error: " << c->errstr << std::endl;
             cmds.clear();
-            return;
+            return false;
         }
     }
 
-    for (size_t i = 0; i < cmds.size(); ++i) {
-        redisReply* reply;
+    bool ok = ReadBatchReplies(c, cmds.size());
+    cmds.clear();
+    return ok;
+}
+
+bool Tycho2Dataset::ReadBatchReplies(redisContext* c, size_t count) {
+    bool ok = true;
+    for (size_t i = 0; i < count; ++i) {
+        redisReply* reply = nullptr;
         if (redisGetReply(c, (void**)&reply) != REDIS_OK) {
             std::lock_guard<std::mutex> lock(io_mutex_);
             std::cerr << "Redis error: " << c->errstr << std::endl;
-            freeReplyObject(reply);
-            break;
+            return false;
+        }
+        // 内存不足、键类型不对等错误回复不会断开连接，读完这一批剩下的回复再报告失败
+        if (reply->type == REDIS_REPLY_ERROR) {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            std::cerr << "Redis error: " << reply->str << std::endl;
+            ok = false;
         }
         freeReplyObject(reply);
+        ingest_metrics().redis_roundtrips.add();
     }
+    return ok;
+}
 
-    cmds.clear();
+bool Tycho2Dataset::FlushRedisBatch(redisContext* c,
+                                  std::unordered_map<int, std::string>& cell_blobs) {
+    bool ok = true;
+    size_t appended = 0;
+    for (const auto& [slot, blob] : cell_blobs) {
+        std::string key = CellStore::BlobKey(slot / CellStore::MAGNITUDE_LAYER_COUNT,
+                                             slot % CellStore::MAGNITUDE_LAYER_COUNT);
+        if (redisAppendCommand(c, "APPEND %b %b", key.data(), key.size(), blob.data(), blob.size()) != REDIS_OK) {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            std::cerr << "Redis append error: " << c->errstr << std::endl;
+            ok = false;
+            break;
+        }
+        ++appended;
+    }
+
+    ok = ReadBatchReplies(c, appended) && ok;
+    cell_blobs.clear();
+    return ok;
 }
\ No newline at end of file
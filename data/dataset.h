@@ -7,8 +7,12 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <mutex>
+#include <unordered_map>
 #include <hiredis/hiredis.h>
+#include <cell_store.h>
+#include <redis_pool.h>
 
 struct Tycho2Entry {
     // 标识符
@@ -29,27 +33,43 @@ struct Tycho2Entry {
     double BT;
     double VT;
     double V_mag;     // 计算后的可视星等
+    double BV;        // 计算后的 Johnson B−V 色指数，BT/VT 缺失时为 NaN
 };
 
 class Tycho2Dataset {
 public:
     explicit Tycho2Dataset(const std::string& redis_host = "127.0.0.1",
                            int redis_port = 6379,
-                           size_t batch_size = 1000)
+                           size_t batch_size = 1000,
+                           StorageLayout layout = StorageLayout::Hash)
         : redis_host_(redis_host),
           redis_port_(redis_port),
-          batch_size_(batch_size) {}
+          batch_size_(batch_size),
+          layout_(layout),
+          redis_pool_(RedisPool::Shared(redis_host, redis_port)) {}
 
     void ProcessDirectory(const std::string& data_dir);
+    // 不经过 Redis，直接把星表写成可 mmap 的二进制快照（格式见 star_snapshot.h）
+    void WriteSnapshot(const std::string& data_dir, const std::string& snapshot_path);
+
+    // 解析 tyc2.dat 的一行定长记录，不做任何堆分配；字段非法或越界时抛异常
+    static Tycho2Entry ParseLine(std::string_view line);
+
+    // 入库使用的连接池，默认与 observer 共用按 host:port 共享的连接池；池的大小决定同时写入的连接数
+    void setRedisPool(std::shared_ptr<RedisPool> redis_pool) { redis_pool_ = std::move(redis_pool); }
 
 private:
-    void ProcessFile(const std::string& file_path, int currentYear); // 修改了函数签名
-    Tycho2Entry ParseLine(const std::string& line);
-    void FlushRedisBatch(redisContext* c, std::vector<std::string>& cmds);
+    // 处理按换行对齐的一块输入；有命令没写进去（连接出错或 Redis 回复错误）时返回 false
+    bool ProcessChunk(redisContext* c, std::string_view chunk);
+    bool FlushRedisBatch(redisContext* c, std::vector<std::string>& cmds);
+    bool FlushRedisBatch(redisContext* c, std::unordered_map<int, std::string>& cell_blobs); // PackedCells 布局
+    bool ReadBatchReplies(redisContext* c, size_t count); // 读回一批流水线命令的回复，全部成功时返回 true
 
     const std::string redis_host_;
     const int redis_port_;
     const size_t batch_size_;
+    const StorageLayout layout_;
+    std::shared_ptr<RedisPool> redis_pool_;
     std::mutex io_mutex_;
 };
 
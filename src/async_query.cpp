@@ -0,0 +1,384 @@
+//
+// Created by viking on 2025/4/10.
+//
+
+#include "async_query.h"
+#include "epoch_kernel.h"
+#include "fov_kernel.h"
+#include "metrics.h"
+#include "sky_grid.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+    constexpr std::size_t CULL_BATCH_SIZE = 1024; // 解码时每攒够这么多颗候选星筛选一次
+
+    struct AsyncMetrics {
+        Metrics::Counter& queries;
+        Metrics::Counter& stars_scanned;
+        Metrics::Counter& stars_returned;
+        Metrics::Counter& redis_roundtrips;
+        Metrics::Counter& redis_bytes_read;
+        Metrics::Histogram& query_seconds;
+    };
+
+    // 与同步查询共用扫描、返回和 Redis 流量的计数器，另外单独记录异步查询的次数和从提交到交付的时间
+    AsyncMetrics& async_metrics() {
+        static AsyncMetrics metrics{
+            Metrics::Registry::Global().counter("starsim_async_queries_total", "Field-of-view queries completed by the async engine"),
+            Metrics::Registry::Global().counter("starsim_stars_scanned_total", "Candidate stars propagated and tested against the field of view"),
+            Metrics::Registry::Global().counter("starsim_stars_returned_total", "Stars returned by field-of-view queries"),
+            Metrics::Registry::Global().counter("starsim_redis_roundtrips_total", "Redis replies read, one per pipelined command"),
+            Metrics::Registry::Global().counter("starsim_redis_bytes_read_total", "Payload bytes in Redis replies"),
+            Metrics::Registry::Global().histogram("starsim_async_query_seconds", "Time from submit to delivery of one async query"),
+        };
+        return metrics;
+    }
+}
+
+struct AsyncQueryEngine::CellRequest {
+    Query* query;
+    std::size_t slot; // 格子在 cells 里的位置
+};
+
+struct AsyncQueryEngine::Query {
+    std::vector<int> cells;
+    FovKernel::FieldOfView fov;
+    double epoch;
+    double magnitude_limit;
+    Callback callback;
+    std::chrono::steady_clock::time_point submitted;
+
+    // 以下由事件循环线程写入，回复到齐后交给 Executor 上的任务
+    StorageLayout layout = StorageLayout::None;
+    std::vector<CellRequest> requests;
+    std::vector<std::vector<catalog_star>> records; // 按格子顺序；回调里趁回复还在缓存里解码，比攒着回复快
+    std::size_t remaining = 0;
+    std::string error; // 第一个出错原因，空表示所有格子都读到了
+
+    void fail(const std::string& reason) {
+        if (error.empty()) error = reason;
+    }
+};
+
+AsyncQueryEngine::AsyncQueryEngine(const std::string& host, int port, std::size_t connections)
+    : host_(host), port_(port), connections_(std::max<std::size_t>(1, connections)) {
+    for (Connection& conn : connections_) conn.engine = this;
+    if (pipe(wake_fds_) != 0) {
+        std::cerr << "AsyncQueryEngine: cannot create wake pipe" << std::endl;
+        wake_fds_[0] = wake_fds_[1] = -1;
+    }
+    for (int fd : wake_fds_) {
+        if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    loop_ = std::thread([this] { run(); });
+}
+
+AsyncQueryEngine::~AsyncQueryEngine() {
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        stopping_ = true;
+    }
+    char byte = 0;
+    if (wake_fds_[1] >= 0 && write(wake_fds_[1], &byte, 1) < 0 && errno != EAGAIN) {
+        std::cerr << "AsyncQueryEngine: cannot wake event loop" << std::endl;
+    }
+    loop_.join();
+    completions_.waitAll(); // 回调的异常已在各自的任务里处理，这里不会再抛出
+    for (int fd : wake_fds_) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void AsyncQueryEngine::submit(const observer& obs, Callback callback) {
+    auto query = std::make_unique<Query>();
+    query->cells = obs.cellsInView();
+    query->fov = obs.fieldOfView();
+    query->epoch = obs.getEpoch();
+    query->magnitude_limit = obs.getMagnitudeLimit();
+    query->callback = std::move(callback);
+    query->submitted = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        inbox_.push_back(std::move(query));
+    }
+    char byte = 0;
+    if (wake_fds_[1] >= 0 && write(wake_fds_[1], &byte, 1) < 0 && errno != EAGAIN) {
+        std::cerr << "AsyncQueryEngine: cannot wake event loop" << std::endl;
+    }
+}
+
+std::future<std::vector<star>> AsyncQueryEngine::submit(const observer& obs) {
+    auto promise = std::make_shared<std::promise<std::vector<star>>>();
+    std::future<std::vector<star>> result = promise->get_future();
+    submit(obs, [promise](std::vector<star>&& stars, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(stars));
+        }
+    });
+    return result;
+}
+
+bool AsyncQueryEngine::connect(Connection& conn) {
+    redisOptions options = {};
+    REDIS_OPTIONS_SET_TCP(&options, host_.c_str(), port_);
+    redisAsyncContext* context = redisAsyncConnectWithOptions(&options);
+    if (context == nullptr || context->err) {
+        std::cerr << "AsyncQueryEngine: cannot connect to Redis at " << host_ << ":" << port_ << ": "
+                  << (context ? context->errstr : "out of memory") << std::endl;
+        if (context) redisAsyncFree(context);
+        return false;
+    }
+    conn.context = context;
+    conn.reading = conn.writing = false;
+    conn.outstanding = 0;
+    context->data = &conn;
+    // poll 适配器：hiredis 通过这些回调告诉我们要等读还是等写，事件循环据此组装 pollfd
+    context->ev.data = &conn;
+    context->ev.addRead = [](void* privdata) { static_cast<Connection*>(privdata)->reading = true; };
+    context->ev.delRead = [](void* privdata) { static_cast<Connection*>(privdata)->reading = false; };
+    context->ev.addWrite = [](void* privdata) { static_cast<Connection*>(privdata)->writing = true; };
+    context->ev.delWrite = [](void* privdata) { static_cast<Connection*>(privdata)->writing = false; };
+    context->ev.cleanup = [](void* privdata) {
+        // 上下文被 hiredis 释放（断开或连接失败），下次分派时重连
+        Connection* owner = static_cast<Connection*>(privdata);
+        owner->context = nullptr;
+        owner->reading = owner->writing = false;
+    };
+    redisAsyncSetConnectCallback(context, onConnect);
+    redisAsyncSetDisconnectCallback(context, onDisconnect);
+    return true;
+}
+
+void AsyncQueryEngine::onConnect(const redisAsyncContext* context, int status) {
+    if (status != REDIS_OK) {
+        std::cerr << "AsyncQueryEngine: connection failed: " << context->errstr << std::endl;
+    }
+}
+
+void AsyncQueryEngine::onDisconnect(const redisAsyncContext* context, int status) {
+    if (status != REDIS_OK) {
+        std::cerr << "AsyncQueryEngine: connection lost: " << context->errstr << std::endl;
+    }
+}
+
+// 未完成命令最少的连接；全部断开时先尝试重连
+AsyncQueryEngine::Connection* AsyncQueryEngine::pickConnection() {
+    Connection* best = nullptr;
+    for (Connection& conn : connections_) {
+        if (conn.context != nullptr && (best == nullptr || conn.outstanding < best->outstanding)) best = &conn;
+    }
+    if (best != nullptr) return best;
+    for (Connection& conn : connections_) {
+        if (connect(conn) && best == nullptr) best = &conn;
+    }
+    return best;
+}
+
+void AsyncQueryEngine::requestLayout() {
+    Connection* conn = pickConnection();
+    if (conn != nullptr &&
+        redisAsyncCommand(conn->context, onLayoutReply, this, "MGET %s %s", SkyGrid::GRID_KEY,
+                          CellStore::LAYOUT_KEY) == REDIS_OK) {
+        ++conn->outstanding;
+        layout_pending_ = true;
+        return;
+    }
+    failParked("cannot connect to Redis");
+}
+
+void AsyncQueryEngine::failParked(const std::string& reason) {
+    while (!parked_.empty()) {
+        Query* query = parked_.front().release();
+        parked_.pop_front();
+        query->fail(reason);
+        complete(query);
+    }
+}
+
+void AsyncQueryEngine::onLayoutReply(redisAsyncContext* context, void* reply, void* privdata) {
+    AsyncQueryEngine* engine = static_cast<AsyncQueryEngine*>(privdata);
+    --static_cast<Connection*>(context->data)->outstanding;
+    engine->layout_pending_ = false;
+    redisReply* layout_reply = static_cast<redisReply*>(reply);
+    if (layout_reply == nullptr) {
+        engine->failParked("connection lost while reading the sky cell index"); // 连接断开或引擎停止
+        return;
+    }
+    engine->layout_ = CellStore::LayoutFromReply(layout_reply);
+    if (engine->layout_ == StorageLayout::None) {
+        std::cerr << "AsyncQueryEngine: database has no sky cell index, use observer::FileterStarInView" << std::endl;
+        engine->failParked("database has no sky cell index"); // 下一个查询会重新读取布局
+        return;
+    }
+    std::deque<std::unique_ptr<Query>> parked;
+    parked.swap(engine->parked_);
+    for (std::unique_ptr<Query>& query : parked) {
+        engine->dispatch(std::move(query));
+    }
+}
+
+// 每个格子一条命令，只读星等极限需要的那一层。命令分给未完成命令最少的连接，hiredis 把同一连接上的命令攒在
+// 输出缓冲区里，可写时一次写出，相当于自动流水线
+void AsyncQueryEngine::dispatch(std::unique_ptr<Query> owned) {
+    if (layout_ == StorageLayout::None) {
+        parked_.push_back(std::move(owned));
+        if (!layout_pending_) requestLayout();
+        return;
+    }
+
+    Query* query = owned.release(); // 回复到齐后由 complete 交给 Executor 上的任务
+    query->layout = layout_;
+    const int layer = CellStore::LayerFor(query->magnitude_limit);
+    query->requests.resize(query->cells.size());
+    query->records.resize(query->cells.size());
+    query->remaining = query->cells.size() + 1; // 多出的一个在发送完后扣掉，防止发送途中就完成
+    for (std::size_t i = 0; i < query->cells.size(); ++i) {
+        query->requests[i] = CellRequest{query, i};
+        Connection* conn = pickConnection();
+        int status = REDIS_ERR;
+        if (conn != nullptr) {
+            if (layout_ == StorageLayout::PackedCells) {
+                std::string blob_key = CellStore::BlobKey(query->cells[i], layer);
+                status = redisAsyncCommand(conn->context, onCellReply, &query->requests[i], "GET %b",
+                                           blob_key.data(), blob_key.size());
+            } else {
+                std::string cell_key = CellStore::CellKey(query->cells[i], layer);
+                status = redisAsyncCommand(conn->context, onCellReply, &query->requests[i],
+                                           CellStore::CELL_FIELDS_COMMAND, cell_key.c_str());
+            }
+        }
+        if (status == REDIS_OK) {
+            ++conn->outstanding;
+        } else {
+            query->fail("cannot send sky cell request");
+            --query->remaining;
+        }
+    }
+    if (--query->remaining == 0) complete(query);
+}
+
+// 在事件循环里解码成星表条目，回复随后由 hiredis 释放
+void AsyncQueryEngine::onCellReply(redisAsyncContext* context, void* reply, void* privdata) {
+    --static_cast<Connection*>(context->data)->outstanding;
+    CellRequest* request = static_cast<CellRequest*>(privdata);
+    Query* query = request->query;
+    redisReply* cell_reply = static_cast<redisReply*>(reply);
+    if (cell_reply == nullptr) {
+        query->fail("connection lost while fetching sky cells"); // 连接断开或引擎停止
+    } else if (cell_reply->type == REDIS_REPLY_ERROR) {
+        std::cerr << "Redis error while fetching sky cells: " << cell_reply->str << std::endl;
+        query->fail(std::string("Redis error while fetching sky cells: ") + cell_reply->str);
+    } else {
+        async_metrics().redis_roundtrips.add();
+        async_metrics().redis_bytes_read.add(CellStore::ReplyBytes(cell_reply));
+        std::vector<catalog_star>& records = query->records[request->slot];
+        const double magnitude_limit = query->magnitude_limit;
+        CellStore::ForEachCellRecord(cell_reply, query->layout, [&](const catalog_star& record) {
+            if (record.magnitude <= magnitude_limit) records.push_back(record);
+        });
+    }
+    if (--query->remaining == 0) static_cast<Connection*>(context->data)->engine->complete(query);
+}
+
+// 在 Executor 上按格子顺序筛选视场并交付，与同步查询的 fetch_cells / fetch_packed_cells 结果相同。
+// 筛选或回调抛出的异常只影响这一个查询：筛选出错交给回调，回调自己抛出的异常打印后丢弃
+void AsyncQueryEngine::complete(Query* query) {
+    completions_.run([query] {
+        std::unique_ptr<Query> owned(query);
+        AsyncMetrics& metrics = async_metrics();
+        std::vector<star> stars;
+        std::exception_ptr error;
+        try {
+            StarBatch batch;
+            auto cull = [&] {
+                metrics.stars_scanned.add(batch.size());
+                FovKernel::Cull(batch, query->fov, query->epoch, stars, query->magnitude_limit);
+                batch.clear();
+            };
+            for (std::vector<catalog_star>& records : query->records) {
+                for (const catalog_star& record : records) batch.push_back(record);
+                std::vector<catalog_star>().swap(records);
+                if (batch.size() >= CULL_BATCH_SIZE) cull();
+            }
+            cull();
+            if (!query->error.empty()) {
+                error = std::make_exception_ptr(std::runtime_error("AsyncQueryEngine: query incomplete: " + query->error));
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        metrics.queries.add();
+        metrics.stars_returned.add(stars.size());
+        metrics.query_seconds.observe(
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - query->submitted).count());
+        try {
+            query->callback(std::move(stars), error);
+        } catch (const std::exception& e) {
+            std::cerr << "AsyncQueryEngine: query callback threw: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "AsyncQueryEngine: query callback threw an unknown exception" << std::endl;
+        }
+    });
+}
+
+void AsyncQueryEngine::run() {
+    for (Connection& conn : connections_) connect(conn);
+
+    std::vector<pollfd> fds;
+    std::vector<Connection*> polled;
+    for (;;) {
+        std::deque<std::unique_ptr<Query>> incoming;
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(inbox_mutex_);
+            incoming.swap(inbox_);
+            stopping = stopping_;
+        }
+        for (std::unique_ptr<Query>& query : incoming) {
+            dispatch(std::move(query));
+        }
+        if (stopping) break;
+
+        fds.clear();
+        polled.clear();
+        fds.push_back(pollfd{wake_fds_[0], POLLIN, 0});
+        for (Connection& conn : connections_) {
+            if (conn.context == nullptr || !(conn.reading || conn.writing)) continue;
+            short events = static_cast<short>((conn.reading ? POLLIN : 0) | (conn.writing ? POLLOUT : 0));
+            fds.push_back(pollfd{conn.context->c.fd, events, 0});
+            polled.push_back(&conn);
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "AsyncQueryEngine: poll failed" << std::endl;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char buffer[64];
+            while (read(wake_fds_[0], buffer, sizeof(buffer)) > 0) {}
+        }
+        for (std::size_t i = 0; i < polled.size(); ++i) {
+            Connection& conn = *polled[i];
+            short revents = fds[i + 1].revents;
+            redisAsyncContext* context = conn.context;
+            // 读回调可能断开并释放上下文，释放后 cleanup 会把 conn.context 置空
+            if (context != nullptr && (revents & (POLLIN | POLLHUP | POLLERR))) redisAsyncHandleRead(context);
+            if (conn.context == context && context != nullptr && (revents & POLLOUT)) redisAsyncHandleWrite(context);
+        }
+    }
+
+    // 停止：释放上下文时 hiredis 以空回复调用所有未完成的回调，对应的查询随之结束
+    for (Connection& conn : connections_) {
+        if (conn.context != nullptr) redisAsyncFree(conn.context);
+    }
+    failParked("query engine stopped");
+}
@@ -0,0 +1,92 @@
+//
+// Created by viking on 2025/4/10.
+//
+
+#ifndef ASYNC_QUERY_H
+#define ASYNC_QUERY_H
+
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <common.h>
+#include <cell_store.h>
+#include <executor.h>
+#include <observer.h>
+#include <hiredis/async.h>
+
+// 基于 hiredis 异步接口的视场查询引擎，用于同时服务大量 observer。
+// 一个事件循环线程用 poll 驱动少量长连接（自带 poll 适配器，不依赖 libevent 等外部库），
+// 各查询的格子请求在这些连接上多路复用。回复在事件循环里解码，一个查询的回复到齐后
+// 在 Executor 上筛选视场，再通过回调或 future 交付。并发查询数与线程数无关，I/O 只占一个线程。
+// 只支持有天区索引的数据库（Hash 或 PackedCells 布局），没有索引的旧数据库请用 observer 的全库扫描。
+class AsyncQueryEngine {
+public:
+    // error 为空表示查询成功；不为空时 stars 只是已经取到的部分（连接断开、Redis 回复错误、数据库没有天区索引等）
+    using Callback = std::function<void(std::vector<star>&& stars, std::exception_ptr error)>;
+    static constexpr std::size_t DEFAULT_CONNECTIONS = 4;
+
+    AsyncQueryEngine(const std::string& host = "127.0.0.1", int port = 6379,
+                     std::size_t connections = DEFAULT_CONNECTIONS);
+    ~AsyncQueryEngine(); // 停止事件循环并等待所有回调执行完；还没收到的回复按出错处理
+    AsyncQueryEngine(const AsyncQueryEngine&) = delete;
+    AsyncQueryEngine& operator=(const AsyncQueryEngine&) = delete;
+
+    // 按 observer 当前的视场和历元提交查询后立即返回，之后修改或销毁 observer 不影响这次查询。
+    // 结果与 FileterStarInView 相同（含顺序）。回调在 Executor 的工作线程上执行，不同查询的回调可能并发。
+    // Redis 出错时回调收到已经取到的部分和描述出错原因的异常，future 版本则由 get() 抛出这个异常。
+    // 回调抛出的异常打印后丢弃，不影响其他查询和析构
+    void submit(const observer& obs, Callback callback);
+    std::future<std::vector<star>> submit(const observer& obs);
+
+private:
+    struct Query;
+    struct CellRequest;
+
+    // 一个异步连接及其在 poll 里关心的事件，由 hiredis 通过 ev 回调维护
+    struct Connection {
+        AsyncQueryEngine* engine = nullptr;
+        redisAsyncContext* context = nullptr;
+        bool reading = false;
+        bool writing = false;
+        std::size_t outstanding = 0; // 已发送、尚未收到回复的命令数
+    };
+
+    void run();
+    bool connect(Connection& conn);
+    Connection* pickConnection();
+    void requestLayout();
+    void failParked(const std::string& reason); // 等布局的查询以空结果和出错原因结束
+    void dispatch(std::unique_ptr<Query> query);
+    void complete(Query* query);
+
+    static void onConnect(const redisAsyncContext* context, int status);
+    static void onDisconnect(const redisAsyncContext* context, int status);
+    static void onLayoutReply(redisAsyncContext* context, void* reply, void* privdata);
+    static void onCellReply(redisAsyncContext* context, void* reply, void* privdata);
+
+    const std::string host_;
+    const int port_;
+    std::vector<Connection> connections_;
+
+    // 以下只在事件循环线程里访问
+    StorageLayout layout_ = StorageLayout::None;
+    bool layout_pending_ = false;             // MGET 已发出，还没有回复
+    std::deque<std::unique_ptr<Query>> parked_; // 等布局确定的查询
+
+    std::mutex inbox_mutex_;
+    std::deque<std::unique_ptr<Query>> inbox_; // submit 放进来，事件循环取走
+    bool stopping_ = false;
+    int wake_fds_[2] = {-1, -1};               // 自唤醒管道，submit 和析构时写一个字节打断 poll
+
+    TaskGroup completions_; // 解码和筛选任务，析构时等待
+    std::thread loop_;
+};
+
+#endif //ASYNC_QUERY_H
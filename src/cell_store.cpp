@@ -0,0 +1,117 @@
+//
+// Created by viking on 2025/3/27.
+//
+
+#include "cell_store.h"
+#include "sky_grid.h"
+#include <charconv>
+#include <limits>
+#include <system_error>
+#include <hiredis/hiredis.h>
+
+namespace CellStore {
+
+const char* LayoutName(StorageLayout layout) {
+    switch (layout) {
+        case StorageLayout::Hash: return "hash-v2"; // v1 不分星等层，已不再支持
+        case StorageLayout::PackedCells: return "packed-v4"; // v1 不含自行、v2 不含色指数、v3 不分星等层，已不再支持
+        default: return "none";
+    }
+}
+
+StorageLayout LayoutFromName(const std::string& name) {
+    if (name == "hash-v2") return StorageLayout::Hash;
+    if (name == "packed-v4") return StorageLayout::PackedCells;
+    return StorageLayout::None;
+}
+
+int LayerOf(float magnitude) {
+    int layer = 0;
+    while (layer < MAGNITUDE_LAYER_COUNT - 1 && !(magnitude <= MAGNITUDE_LAYER_LIMITS[layer])) ++layer;
+    return layer;
+}
+
+int LayerFor(double magnitude_limit) {
+    int layer = 0;
+    while (layer < MAGNITUDE_LAYER_COUNT - 1 && !(magnitude_limit <= MAGNITUDE_LAYER_LIMITS[layer])) ++layer;
+    return layer;
+}
+
+std::string CellKey(int cell, int layer) {
+    return SkyGrid::CellKey(cell) + ":m" + std::to_string(layer);
+}
+
+std::string BlobKey(int cell, int layer) {
+    return BLOB_KEY_PREFIX + std::to_string(cell) + ":m" + std::to_string(layer);
+}
+
+StorageLayout LayoutFromReply(const redisReply* reply) {
+    if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements < 2 ||
+        reply->element[0]->type != REDIS_REPLY_STRING ||
+        std::string(reply->element[0]->str, reply->element[0]->len) != SkyGrid::GRID_TAG) {
+        return StorageLayout::None;
+    }
+    // 早期入库只写了划分标识、没有布局键的是不分层的 hash 布局，与其他旧布局一样需要重新入库，在此之前全库扫描
+    return reply->element[1]->type == REDIS_REPLY_STRING
+               ? LayoutFromName(std::string(reply->element[1]->str, reply->element[1]->len))
+               : StorageLayout::None;
+}
+
+Source SourceFromReply(const redisReply* reply) {
+    Source source;
+    source.layout = LayoutFromReply(reply);
+    if (source.layout == StorageLayout::None || reply->elements < 3 ||
+        reply->element[2]->type != REDIS_REPLY_STRING) {
+        return source;
+    }
+    const char* first = reply->element[2]->str;
+    const char* last = first + reply->element[2]->len;
+    uint64_t generation = 0;
+    auto [ptr, ec] = std::from_chars(first, last, generation);
+    if (ec == std::errc() && ptr == last) source.generation = generation;
+    return source;
+}
+
+namespace {
+    // 整个字段是一个数（入库时 std::to_string 写出的格式，包括 "nan"）才算解析成功，不抛异常
+    bool ParseField(const redisReply* field, double& value) {
+        if (field->type != REDIS_REPLY_STRING) return false;
+        const char* first = field->str;
+        const char* last = field->str + field->len;
+        if (first != last && *first == '+') ++first;
+        auto [ptr, ec] = std::from_chars(first, last, value);
+        return ec == std::errc() && ptr == last;
+    }
+}
+
+bool ParseStoredFields(redisReply* const* fields, catalog_star& out) {
+    double ra, dec, magnitude;
+    if (!ParseField(fields[0], ra) || !ParseField(fields[1], dec) || !ParseField(fields[2], magnitude)) {
+        return false;
+    }
+    double optional[5] = {0.0, 0.0, 2000.0, 2000.0, std::numeric_limits<double>::quiet_NaN()};
+    for (std::size_t k = 3; k < STORED_FIELD_COUNT; ++k) {
+        if (fields[k]->type != REDIS_REPLY_NIL && !ParseField(fields[k], optional[k - 3])) return false;
+    }
+    out.ra = ra;
+    out.dec = dec;
+    out.magnitude = static_cast<float>(magnitude);
+    out.pm_ra = static_cast<float>(optional[0]);
+    out.pm_dec = static_cast<float>(optional[1]);
+    out.epoch_ra = static_cast<float>(optional[2]);
+    out.epoch_dec = static_cast<float>(optional[3]);
+    out.color_index = static_cast<float>(optional[4]);
+    return true;
+}
+
+std::size_t ReplyBytes(const redisReply* reply) {
+    if (reply == nullptr) return 0;
+    if (reply->type == REDIS_REPLY_ARRAY) {
+        std::size_t bytes = 0;
+        for (std::size_t i = 0; i < reply->elements; ++i) bytes += ReplyBytes(reply->element[i]);
+        return bytes;
+    }
+    return reply->type == REDIS_REPLY_STRING ? reply->len : 0;
+}
+
+}
@@ -0,0 +1,149 @@
+//
+// Created by viking on 2025/3/27.
+//
+
+#ifndef CELL_STORE_H
+#define CELL_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <common.h>
+#include <hiredis/hiredis.h>
+
+// 星表在 Redis 中的存储布局
+enum class StorageLayout {
+    None,        // 没有天区索引（旧数据库），只能全库扫描
+    Hash,        // 每颗星一个 hash（平均位置、星等、自行、历元、色指数的文本），外加各星等层的成员集合 sky:<cell>:m<layer>
+    PackedCells, // 每个格子每个星等层一个二进制串 skyblob:<cell>:m<layer>，定长小端记录（含自行、历元和色指数）
+};
+
+namespace CellStore {
+    constexpr const char* LAYOUT_KEY = "sky:layout";     // 存放布局名称的键
+    constexpr const char* GENERATION_KEY = "sky:generation"; // 入库代数：发布索引时写入的时间戳（纳秒），每次入库都不同
+    constexpr const char* BLOB_KEY_PREFIX = "skyblob:";  // 格子二进制串 skyblob:<cell>:m<layer>
+
+    // 星等分层：每个格子存 MAGNITUDE_LAYER_COUNT 层，第 k 层是星等不超过 LIMITS[k] 的全部星，最后一层是整个格子。
+    // 层是嵌套的，带星等极限的查询每个格子只读 LayerFor(limit) 一个键；Tycho-2 的 250 万颗星里 6 等以内只有几千颗、
+    // 10 等以内不到两成，浅而宽的视场读的数据少两到三个数量级，多存的前几层也不到两成
+    constexpr float MAGNITUDE_LAYER_LIMITS[] = {6.0f, 8.0f, 10.0f};
+    constexpr int MAGNITUDE_LAYER_COUNT = static_cast<int>(std::size(MAGNITUDE_LAYER_LIMITS)) + 1;
+
+    // hash 布局每颗星存储的字段：平均位置、星等、自行、平均历元、色指数
+    constexpr std::size_t STORED_FIELD_COUNT = 8;
+    // 一次取出格子一层 sky:<cell>:m<layer> 内所有星的存储字段，%s 为成员集合的键
+    constexpr const char* CELL_FIELDS_COMMAND = "SORT %s BY nosort GET *->ra GET *->dec GET *->magnitude "
+                                                "GET *->pmra GET *->pmdec GET *->epra GET *->epdec GET *->bv";
+
+    // 定长记录：ra(f64) dec(f64) magnitude(f32) pm_ra(f32) pm_dec(f32) epoch_ra(f32) epoch_dec(f32)
+    // color_index(f32)，小端
+    constexpr std::size_t RECORD_SIZE = 8 + 8 + 6 * 4;
+
+    const char* LayoutName(StorageLayout layout);
+    StorageLayout LayoutFromName(const std::string& name);
+
+    int LayerOf(float magnitude);          // 包含这颗星的最内层，它也在之后的各层里；无效星等 99.9 只在最后一层
+    int LayerFor(double magnitude_limit);  // 包含所有不暗于 magnitude_limit 的星的最内层
+    std::string CellKey(int cell, int layer); // Hash 布局的格子成员集合
+    std::string BlobKey(int cell, int layer); // PackedCells 布局的格子二进制串
+
+    // 查询时读到的数据库内容：布局加入库代数。进程内的格子缓存和增量查询按它区分重新入库、换布局前后的数据
+    struct Source {
+        StorageLayout layout = StorageLayout::None;
+        uint64_t generation = 0; // 早期入库没有写代数的为 0
+        bool operator==(const Source& other) const {
+            return layout == other.layout && generation == other.generation;
+        }
+        bool operator!=(const Source& other) const { return !(*this == other); }
+    };
+
+    // MGET sky:grid sky:layout 的回复对应的布局，天区划分标识不一致时为 None；回复里多出的键忽略
+    StorageLayout LayoutFromReply(const redisReply* reply);
+    // MGET sky:grid sky:layout sky:generation 的回复
+    Source SourceFromReply(const redisReply* reply);
+
+    // 把 STORED_FIELD_COUNT 个文本字段解析成星表条目。位置或星等缺失、任何字段不是数字时返回 false，
+    // 不抛异常，可以在 hiredis 的异步回调里调用；自行缺失的是早期入库时已推算过位置的数据，按零自行处理；
+    // 色指数缺失记为 NaN
+    bool ParseStoredFields(redisReply* const* fields, catalog_star& out);
+
+    // 回复里字符串负载的字节数，数组递归累加
+    std::size_t ReplyBytes(const redisReply* reply);
+
+    inline void StoreLE(char* p, uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; ++i, v >>= 8) p[i] = static_cast<char>(v & 0xff);
+    }
+
+    inline uint64_t LoadLE(const char* p, int bytes) {
+        uint64_t v = 0;
+        for (int i = bytes - 1; i >= 0; --i) v = (v << 8) | static_cast<unsigned char>(p[i]);
+        return v;
+    }
+
+    inline void StoreF64(char* p, double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        StoreLE(p, bits, 8);
+    }
+
+    inline void StoreF32(char* p, float v) {
+        uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        StoreLE(p, bits, 4);
+    }
+
+    inline double LoadF64(const char* p) {
+        uint64_t bits = LoadLE(p, 8);
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    inline float LoadF32(const char* p) {
+        uint32_t bits = static_cast<uint32_t>(LoadLE(p, 4));
+        float v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    // 把一颗星编码后追加到 blob 末尾
+    inline void AppendRecord(std::string& blob, const catalog_star& s) {
+        char record[RECORD_SIZE];
+        StoreF64(record, s.ra);
+        StoreF64(record + 8, s.dec);
+        StoreF32(record + 16, s.magnitude);
+        StoreF32(record + 20, s.pm_ra);
+        StoreF32(record + 24, s.pm_dec);
+        StoreF32(record + 28, s.epoch_ra);
+        StoreF32(record + 32, s.epoch_dec);
+        StoreF32(record + 36, s.color_index);
+        blob.append(record, RECORD_SIZE);
+    }
+
+    // 解码 blob 中的全部记录，对每颗星调用 fn；末尾不足一条记录的字节被忽略
+    template <typename Fn>
+    void ForEachRecord(const char* data, std::size_t len, Fn&& fn) {
+        for (std::size_t off = 0; off + RECORD_SIZE <= len; off += RECORD_SIZE) {
+            const char* p = data + off;
+            fn(catalog_star{LoadF64(p), LoadF64(p + 8), LoadF32(p + 16), LoadF32(p + 20), LoadF32(p + 24),
+                            LoadF32(p + 28), LoadF32(p + 32), LoadF32(p + 36)});
+        }
+    }
+
+    // 解码一个格子的回复（Hash 布局是 CELL_FIELDS_COMMAND 的数组，PackedCells 是 skyblob 串），对每颗星调用 fn
+    template <typename Fn>
+    void ForEachCellRecord(const redisReply* reply, StorageLayout layout, Fn&& fn) {
+        if (layout == StorageLayout::PackedCells) {
+            if (reply->type == REDIS_REPLY_STRING) ForEachRecord(reply->str, reply->len, fn);
+        } else if (reply->type == REDIS_REPLY_ARRAY) {
+            for (std::size_t j = 0; j + STORED_FIELD_COUNT <= reply->elements; j += STORED_FIELD_COUNT) {
+                catalog_star record;
+                if (ParseStoredFields(reply->element + j, record)) fn(record);
+            }
+        }
+    }
+}
+
+#endif //CELL_STORE_H
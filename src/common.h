@@ -5,10 +5,42 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <cstdint>
+#include <limits>
+
 struct star {
     double ra;
     double dec;
     double magnitude;
+    double color_index = std::numeric_limits<double>::quiet_NaN(); // B−V 色指数，未知时为 NaN
+};
+
+// star 的紧凑存储形式（12 字节），用于保存大的查询结果、缓存和传输，渲染时再换回 star。
+// 量化方式和精度见 compact_star.h
+struct compact_star {
+    uint32_t ra;         // 赤经，单位 360/2^32 度
+    int32_t dec;         // 赤纬，单位同赤经
+    int16_t magnitude;   // 毫星等
+    int16_t color_index; // B−V（毫星等），未知时为 CompactStar::UNKNOWN_COLOR
+};
+
+// 星表中存储的条目：平均位置、自行和平均历元，查询时再推到观测历元
+struct catalog_star {
+    double ra;          // 平均赤经（度）
+    double dec;         // 平均赤纬（度）
+    float magnitude;
+    float pm_ra;        // 赤经自行 dα/dt（毫角秒/年，已除以 cosδ）
+    float pm_dec;       // 赤纬自行（毫角秒/年）
+    float epoch_ra;     // 赤经平均历元（年）
+    float epoch_dec;    // 赤纬平均历元（年）
+    float color_index;  // Johnson B−V，由 BT−VT 换算，未知时为 NaN
+};
+
+// 平均位置在赤道坐标系下的单位向量，x 指向春分点，z 指向北天极
+struct unit_vector {
+    float x;
+    float y;
+    float z;
 };
 
 #endif //COMMON_H
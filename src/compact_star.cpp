@@ -0,0 +1,48 @@
+//
+// Created by viking on 2025/4/13.
+//
+
+#include "compact_star.h"
+#include "cell_store.h"
+
+namespace CompactStar {
+
+void PackAll(const std::vector<star>& stars, std::vector<compact_star>& out) {
+    out.reserve(out.size() + stars.size());
+    for (const star& s : stars) out.push_back(Pack(s));
+}
+
+std::vector<star> UnpackAll(const std::vector<compact_star>& stars) {
+    std::vector<star> out;
+    out.reserve(stars.size());
+    for (const compact_star& s : stars) out.push_back(Unpack(s));
+    return out;
+}
+
+void AppendRecords(std::string& blob, const std::vector<compact_star>& stars) {
+    std::size_t offset = blob.size();
+    blob.resize(offset + stars.size() * RECORD_SIZE);
+    for (const compact_star& s : stars) {
+        char* p = &blob[offset];
+        CellStore::StoreLE(p, s.ra, 4);
+        CellStore::StoreLE(p + 4, static_cast<uint32_t>(s.dec), 4);
+        CellStore::StoreLE(p + 8, static_cast<uint16_t>(s.magnitude), 2);
+        CellStore::StoreLE(p + 10, static_cast<uint16_t>(s.color_index), 2);
+        offset += RECORD_SIZE;
+    }
+}
+
+std::vector<compact_star> DecodeRecords(const char* data, std::size_t len) {
+    std::vector<compact_star> stars;
+    stars.reserve(len / RECORD_SIZE);
+    for (std::size_t off = 0; off + RECORD_SIZE <= len; off += RECORD_SIZE) {
+        const char* p = data + off;
+        stars.push_back(compact_star{static_cast<uint32_t>(CellStore::LoadLE(p, 4)),
+                                     static_cast<int32_t>(static_cast<uint32_t>(CellStore::LoadLE(p + 4, 4))),
+                                     static_cast<int16_t>(static_cast<uint16_t>(CellStore::LoadLE(p + 8, 2))),
+                                     static_cast<int16_t>(static_cast<uint16_t>(CellStore::LoadLE(p + 10, 2)))});
+    }
+    return stars;
+}
+
+}
@@ -0,0 +1,66 @@
+//
+// Created by viking on 2025/4/13.
+//
+
+#ifndef COMPACT_STAR_H
+#define COMPACT_STAR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include <common.h>
+
+// star（4 个 double，32 字节）和 compact_star（12 字节）之间的转换。定点量化的精度：
+//   赤经、赤纬：步长 360/2^32 度 ≈ 0.30 毫角秒，误差不超过半步 0.15 毫角秒，比 Tycho-2 的位置精度（7～100 毫角秒）
+//               小两个数量级以上，任何实际分辨率下都不会让星换一个像素（除非恰好落在像素边界上）
+//   星等、色指数：步长 0.001 等，误差不超过 0.0005 等，远小于 Tycho-2 的测光误差（0.01 等以上）；
+//               超出 ±32.767 的星等（例如无效星等 99.9）饱和到边界，仍比任何星等阈值暗
+// 赤经归一化到 [0, 360)，赤纬截到 [-90, 90]。Pack 后 Unpack 不会逐位还原，渲染结果可能在个别像素上差一个灰度
+namespace CompactStar {
+    constexpr double UNITS_PER_DEGREE = 4294967296.0 / 360.0; // 2^32 / 360
+    constexpr double DEGREES_PER_UNIT = 360.0 / 4294967296.0;
+    constexpr double MAGNITUDE_UNITS = 1000.0;                // 每等的量化单位数
+    constexpr int16_t UNKNOWN_COLOR = std::numeric_limits<int16_t>::min(); // 色指数未知（NaN）
+
+    // 传输用的定长记录：ra(u32) dec(i32) magnitude(i16) color_index(i16)，小端
+    constexpr std::size_t RECORD_SIZE = 4 + 4 + 2 + 2;
+
+    static_assert(sizeof(compact_star) == RECORD_SIZE, "compact_star must stay a 12-byte record");
+
+    inline int16_t QuantizeMagnitude(double magnitude) {
+        const double limit = std::numeric_limits<int16_t>::max();
+        return static_cast<int16_t>(std::lround(std::clamp(magnitude * MAGNITUDE_UNITS, -limit, limit)));
+    }
+
+    inline compact_star Pack(const star& s) {
+        double ra = std::fmod(s.ra, 360.0);
+        if (ra < 0.0) ra += 360.0;
+        compact_star out;
+        // 接近 360 度的赤经舍入到 2^32 时回绕到 0
+        out.ra = static_cast<uint32_t>(static_cast<uint64_t>(std::llround(ra * UNITS_PER_DEGREE)));
+        out.dec = static_cast<int32_t>(std::llround(std::clamp(s.dec, -90.0, 90.0) * UNITS_PER_DEGREE));
+        out.magnitude = QuantizeMagnitude(s.magnitude);
+        out.color_index = std::isnan(s.color_index) ? UNKNOWN_COLOR : QuantizeMagnitude(s.color_index);
+        return out;
+    }
+
+    inline star Unpack(const compact_star& s) {
+        return star{s.ra * DEGREES_PER_UNIT, s.dec * DEGREES_PER_UNIT, s.magnitude / MAGNITUDE_UNITS,
+                    s.color_index == UNKNOWN_COLOR ? std::numeric_limits<double>::quiet_NaN()
+                                                   : s.color_index / MAGNITUDE_UNITS};
+    }
+
+    // 追加到 out 末尾
+    void PackAll(const std::vector<star>& stars, std::vector<compact_star>& out);
+    std::vector<star> UnpackAll(const std::vector<compact_star>& stars);
+
+    // 把记录编码后追加到 blob 末尾 / 解码 blob 中的全部记录，末尾不足一条记录的字节被忽略
+    void AppendRecords(std::string& blob, const std::vector<compact_star>& stars);
+    std::vector<compact_star> DecodeRecords(const char* data, std::size_t len);
+}
+
+#endif //COMPACT_STAR_H
@@ -3,13 +3,27 @@
 //
 
 #include "draw.h"
+#include "compact_star.h"
+#include "philox.h"
+#include "executor.h"
+#include "fov_kernel.h"
+#include "metrics.h"
 #include <algorithm>
+#include <cctype>
+#include <cfloat>
 #include <cmath>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
-#include <random>
+#include <unordered_map>
 #include <vector>
 
 namespace StarMapDrawer {
@@ -25,59 +39,460 @@ constexpr double PSF_KERNEL_SIZE_MULTIPLIER = 3.0; // PSF 核大小的倍数
 constexpr double SATURATION_MAGNITUDE = 6.0; // 饱和星等的阈值，比这个亮度高的星会发生饱和
 constexpr int REFERENCE_RESOLUTION = 512; // 参考分辨率大小
 
-// --- 随机数生成器 ---
-std::random_device rd;
-std::mt19937 gen(rd());
-std::uniform_real_distribution<> jitter(-0.2, 0.2); // 用于位置抖动
-std::uniform_real_distribution<> brightness_noise(-0.05, 0.05); // 用于亮度噪声
+// --- 随机数参数 ---
+// 抖动和噪声都取自 Philox 计数器随机数，计数器为 {块号/像素, 行, 星号, 流}，同一种子的渲染结果完全可复现
+constexpr float JITTER_RANGE = 0.2f;            // 位置抖动 [-0.2, 0.2] 像素
+constexpr float BRIGHTNESS_NOISE_RANGE = 0.05f; // 亮度噪声 [-5%, 5%]
+constexpr uint32_t JITTER_STREAM = 0;
+constexpr uint32_t NOISE_STREAM = 1;
+
+// --- 指标 ---
+struct RenderMetrics {
+    Metrics::Counter& starsDrawn;
+    Metrics::Histogram& splatSeconds;
+    Metrics::Histogram& toneMapSeconds;
+    Metrics::Histogram& encodeSeconds;
+};
+
+RenderMetrics& renderMetrics() {
+    static RenderMetrics metrics{
+        Metrics::Registry::Global().counter("starsim_render_stars_total", "Stars splatted into the accumulation buffer"),
+        Metrics::Registry::Global().histogram("starsim_render_splat_seconds", "Wall time of the tiled PSF splat pass"),
+        Metrics::Registry::Global().histogram("starsim_render_tonemap_seconds", "Wall time of normalisation and CLAHE"),
+        Metrics::Registry::Global().histogram("starsim_render_encode_seconds", "Wall time of image encoding and write"),
+    };
+    return metrics;
+}
 
 double intensityFromMagnitude(double magnitude) {
     return std::pow(10, -MAGNITUDE_SCALE * magnitude);
 }
 
-// 修改后的 drawStarMap 函数，添加 magnitudeThreshold 参数
-void drawStarMap(const std::vector<star>& stars,
-                 const std::string& outputPath,
-                 int imageWidth, int imageHeight,
-                 double centerRA, double centerDec, double fovRA, double fovDec,
-                 double magnitudeThreshold ) { // 默认阈值为 12 等星
-    cv::Mat accumulationBuffer(imageHeight, imageWidth, CV_32FC3, cv::Scalar(0, 0, 0));
+// --- 颜色模型 ---
+// B−V 到显示颜色（BGR）的分段线性近似，取自主序星的典型颜色，按三通道均值归一化，
+// 只改变色调不改变亮度。色指数未知的星按白色处理
+struct BvColor {
+    double bv;
+    double b, g, r;
+};
 
-    // 根据图像尺寸动态计算 MAX_RADIUS
-    double resolutionScale = static_cast<double>(std::max(imageWidth, imageHeight)) / REFERENCE_RESOLUTION;
-    double current_max_radius = BASE_MAX_RADIUS * resolutionScale;
-    double current_psf_fwhm_scale = BASE_PSF_FWHM_SCALE * resolutionScale; // 缩放 PSF_FWHM_SCALE
+constexpr BvColor BV_COLOR_TABLE[] = {
+    {-0.40, 255, 176, 155},
+    { 0.00, 255, 215, 202},
+    { 0.40, 255, 247, 248},
+    { 0.65, 234, 244, 255},
+    { 1.00, 181, 218, 255},
+    { 1.40, 142, 199, 255},
+    { 2.00,  81, 166, 255},
+};
 
-    for (const auto& star : stars) {
-        // 只有亮度高于阈值的恒星才会被绘制
-        if (star.magnitude > magnitudeThreshold) {
-            continue;
+cv::Vec3f colorFromBV(double bv) {
+    if (!std::isfinite(bv)) {
+        return cv::Vec3f(1.0f, 1.0f, 1.0f);
+    }
+    constexpr int n = sizeof(BV_COLOR_TABLE) / sizeof(BV_COLOR_TABLE[0]);
+    bv = std::clamp(bv, BV_COLOR_TABLE[0].bv, BV_COLOR_TABLE[n - 1].bv);
+    int i = 0;
+    while (i < n - 2 && bv > BV_COLOR_TABLE[i + 1].bv) ++i;
+    const BvColor& lo = BV_COLOR_TABLE[i];
+    const BvColor& hi = BV_COLOR_TABLE[i + 1];
+    double t = (bv - lo.bv) / (hi.bv - lo.bv);
+    double b = lo.b + t * (hi.b - lo.b);
+    double g = lo.g + t * (hi.g - lo.g);
+    double r = lo.r + t * (hi.r - lo.r);
+    double mean = (b + g + r) / 3.0;
+    return cv::Vec3f(static_cast<float>(b / mean), static_cast<float>(g / mean), static_cast<float>(r / mean));
+}
+
+// --- PSF 核缓存 ---
+// 核只由半径和分辨率缩放决定。半径按 1/RADIUS_STEPS 像素量化后，同一分辨率下的暗星几乎都落在同一个核上，
+// 预先算好归一化的 float 核，每颗星只做一次缩放累加。核的尺寸仍按精确半径计算，和逐星计算时覆盖的像素完全一致。
+// 星心取整到像素中心，所以没有亚像素偏移这一维。
+constexpr int RADIUS_STEPS = 64;
+constexpr int MAX_CACHED_KERNEL_HALF_SIZE = 256; // 更大的核只属于极少数亮星，临时计算不进缓存
+
+struct PsfKernel {
+    int halfSize = 0;           // 核覆盖 [-halfSize, halfSize]^2
+    std::vector<float> weights; // 行优先，已归一化，和为 1；为空时由 alpha 和 normalization 逐像素现算
+    double alpha = 0.0;
+    double normalization = 0.0;
+};
+
+double psfAlpha(double radius, double psfFwhmScale) {
+    const double beta = PSF_BETA;
+    const double originalFWHM = psfFwhmScale * radius;
+    const double sqrt_term = std::sqrt(std::pow(2.0, 1.0/beta) - 1.0);
+    return originalFWHM / (2.0 * sqrt_term);
+}
+
+int psfHalfSize(double alpha) {
+    return static_cast<int>(std::ceil(PSF_KERNEL_SIZE_MULTIPLIER * alpha));
+}
+
+double psfFactor(double alpha, double r2) {
+    const double beta = PSF_BETA;
+    return std::pow(1.0 + r2/(alpha*alpha), -beta);
+}
+
+PsfKernel buildPsfKernel(double alpha, int halfSize) {
+    PsfKernel kernel;
+    kernel.halfSize = halfSize;
+    kernel.alpha = alpha;
+    const int side = 2 * kernel.halfSize + 1;
+    std::vector<double> factors(static_cast<size_t>(side) * side);
+    double sumFactors = 0.0;
+    for (int dy = -kernel.halfSize; dy <= kernel.halfSize; ++dy) {
+        for (int dx = -kernel.halfSize; dx <= kernel.halfSize; ++dx) {
+            double r2 = static_cast<double>(dx)*dx + static_cast<double>(dy)*dy;
+            double factor = psfFactor(alpha, r2);
+            factors[(dy + kernel.halfSize) * side + (dx + kernel.halfSize)] = factor;
+            sumFactors += factor;
+        }
+    }
+
+    kernel.normalization = 1.0 / sumFactors;
+    kernel.weights.resize(factors.size());
+    for (size_t i = 0; i < factors.size(); ++i) {
+        kernel.weights[i] = static_cast<float>(factors[i] * kernel.normalization);
+    }
+    return kernel;
+}
+
+// 不展开权重的核：只按与 buildPsfKernel 相同的顺序求出归一化系数，splatStar 逐像素现算出相同的权重。
+// 核的边长随分辨率平方增长，条带渲染超大图像时亮星的核展开后会比条带本身大得多
+PsfKernel describePsfKernel(double alpha, int halfSize) {
+    PsfKernel kernel;
+    kernel.halfSize = halfSize;
+    kernel.alpha = alpha;
+    double sumFactors = 0.0;
+    for (int dy = -halfSize; dy <= halfSize; ++dy) {
+        for (int dx = -halfSize; dx <= halfSize; ++dx) {
+            sumFactors += psfFactor(alpha, static_cast<double>(dx)*dx + static_cast<double>(dy)*dy);
+        }
+    }
+    kernel.normalization = 1.0 / sumFactors;
+    return kernel;
+}
+
+class PsfKernelCache {
+public:
+    explicit PsfKernelCache(double resolutionScale)
+        : psfFwhmScale_(BASE_PSF_FWHM_SCALE * resolutionScale) {}
+
+    // 返回量化半径对应的核；大核写入 scratch 并返回它。expandLarge 为 false 时大核不展开权重，
+    // 只有归一化系数，和小核一样进缓存
+    const PsfKernel& get(double radius, PsfKernel& scratch, bool expandLarge = true) {
+        int halfSize = psfHalfSize(psfAlpha(radius, psfFwhmScale_));
+        int radiusKey = static_cast<int>(std::lround(radius * RADIUS_STEPS));
+        double quantizedAlpha = psfAlpha(static_cast<double>(radiusKey) / RADIUS_STEPS, psfFwhmScale_);
+        const bool large = halfSize > MAX_CACHED_KERNEL_HALF_SIZE;
+        if (large && expandLarge) {
+            scratch = buildPsfKernel(quantizedAlpha, halfSize);
+            return scratch;
+        }
+
+        int64_t key = (static_cast<int64_t>(halfSize) << 32) | static_cast<uint32_t>(radiusKey);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& kernel = large ? described_[key] : kernels_[key];
+        if (!kernel) {
+            kernel = std::make_unique<PsfKernel>(large ? describePsfKernel(quantizedAlpha, halfSize)
+                                                       : buildPsfKernel(quantizedAlpha, halfSize));
+        }
+        return *kernel;
+    }
+
+private:
+    double psfFwhmScale_;
+    std::unordered_map<int64_t, std::unique_ptr<PsfKernel>> kernels_;
+    std::unordered_map<int64_t, std::unique_ptr<PsfKernel>> described_; // 不展开权重的大核
+    std::mutex mutex_;
+};
+
+// 每种分辨率缩放一份缓存，跨 drawStarMap 调用复用。缩放只由图像长边决定，按长边的像素数取缓存；
+// 只保留最近用过的 MAX_KERNEL_CACHES 种尺寸，淘汰的缓存由还在用它的渲染持有到结束
+constexpr std::size_t MAX_KERNEL_CACHES = 4;
+
+std::shared_ptr<PsfKernelCache> kernelCacheFor(int longSide) {
+    static std::mutex cachesMutex;
+    static std::list<std::pair<int, std::shared_ptr<PsfKernelCache>>> caches; // 最近用过的在前
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    auto it = std::find_if(caches.begin(), caches.end(), [longSide](const auto& entry) { return entry.first == longSide; });
+    if (it != caches.end()) {
+        caches.splice(caches.begin(), caches, it);
+    } else {
+        caches.emplace_front(longSide, std::make_shared<PsfKernelCache>(static_cast<double>(longSide) / REFERENCE_RESOLUTION));
+        if (caches.size() > MAX_KERNEL_CACHES) caches.pop_back();
+    }
+    return caches.front().second;
+}
+
+// 一颗星落到图像上的参数，由串行的布点阶段算好，分块渲染时只读
+struct StarSplat {
+    uint32_t starIndex; // 星在输入中的下标，作为噪声计数器的一部分
+    int centerX;
+    int centerY;
+    double baseBrightness;
+    const PsfKernel* kernel;
+    cv::Vec3f color; // 只在彩色模式下使用
+};
+
+// 单通道直接累加亮度；彩色模式按星的颜色分到三个通道
+inline void accumulate(float& pixel, const StarSplat&, float value) {
+    pixel += value;
+}
+
+inline void accumulate(cv::Vec3f& pixel, const StarSplat& splat, float value) {
+    pixel[0] += splat.color[0] * value;
+    pixel[1] += splat.color[1] * value;
+    pixel[2] += splat.color[2] * value;
+}
+
+// 把 splat 裁到 [x0,x1]x[y0,y1] 内累加，坐标是整幅图像的像素坐标，缓冲区第 0 行是图像的第 originY 行。
+// 像素 (px, py) 的亮度噪声是计数器块 {px/4, py, 星号, NOISE_STREAM} 的第 px%4 个输出，只和星与像素有关，
+// 与分块、分条带方式和线程数无关；每行先批量生成噪声再累加
+template <typename Pixel>
+void splatStar(cv::Mat& accumulationBuffer, int originY, const StarSplat& splat, int x0, int y0, int x1, int y1,
+               const Philox::Key& key, std::vector<float>& noise, std::vector<float>& rowWeights) {
+    const PsfKernel& kernel = *splat.kernel;
+    const int side = 2 * kernel.halfSize + 1;
+    y0 = std::max(splat.centerY - kernel.halfSize, y0);
+    y1 = std::min(splat.centerY + kernel.halfSize, y1);
+    x0 = std::max(splat.centerX - kernel.halfSize, x0);
+    x1 = std::min(splat.centerX + kernel.halfSize, x1);
+    if (x0 > x1) return;
+
+    const uint32_t firstBlock = static_cast<uint32_t>(x0) / 4;
+    const std::size_t blocks = static_cast<uint32_t>(x1) / 4 - firstBlock + 1;
+    noise.resize(4 * blocks);
+    const float* rowNoise = noise.data() + (x0 - 4 * static_cast<int>(firstBlock));
+    const float brightness = static_cast<float>(splat.baseBrightness);
+    const int width = x1 - x0 + 1;
+
+    for (int py = y0; py <= y1; ++py) {
+        // 添加微小的随机亮度噪声
+        Philox::UniformBatch(key, firstBlock, static_cast<uint32_t>(py), splat.starIndex, NOISE_STREAM, blocks,
+                             -BRIGHTNESS_NOISE_RANGE, BRIGHTNESS_NOISE_RANGE, noise.data());
+        const float* weights;
+        if (kernel.weights.empty()) {
+            // 没有展开的大核只算落在裁剪范围里的这一段
+            rowWeights.resize(width);
+            const double dy = py - splat.centerY;
+            for (int i = 0; i < width; ++i) {
+                const double dx = x0 + i - splat.centerX;
+                rowWeights[i] = static_cast<float>(psfFactor(kernel.alpha, dx*dx + dy*dy) * kernel.normalization);
+            }
+            weights = rowWeights.data();
+        } else {
+            weights = kernel.weights.data() + static_cast<size_t>(py - splat.centerY + kernel.halfSize) * side
+                      + (x0 - splat.centerX + kernel.halfSize);
         }
+        Pixel* row = accumulationBuffer.ptr<Pixel>(py - originY) + x0;
+        for (int i = 0; i < width; ++i) {
+            float value = brightness * (1.0f + rowNoise[i]) * weights[i];
 
-        double deltaRA = star.ra - centerRA;
-        deltaRA = std::fmod(deltaRA + 180.0, 360.0) - 180.0;
+            // 对于非常亮的星，允许像素值超过 255，在后续的归一化和后处理中会处理饱和效果
+            accumulate(row[i], splat, value);
+        }
+    }
+}
 
-        bool inRA = (std::abs(deltaRA) <= fovRA) / 2.0;
-        bool inDec = (star.dec >= (centerDec - fovDec/2.0)) &&
-                     (star.dec <= (centerDec + fovDec/2.0));
+// 把缓冲区切成 tileSize 见方的块，每颗星按核覆盖范围登记到所有相交的块（包括溢出到邻块的部分）。
+// 每个块只由一个任务渲染，写入互不重叠，不需要原子操作；块内按星的顺序累加。缓冲区是图像从 originY 行开始的
+// 一段（整幅图像时为 0），核只有一部分落在这段行里的星只累加这一部分。tileSplats 是各块的星列表，
+// 由调用方保留以便复用容量
+void renderTiles(cv::Mat& accumulationBuffer, int originY, const std::vector<StarSplat>& splats,
+                 const RenderOptions& options, std::vector<std::vector<uint32_t>>& tileSplats) {
+    const int imageWidth = accumulationBuffer.cols;
+    const int bufferHeight = accumulationBuffer.rows;
+    const int tileSize = std::max(options.tileSize, 16);
+    const int tilesX = (imageWidth + tileSize - 1) / tileSize;
+    const int tilesY = (bufferHeight + tileSize - 1) / tileSize;
 
-        if (!(inRA && inDec)) continue;
+    tileSplats.resize(static_cast<size_t>(tilesX) * tilesY);
+    for (std::vector<uint32_t>& list : tileSplats) list.clear();
+    for (size_t i = 0; i < splats.size(); ++i) {
+        const StarSplat& splat = splats[i];
+        int halfSize = splat.kernel->halfSize;
+        int x0 = std::max(splat.centerX - halfSize, 0);
+        int x1 = std::min(splat.centerX + halfSize, imageWidth - 1);
+        int y0 = std::max(splat.centerY - halfSize, originY) - originY;
+        int y1 = std::min(splat.centerY + halfSize, originY + bufferHeight - 1) - originY;
+        if (x0 > x1 || y0 > y1) continue;
+        for (int ty = y0 / tileSize; ty <= y1 / tileSize; ++ty) {
+            for (int tx = x0 / tileSize; tx <= x1 / tileSize; ++tx) {
+                tileSplats[ty * tilesX + tx].push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
 
-        double normalizedRA = (deltaRA + fovRA/2.0) / fovRA;
-        double normalizedDec = (centerDec + fovDec/2.0 - star.dec) / fovDec;
+    const Philox::Key key = Philox::KeyFromSeed(options.seed);
+    auto renderTile = [&](size_t t) {
+        std::vector<float> noise;
+        std::vector<float> rowWeights;
+        const int tx = static_cast<int>(t % tilesX);
+        const int ty = static_cast<int>(t / tilesX);
+        const int x0 = tx * tileSize;
+        const int y0 = originY + ty * tileSize;
+        const int x1 = std::min(x0 + tileSize, imageWidth) - 1;
+        const int y1 = originY + std::min((ty + 1) * tileSize, bufferHeight) - 1;
+        for (uint32_t i : tileSplats[t]) {
+            if (accumulationBuffer.channels() == 1) {
+                splatStar<float>(accumulationBuffer, originY, splats[i], x0, y0, x1, y1, key, noise, rowWeights);
+            } else {
+                splatStar<cv::Vec3f>(accumulationBuffer, originY, splats[i], x0, y0, x1, y1, key, noise, rowWeights);
+            }
+        }
+    };
 
-        double x = normalizedRA * imageWidth;
-        double y = normalizedDec * imageHeight;
+    if (options.threads == 1) {
+        for (size_t t = 0; t < tileSplats.size(); ++t) {
+            renderTile(t);
+        }
+        return;
+    }
+
+    // 每个非空分块一个任务，交给进程级 Executor，空闲线程自动分担星密集的分块
+    TaskGroup tasks;
+    for (size_t t = 0; t < tileSplats.size(); ++t) {
+        if (!tileSplats[t].empty()) {
+            tasks.run([&renderTile, t] { renderTile(t); });
+        }
+    }
+    tasks.wait();
+}
+
+// --- 色调映射参数 ---
+constexpr double CLAHE_CLIP_LIMIT = 2.0;
+constexpr int CLAHE_TILES = 8; // 每个方向的分块数
+
+// 色调映射的中间图像，尺寸不变时在帧之间复用内存
+struct ToneMapScratch {
+    cv::Mat luminance;
+    cv::Mat normalized;
+    cv::Mat mapped;
+    cv::Ptr<cv::CLAHE> clahe;
+};
+
+// 单通道色调映射：归一化到输出位深后做自适应直方图均衡化，结果写到 mapped
+void toneMap(const cv::Mat& luminance, const RenderOptions& options, ToneMapScratch& scratch, cv::Mat& mapped) {
+    const bool wide = options.bitDepth == 16;
+    cv::normalize(luminance, scratch.normalized, 0, wide ? 65535 : 255, cv::NORM_MINMAX, wide ? CV_16U : CV_8U);
+
+    if (!scratch.clahe) {
+        scratch.clahe = cv::createCLAHE(CLAHE_CLIP_LIMIT, cv::Size(CLAHE_TILES, CLAHE_TILES));
+    }
+    scratch.clahe->apply(scratch.normalized, mapped);
+}
+
+// 按一行的原始通道比例把映射后的亮度 level 还原成颜色
+template <typename T>
+void restoreColor(const cv::Vec3f* src, const float* lum, const T* level, T* dst, int width) {
+    for (int x = 0; x < width; ++x) {
+        float scale = lum[x] > 0.0f ? level[x] / lum[x] : 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            dst[3 * x + c] = cv::saturate_cast<T>(src[x][c] * scale);
+        }
+    }
+}
+
+// 彩色色调映射：只对亮度（三通道均值）做一次映射，再按原始通道比例还原颜色
+template <typename T>
+void toneMapColor(const cv::Mat& accumulationBuffer, const RenderOptions& options, ToneMapScratch& scratch,
+                  cv::Mat& outputImage) {
+    cv::Mat& luminance = scratch.luminance;
+    luminance.create(accumulationBuffer.rows, accumulationBuffer.cols, CV_32FC1);
+    for (int y = 0; y < accumulationBuffer.rows; ++y) {
+        const cv::Vec3f* src = accumulationBuffer.ptr<cv::Vec3f>(y);
+        float* dst = luminance.ptr<float>(y);
+        for (int x = 0; x < accumulationBuffer.cols; ++x) {
+            dst[x] = (src[x][0] + src[x][1] + src[x][2]) / 3.0f;
+        }
+    }
+    cv::Mat& mapped = scratch.mapped;
+    toneMap(luminance, options, scratch, mapped);
+
+    outputImage.create(accumulationBuffer.rows, accumulationBuffer.cols, CV_MAKETYPE(mapped.depth(), 3));
+    for (int y = 0; y < accumulationBuffer.rows; ++y) {
+        const cv::Vec3f* src = accumulationBuffer.ptr<cv::Vec3f>(y);
+        const float* lum = luminance.ptr<float>(y);
+        restoreColor(src, lum, mapped.ptr<T>(y), outputImage.ptr<T>(y), accumulationBuffer.cols);
+    }
+}
+
+// 布点时按 star 读取星表记录，紧凑记录在用到时逐颗解包，不另外展开整个星表
+inline const star& toStar(const star& record) { return record; }
+inline star toStar(const compact_star& record) { return CompactStar::Unpack(record); }
+
+// 布点参数：视场、星等阈值和随分辨率缩放的 PSF 核。Accumulator::State 和条带渲染共用
+struct SplatLayout {
+    SplatLayout(int imageWidth, int imageHeight, double centerRA, double centerDec, double fovRA, double fovDec,
+                double magnitudeThreshold, const RenderOptions& options)
+        : imageWidth(imageWidth),
+          imageHeight(imageHeight),
+          colored(options.colorModel != ColorModel::Mono),
+          key(Philox::KeyFromSeed(options.seed)),
+          fieldOfView(FovKernel::MakeFieldOfView(centerRA, centerDec, fovRA, fovDec, options.gamma)),
+          magnitudeThreshold(magnitudeThreshold),
+          // 根据图像尺寸动态计算 MAX_RADIUS
+          resolutionScale(static_cast<double>(std::max(imageWidth, imageHeight)) / REFERENCE_RESOLUTION),
+          maxRadius(BASE_MAX_RADIUS * resolutionScale),
+          kernelCache(kernelCacheFor(std::max(imageWidth, imageHeight))) {} // PSF_FWHM_SCALE 随分辨率缩放
+
+    void reset(double centerRA, double centerDec, double fovRA, double fovDec, double gamma);
+    template <typename Record>
+    void layout(const std::vector<Record>& stars, uint32_t firstIndex, std::vector<StarSplat>& splats);
+
+    bool expandLargeKernels = true; // 为 false 时不进缓存的大核不展开权重，见 describePsfKernel
+    const int imageWidth;
+    const int imageHeight;
+    const bool colored;
+    const Philox::Key key;
+    FovKernel::FieldOfView fieldOfView;
+    const double magnitudeThreshold;
+    const double resolutionScale;
+    const double maxRadius;
+    std::shared_ptr<PsfKernelCache> kernelCache;
+    std::deque<PsfKernel> largeKernels; // 不进缓存的大核，deque 保证地址稳定
+};
+
+// 换一个视场，之前布点得到的大核不再使用
+void SplatLayout::reset(double centerRA, double centerDec, double fovRA, double fovDec, double gamma) {
+    fieldOfView = FovKernel::MakeFieldOfView(centerRA, centerDec, fovRA, fovDec, gamma);
+    largeKernels.clear();
+}
+
+// 布点：串行计算每颗星的位置、亮度和 PSF 核，追加到 splats。stars[i] 的编号是 firstIndex + i
+template <typename Record>
+void SplatLayout::layout(const std::vector<Record>& stars, uint32_t firstIndex, std::vector<StarSplat>& splats) {
+    splats.reserve(splats.size() + stars.size());
+    const uint32_t endIndex = firstIndex + static_cast<uint32_t>(stars.size());
+    for (uint32_t starIndex = firstIndex; starIndex < endIndex; ++starIndex) {
+        const auto& star = toStar(stars[starIndex - firstIndex]);
+        // 只有亮度高于阈值的恒星才会被绘制
+        if (star.magnitude > magnitudeThreshold) {
+            continue;
+        }
+
+        // 与 observer 相同的心射投影，切平面坐标线性映射到像素，right 轴向右、up 轴向上
+        double u, v;
+        if (!FovKernel::Project(fieldOfView.frame, star.ra, star.dec, u, v) ||
+            std::abs(u) > fieldOfView.tan_half_w || std::abs(v) > fieldOfView.tan_half_h) {
+            continue;
+        }
+
+        double x = (u / fieldOfView.tan_half_w + 1.0) / 2.0 * imageWidth;
+        double y = (1.0 - v / fieldOfView.tan_half_h) / 2.0 * imageHeight;
 
         // 添加微小的随机位置抖动
-        double jitterX = jitter(gen);
-        double jitterY = jitter(gen);
+        Philox::Counter jitterBits = Philox::Generate({starIndex, 0, 0, JITTER_STREAM}, key);
+        double jitterX = JITTER_RANGE * (2.0f * Philox::ToUniform(jitterBits[0]) - 1.0f);
+        double jitterY = JITTER_RANGE * (2.0f * Philox::ToUniform(jitterBits[1]) - 1.0f);
         int centerX = std::round(x + jitterX);
         int centerY = std::round(y + jitterY);
 
         // 计算恒星的强度和半径
         double intensity = intensityFromMagnitude(star.magnitude);
-        double radius = std::clamp(intensity * current_max_radius, MIN_RADIUS, current_max_radius);
+        double radius = std::clamp(intensity * maxRadius, MIN_RADIUS, maxRadius);
 
         // 修改亮度计算方式，考虑饱和星等
         double baseBrightness;
@@ -90,77 +505,520 @@ void drawStarMap(const std::vector<star>& stars,
             baseBrightness = BASE_LUMINOSITY * std::pow(brightnessFactor, 2.0);
         }
 
-        // 优化PSF参数
-        const double beta = PSF_BETA;
-        const double originalFWHM = current_psf_fwhm_scale * radius; // 使用缩放后的 PSF_FWHM_SCALE
-        const double sqrt_term = std::sqrt(std::pow(2.0, 1.0/beta) - 1.0);
-        const double alpha = originalFWHM / (2.0 * sqrt_term);
+        // 取缓存的归一化 PSF 核
+        PsfKernel largeKernel;
+        const PsfKernel* kernel = &kernelCache->get(radius, largeKernel, expandLargeKernels);
+        if (kernel == &largeKernel) {
+            largeKernels.push_back(std::move(largeKernel));
+            kernel = &largeKernels.back();
+        }
+        cv::Vec3f color = colored ? colorFromBV(star.color_index) : cv::Vec3f(1.0f, 1.0f, 1.0f);
+        splats.push_back(StarSplat{starIndex, centerX, centerY, baseBrightness, kernel, color});
+    }
+}
 
-        // 扩大采样范围 (可能需要根据 PSF 的缩放调整)
-        int kernelSize = static_cast<int>(std::ceil(PSF_KERNEL_SIZE_MULTIPLIER * alpha));
+// 累加缓冲区和渲染参数。drawStarMap 直接同步使用；Accumulator 把各批星排队，由 Executor 上的后台任务依次累加；
+// FrameRenderer 每帧 reset 后重复使用
+struct Accumulator::State {
+    State(int imageWidth, int imageHeight, double centerRA, double centerDec, double fovRA, double fovDec,
+          double magnitudeThreshold, const RenderOptions& options)
+        : layout(imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec, magnitudeThreshold, options),
+          // 所有星同色时三个通道完全相同，只累加一个通道；彩色模型才展开成三通道
+          accumulationBuffer(imageHeight, imageWidth, layout.colored ? CV_32FC3 : CV_32FC1, cv::Scalar::all(0)),
+          options(options) {}
 
-        std::vector<std::tuple<int, int, double>> psfFactors;
-        double sumFactors = 0.0;
+    void reset(double centerRA, double centerDec, double fovRA, double fovDec, double gamma);
+    template <typename Record>
+    void splat(const std::vector<Record>& stars);
+    void toneMap(cv::Mat& outputImage);
+    bool write(const std::string& outputPath);
+    void drainPending();
 
-        // 预计算PSF核
-        for (int dy = -kernelSize; dy <= kernelSize; ++dy) {
-            for (int dx = -kernelSize; dx <= kernelSize; ++dx) {
-                double r2 = dx*dx + dy*dy;
-                double factor = std::pow(1.0 + r2/(alpha*alpha), -beta);
-                psfFactors.emplace_back(dx, dy, factor);
-                sumFactors += factor;
-            }
-        }
+    SplatLayout layout;
+    cv::Mat accumulationBuffer;
+    const RenderOptions options;
+    uint32_t nextStarIndex = 0; // 星的编号跨批连续，抖动和噪声与分批方式无关
 
-        // 应用PSF
-        const double normalization = 1.0 / sumFactors;
-        for (const auto& [dx, dy, factor] : psfFactors) {
-            int px = centerX + dx;
-            int py = centerY + dy;
-            if (px < 0 || px >= imageWidth || py < 0 || py >= imageHeight) continue;
+    // 每批、每帧复用的临时数据
+    std::vector<StarSplat> splats;
+    std::vector<std::vector<uint32_t>> tileSplats;
+    ToneMapScratch toneMapScratch;
 
-            // 添加微小的随机亮度噪声
-            double brightnessWithNoise = baseBrightness * (1.0 + brightness_noise(gen));
-            float value = static_cast<float>(brightnessWithNoise * factor * normalization);
-            cv::Vec3f& pixel = accumulationBuffer.at<cv::Vec3f>(py, px);
+    std::mutex pendingMutex;
+    std::deque<std::vector<star>> pending;
+    bool draining = false;
+    bool failed = false; // 某一批累加时抛出了异常，图像已不完整，之后的批次直接丢掉
+    TaskGroup drainTasks; // 放在最后，析构时先等后台任务结束
+};
 
-            // 对于非常亮的星，允许像素值超过 255，在后续的归一化和后处理中会处理饱和效果
-            pixel[0] += value;
-            pixel[1] += value;
-            pixel[2] += value;
-        }
+// 换一个视场重新开始累加，缓冲区的内存保留
+void Accumulator::State::reset(double centerRA, double centerDec, double fovRA, double fovDec, double gamma) {
+    layout.reset(centerRA, centerDec, fovRA, fovDec, gamma);
+    accumulationBuffer.setTo(cv::Scalar::all(0));
+    nextStarIndex = 0;
+}
+
+// 布点后分块累加一批星
+template <typename Record>
+void Accumulator::State::splat(const std::vector<Record>& stars) {
+    splats.clear();
+    layout.layout(stars, nextStarIndex, splats);
+    nextStarIndex += static_cast<uint32_t>(stars.size());
+
+    // 分块并行累加。每个像素上各星按编号顺序累加，一次性渲染和分批渲染的浮点结果相同
+    renderMetrics().starsDrawn.add(splats.size());
+    Metrics::ScopedTimer timer(renderMetrics().splatSeconds);
+    renderTiles(accumulationBuffer, 0, splats, options, tileSplats);
+}
+
+// 色调映射到输出位深，outputImage 尺寸和类型相同时复用它的内存
+void Accumulator::State::toneMap(cv::Mat& outputImage) {
+    Metrics::ScopedTimer timer(renderMetrics().toneMapSeconds);
+    if (!layout.colored) {
+        StarMapDrawer::toneMap(accumulationBuffer, options, toneMapScratch, outputImage);
+    } else if (options.bitDepth == 16) {
+        toneMapColor<uint16_t>(accumulationBuffer, options, toneMapScratch, outputImage);
+    } else {
+        toneMapColor<uint8_t>(accumulationBuffer, options, toneMapScratch, outputImage);
     }
+}
 
-    // 优化后处理流程
+bool Accumulator::State::write(const std::string& outputPath) {
     // 优化后处理流程
     cv::Mat outputImage;
+    toneMap(outputImage);
+    return writeImage(outputImage, outputPath);
+}
 
-    // 自适应直方图均衡化
-    cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE();
-    clahe->setClipLimit(2.0);
+// 后台任务：依次取出排队的批次累加，队列空了就结束，下一次 add 再提交新任务
+void Accumulator::State::drainPending() {
+    for (;;) {
+        std::vector<star> stars;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (pending.empty()) {
+                draining = false;
+                return;
+            }
+            stars = std::move(pending.front());
+            pending.pop_front();
+        }
+        try {
+            splat(stars);
+        } catch (...) {
+            // 不复位 draining 的话，之后 add 的批次没有任务来累加
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            pending.clear();
+            draining = false;
+            failed = true;
+            throw; // 由 drainTasks.wait() 交给 finish 的调用方
+        }
+    }
+}
 
-    std::vector<cv::Mat> channels;
-    cv::split(accumulationBuffer, channels);
-    for (auto& channel : channels) {
-        // 先将 float 类型的 channel 归一化到 0-255 并转换为 8-bit unsigned
-        cv::Mat normalizedChannel;
-        cv::normalize(channel, normalizedChannel, 0, 255, cv::NORM_MINMAX, CV_8U);
-        // 然后对转换后的通道应用 CLAHE
-        clahe->apply(normalizedChannel, channel); // 注意这里我们将结果写回 channel
+Accumulator::Accumulator(int imageWidth, int imageHeight, double centerRA, double centerDec, double fovRA,
+                         double fovDec, double magnitudeThreshold, const RenderOptions& options)
+    : state_(std::make_unique<State>(imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec,
+                                     magnitudeThreshold, options)) {}
+
+Accumulator::~Accumulator() = default;
+
+void Accumulator::add(std::vector<star>&& stars) {
+    std::lock_guard<std::mutex> lock(state_->pendingMutex);
+    if (state_->failed) return;
+    state_->pending.push_back(std::move(stars));
+    if (!state_->draining) {
+        state_->draining = true;
+        state_->drainTasks.run([state = state_.get()] { state->drainPending(); });
     }
-    cv::merge(channels, outputImage);
+}
+
+bool Accumulator::finish(const std::string& outputPath) {
+    state_->drainTasks.wait();
+    if (state_->failed) {
+        std::cerr << "Error: star map for " << outputPath << " is incomplete, a batch failed to render" << std::endl;
+        return false;
+    }
+    return state_->write(outputPath);
+}
+
+FrameRenderer::FrameRenderer(int imageWidth, int imageHeight, double fovRA, double fovDec,
+                             double magnitudeThreshold, const RenderOptions& options)
+    : fovRA_(fovRA), fovDec_(fovDec),
+      state_(std::make_unique<Accumulator::State>(imageWidth, imageHeight, 0.0, 0.0, fovRA, fovDec,
+                                                   magnitudeThreshold, options)) {}
 
+FrameRenderer::~FrameRenderer() = default;
+
+void FrameRenderer::render(const std::vector<star>& stars, double centerRA, double centerDec, double gamma,
+                           cv::Mat& image) {
+    state_->reset(centerRA, centerDec, fovRA_, fovDec_, gamma);
+    state_->splat(stars);
+    state_->toneMap(image);
+}
+
+bool writeImage(const cv::Mat& image, const std::string& outputPath) {
     // 保存结果
     std::filesystem::path dir = std::filesystem::path(outputPath).parent_path();
-    if (!std::filesystem::exists(dir)) {
+    if (!dir.empty() && !std::filesystem::exists(dir)) {
         std::filesystem::create_directories(dir);
     }
 
-    if (!cv::imwrite(outputPath, outputImage)) {
+    bool written;
+    {
+        Metrics::ScopedTimer timer(renderMetrics().encodeSeconds);
+        written = cv::imwrite(outputPath, image);
+    }
+    if (!written) {
         std::cerr << "Error: Could not save the star map to " << outputPath << std::endl;
-    } else {
+    } else if (Metrics::Verbose()) {
+        std::cout << "Star map saved to " << outputPath << std::endl;
+    }
+    return written;
+}
+
+// 修改后的 drawStarMap 函数，添加 magnitudeThreshold 参数
+void drawStarMap(const std::vector<star>& stars,
+                 const std::string& outputPath,
+                 int imageWidth, int imageHeight,
+                 double centerRA, double centerDec, double fovRA, double fovDec,
+                 double magnitudeThreshold, // 默认阈值为 12 等星
+                 const RenderOptions& options) {
+    Accumulator::State state(imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec, magnitudeThreshold, options);
+    state.splat(stars);
+    state.write(outputPath);
+}
+
+void drawStarMap(const std::vector<compact_star>& stars,
+                 const std::string& outputPath,
+                 int imageWidth, int imageHeight,
+                 double centerRA, double centerDec, double fovRA, double fovDec,
+                 double magnitudeThreshold,
+                 const RenderOptions& options) {
+    Accumulator::State state(imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec, magnitudeThreshold, options);
+    state.splat(stars);
+    state.write(outputPath);
+}
+
+// --- 条带渲染 ---
+// 边界按 BORDER_REFLECT_101 镜像回 [0, n)，与 cv::borderInterpolate 相同
+int reflect101(int p, int n) {
+    if (n == 1) return 0;
+    while (p < 0 || p >= n) {
+        p = p < 0 ? -p : 2 * n - 2 - p;
+    }
+    return p;
+}
+
+// 把 toneMap 的 cv::normalize(NORM_MINMAX) 和 CLAHE 按 OpenCV 的实现展开成逐行进行的三步，不需要整幅图像：
+// observe 统计全图亮度范围；addHistogramRow 统计归一化后各块的直方图，图像宽高不是分块数的倍数时与 OpenCV
+// 一样按 BORDER_REFLECT_101 补边；buildLuts 裁剪直方图得到各块的查找表后，mapRow 在相邻四块之间双线性插值。
+// 内存只有各块的直方图和查找表，与图像尺寸无关
+template <typename T>
+class BandToneMap {
+public:
+    static constexpr int HIST_SIZE = std::numeric_limits<T>::max() + 1;
+
+    BandToneMap(int width, int height) : width_(width), height_(height) {
+        // OpenCV 只要有一边不整除就两边都补，整除的一边补满一个分块数
+        const bool padded = width % CLAHE_TILES != 0 || height % CLAHE_TILES != 0;
+        extWidth_ = padded ? width + CLAHE_TILES - width % CLAHE_TILES : width;
+        extHeight_ = padded ? height + CLAHE_TILES - height % CLAHE_TILES : height;
+        tileWidth_ = extWidth_ / CLAHE_TILES;
+        tileHeight_ = extHeight_ / CLAHE_TILES;
+
+        columnTile_.resize(extWidth_);
+        for (int x = 0; x < extWidth_; ++x) columnTile_[x] = x / tileWidth_;
+
+        const float invTileWidth = 1.0f / tileWidth_;
+        lower_.resize(width);
+        upper_.resize(width);
+        weight_.resize(width);
+        for (int x = 0; x < width; ++x) {
+            float txf = x * invTileWidth - 0.5f;
+            int tx1 = static_cast<int>(std::floor(txf));
+            weight_[x] = txf - tx1;
+            lower_[x] = std::max(tx1, 0) * HIST_SIZE;
+            upper_[x] = std::min(tx1 + 1, CLAHE_TILES - 1) * HIST_SIZE;
+        }
+    }
+
+    // 第一遍：一行亮度计入全图范围
+    void observe(const float* lum) {
+        for (int x = 0; x < width_; ++x) {
+            minimum_ = std::min(minimum_, lum[x]);
+            maximum_ = std::max(maximum_, lum[x]);
+        }
+    }
+
+    // 第一遍之后：与 cv::normalize 相同的缩放和偏移，范围为零时整幅图像为 0
+    void beginHistograms() {
+        const double range = static_cast<double>(maximum_) - minimum_;
+        const double scale = std::numeric_limits<T>::max() * (range > DBL_EPSILON ? 1.0 / range : 0.0);
+        scale_ = static_cast<float>(scale);
+        shift_ = static_cast<float>(-minimum_ * scale);
+        histograms_.assign(static_cast<size_t>(CLAHE_TILES) * CLAHE_TILES * HIST_SIZE, 0);
+    }
+
+    // 与 OpenCV 的 convertTo 一样用 float 乘加，只舍入一次（FMA），恰好落在 .5 附近的像素也取到同一个整数
+    void normalize(const float* lum, T* dst) const {
+        for (int x = 0; x < width_; ++x) {
+            dst[x] = cv::saturate_cast<T>(std::fma(lum[x], scale_, shift_));
+        }
+    }
+
+    // 第二遍：归一化后的第 y 行计入它所在的块，以及补边时镜像到它的各行所在的块
+    void addHistogramRow(int y, const T* row) {
+        addHistogramRowAt(y, row);
+        for (int ye = height_; ye < extHeight_; ++ye) {
+            if (reflect101(ye, height_) == y) addHistogramRowAt(ye, row);
+        }
+    }
+
+    // 第二遍之后：裁剪直方图，被裁掉的计数平均分回各档，再累加成查找表
+    void buildLuts() {
+        const int tileArea = tileWidth_ * tileHeight_;
+        const float lutScale = static_cast<float>(HIST_SIZE - 1) / tileArea;
+        const int clipLimit = std::max(static_cast<int>(CLAHE_CLIP_LIMIT * tileArea / HIST_SIZE), 1);
+        luts_.resize(histograms_.size());
+        for (int tile = 0; tile < CLAHE_TILES * CLAHE_TILES; ++tile) {
+            int* hist = histograms_.data() + static_cast<size_t>(tile) * HIST_SIZE;
+            int clipped = 0;
+            for (int i = 0; i < HIST_SIZE; ++i) {
+                if (hist[i] > clipLimit) {
+                    clipped += hist[i] - clipLimit;
+                    hist[i] = clipLimit;
+                }
+            }
+            const int redistBatch = clipped / HIST_SIZE;
+            int residual = clipped - redistBatch * HIST_SIZE;
+            for (int i = 0; i < HIST_SIZE; ++i) hist[i] += redistBatch;
+            if (residual != 0) {
+                const int residualStep = std::max(HIST_SIZE / residual, 1);
+                for (int i = 0; i < HIST_SIZE && residual > 0; i += residualStep, --residual) ++hist[i];
+            }
+
+            T* lut = luts_.data() + static_cast<size_t>(tile) * HIST_SIZE;
+            int sum = 0;
+            for (int i = 0; i < HIST_SIZE; ++i) {
+                sum += hist[i];
+                lut[i] = cv::saturate_cast<T>(sum * lutScale);
+            }
+        }
+        histograms_ = std::vector<int>();
+    }
+
+    // 第三遍：归一化后的第 y 行在相邻四块的查找表之间插值
+    void mapRow(int y, const T* row, T* dst) const {
+        const float tyf = y * (1.0f / tileHeight_) - 0.5f;
+        const int ty1 = static_cast<int>(std::floor(tyf));
+        const float ya = tyf - ty1;
+        const float ya1 = 1.0f - ya;
+        const T* lut1 = luts_.data() + static_cast<size_t>(std::max(ty1, 0)) * CLAHE_TILES * HIST_SIZE;
+        const T* lut2 = luts_.data() + static_cast<size_t>(std::min(ty1 + 1, CLAHE_TILES - 1)) * CLAHE_TILES * HIST_SIZE;
+        for (int x = 0; x < width_; ++x) {
+            const int value = row[x];
+            const float xa = weight_[x];
+            const float xa1 = 1.0f - xa;
+            const int ind1 = lower_[x] + value;
+            const int ind2 = upper_[x] + value;
+            float res = (lut1[ind1] * xa1 + lut1[ind2] * xa) * ya1 + (lut2[ind1] * xa1 + lut2[ind2] * xa) * ya;
+            dst[x] = cv::saturate_cast<T>(res);
+        }
+    }
+
+private:
+    void addHistogramRowAt(int ye, const T* row) {
+        int* hist = histograms_.data() + static_cast<size_t>(ye / tileHeight_) * CLAHE_TILES * HIST_SIZE;
+        for (int x = 0; x < width_; ++x) {
+            ++hist[columnTile_[x] * HIST_SIZE + row[x]];
+        }
+        for (int xe = width_; xe < extWidth_; ++xe) {
+            ++hist[columnTile_[xe] * HIST_SIZE + row[reflect101(xe, width_)]];
+        }
+    }
+
+    const int width_;
+    const int height_;
+    int extWidth_;
+    int extHeight_;
+    int tileWidth_;
+    int tileHeight_;
+    std::vector<int> columnTile_; // 补边后每列所在的块
+    std::vector<int> lower_;      // 插值的左右两块在查找表里的偏移
+    std::vector<int> upper_;
+    std::vector<float> weight_;   // 右边一块的权重
+    float minimum_ = std::numeric_limits<float>::infinity();
+    float maximum_ = -std::numeric_limits<float>::infinity();
+    float scale_ = 0.0f;
+    float shift_ = 0.0f;
+    std::vector<int> histograms_;
+    std::vector<T> luts_;
+};
+
+// 二进制 PGM/PPM 的一行：16 位采样按大端存放，彩色从 BGR 换成 RGB
+template <typename T>
+void encodePnmRow(const T* row, int width, int channels, std::vector<char>& bytes) {
+    bytes.resize(static_cast<size_t>(width) * channels * sizeof(T));
+    char* out = bytes.data();
+    for (int x = 0; x < width; ++x) {
+        for (int c = 0; c < channels; ++c) {
+            T value = row[x * channels + (channels - 1 - c)];
+            if (sizeof(T) == 2) *out++ = static_cast<char>(value >> 8);
+            *out++ = static_cast<char>(value & 0xff);
+        }
+    }
+}
+
+template <typename T, typename Record>
+bool renderBanded(const std::vector<Record>& stars, std::ofstream& out, int imageWidth, int imageHeight,
+                  double centerRA, double centerDec, double fovRA, double fovDec, double magnitudeThreshold,
+                  const RenderOptions& options, int bandHeight) {
+    SplatLayout layout(imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec, magnitudeThreshold, options);
+    layout.expandLargeKernels = false;
+    std::vector<StarSplat> splats;
+    layout.layout(stars, 0, splats);
+    renderMetrics().starsDrawn.add(splats.size());
+
+    // 按核覆盖的行把星分到各条带，条带内保持星的顺序，每个像素上的累加顺序与整幅渲染相同。
+    // 核跨过条带边界的星在每个相交的条带里累加落在其中的部分，相当于条带带着核半径宽的边
+    const int bands = (imageHeight + bandHeight - 1) / bandHeight;
+    std::vector<std::vector<uint32_t>> bandMembers(bands);
+    for (size_t i = 0; i < splats.size(); ++i) {
+        const StarSplat& splat = splats[i];
+        const int halfSize = splat.kernel->halfSize;
+        if (splat.centerX + halfSize < 0 || splat.centerX - halfSize >= imageWidth) continue;
+        const int y0 = std::max(splat.centerY - halfSize, 0);
+        const int y1 = std::min(splat.centerY + halfSize, imageHeight - 1);
+        if (y0 > y1) continue;
+        for (int band = y0 / bandHeight; band <= y1 / bandHeight; ++band) {
+            bandMembers[band].push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    const int channels = layout.colored ? 3 : 1;
+    cv::Mat bandBuffer(bandHeight, imageWidth, layout.colored ? CV_32FC3 : CV_32FC1);
+    std::vector<StarSplat> bandSplats;
+    std::vector<std::vector<uint32_t>> tileSplats;
+    std::vector<float> luminance(imageWidth);
+
+    // 依次累加各条带，对每一行调用 visit(行号, 累加缓冲区的这一行, 亮度)
+    auto forEachRow = [&](auto&& visit) {
+        for (int band = 0; band < bands; ++band) {
+            const int y0 = band * bandHeight;
+            cv::Mat buffer = bandBuffer.rowRange(0, std::min(bandHeight, imageHeight - y0));
+            buffer.setTo(cv::Scalar::all(0));
+            bandSplats.clear();
+            for (uint32_t i : bandMembers[band]) bandSplats.push_back(splats[i]);
+            {
+                Metrics::ScopedTimer timer(renderMetrics().splatSeconds);
+                renderTiles(buffer, y0, bandSplats, options, tileSplats);
+            }
+            for (int r = 0; r < buffer.rows; ++r) {
+                const float* lum = buffer.ptr<float>(r);
+                if (layout.colored) {
+                    const cv::Vec3f* src = buffer.ptr<cv::Vec3f>(r);
+                    for (int x = 0; x < imageWidth; ++x) {
+                        luminance[x] = (src[x][0] + src[x][1] + src[x][2]) / 3.0f;
+                    }
+                    lum = luminance.data();
+                }
+                visit(y0 + r, buffer.ptr<cv::Vec3f>(r), lum);
+            }
+        }
+    };
+
+    BandToneMap<T> toneMap(imageWidth, imageHeight);
+    std::vector<T> normalized(imageWidth);
+    forEachRow([&](int, const cv::Vec3f*, const float* lum) { toneMap.observe(lum); });
+    toneMap.beginHistograms();
+    forEachRow([&](int y, const cv::Vec3f*, const float* lum) {
+        toneMap.normalize(lum, normalized.data());
+        toneMap.addHistogramRow(y, normalized.data());
+    });
+    toneMap.buildLuts();
+
+    std::vector<T> mapped(imageWidth);
+    std::vector<T> colorRow(layout.colored ? 3 * imageWidth : 0);
+    std::vector<char> bytes;
+    forEachRow([&](int y, const cv::Vec3f* src, const float* lum) {
+        toneMap.normalize(lum, normalized.data());
+        toneMap.mapRow(y, normalized.data(), mapped.data());
+        const T* row = mapped.data();
+        if (layout.colored) {
+            restoreColor(src, lum, mapped.data(), colorRow.data(), imageWidth);
+            row = colorRow.data();
+        }
+        encodePnmRow(row, imageWidth, channels, bytes);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    });
+    return static_cast<bool>(out);
+}
+
+template <typename Record>
+bool writeBanded(const std::vector<Record>& stars, const std::string& outputPath, int imageWidth, int imageHeight,
+                 double centerRA, double centerDec, double fovRA, double fovDec, double magnitudeThreshold,
+                 const RenderOptions& options, int bandHeight) {
+    const bool colored = options.colorModel != ColorModel::Mono;
+    std::filesystem::path path(outputPath);
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (extension != ".pnm" && extension != (colored ? ".ppm" : ".pgm")) {
+        std::cerr << "Error: banded rendering writes " << (colored ? ".ppm" : ".pgm") << " or .pnm files, not "
+                  << outputPath << std::endl;
+        return false;
+    }
+    if (imageWidth <= 0 || imageHeight <= 0) {
+        std::cerr << "Error: invalid image size " << imageWidth << "x" << imageHeight << std::endl;
+        return false;
+    }
+
+    std::filesystem::path dir = path.parent_path();
+    std::error_code error;
+    if (!dir.empty() && !std::filesystem::exists(dir, error)) {
+        std::filesystem::create_directories(dir, error);
+    }
+    std::ofstream out(outputPath, std::ios::binary | std::ios::trunc);
+    const bool wide = options.bitDepth == 16;
+    out << (colored ? "P6" : "P5") << "\n" << imageWidth << " " << imageHeight << "\n" << (wide ? 65535 : 255) << "\n";
+
+    bandHeight = std::clamp(bandHeight, 1, imageHeight);
+    bool written = out && (wide ? renderBanded<uint16_t>(stars, out, imageWidth, imageHeight, centerRA, centerDec,
+                                                         fovRA, fovDec, magnitudeThreshold, options, bandHeight)
+                                : renderBanded<uint8_t>(stars, out, imageWidth, imageHeight, centerRA, centerDec,
+                                                        fovRA, fovDec, magnitudeThreshold, options, bandHeight));
+    out.close();
+    if (!written || !out) {
+        std::cerr << "Error: Could not save the star map to " << outputPath << std::endl;
+        return false;
+    }
+    if (Metrics::Verbose()) {
         std::cout << "Star map saved to " << outputPath << std::endl;
     }
+    return true;
+}
+
+bool drawStarMapBanded(const std::vector<star>& stars,
+                       const std::string& outputPath,
+                       int imageWidth, int imageHeight,
+                       double centerRA, double centerDec, double fovRA, double fovDec,
+                       double magnitudeThreshold,
+                       const RenderOptions& options,
+                       int bandHeight) {
+    return writeBanded(stars, outputPath, imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec,
+                       magnitudeThreshold, options, bandHeight);
 }
 
-}
\ No newline at end of file
+bool drawStarMapBanded(const std::vector<compact_star>& stars,
+                       const std::string& outputPath,
+                       int imageWidth, int imageHeight,
+                       double centerRA, double centerDec, double fovRA, double fovDec,
+                       double magnitudeThreshold,
+                       const RenderOptions& options,
+                       int bandHeight) {
+    return writeBanded(stars, outputPath, imageWidth, imageHeight, centerRA, centerDec, fovRA, fovDec,
+                       magnitudeThreshold, options, bandHeight);
+}
+
+}
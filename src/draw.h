@@ -5,6 +5,8 @@
 #ifndef STARSIMULATION_DRAW_H
 #define STARSIMULATION_DRAW_H
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 #include <common.h>
@@ -12,11 +14,111 @@
 
 
 namespace StarMapDrawer {
+    // 颜色模型：Mono 只累加一个亮度通道，输出灰度图；BV 按星表 B−V 色指数给星上色，输出三通道
+    enum class ColorModel {
+        Mono,
+        BV,
+    };
+
+    // 渲染选项
+    struct RenderOptions {
+        int threads = 1;      // 1 表示在调用线程里串行渲染，其他值把分块交给进程级 Executor 并行渲染
+        int tileSize = 256;   // 分块边长（像素），每块由一个任务独占渲染
+        ColorModel colorModel = ColorModel::Mono;
+        int bitDepth = 8;     // 输出位深，8 或 16（16 位需要 PNG/TIFF 等支持的格式）
+        uint64_t seed = 0;    // 抖动和噪声的种子，相同种子和输入得到逐位相同的图像
+        double gamma = 0.0;   // 滚转角（度），与 observer 的 gamma 相同，图像上方从北向东转过的角度
+    };
+
+    // 以 (centerRA, centerDec) 为切点做心射投影，fovRA/fovDec 是图像宽高对应的视场角（度）
     void drawStarMap(const std::vector<star>& stars,
                  const std::string& outputPath,
                  int imageWidth, int imageHeight,
                  double centerRA, double centerDec, double fovRA, double fovDec,
-                 double magnitudeThreshold = 12.0);
+                 double magnitudeThreshold = 12.0,
+                 const RenderOptions& options = RenderOptions());
+    // 直接渲染紧凑记录（见 observer::FileterStarInViewCompact），布点时逐颗解包，不展开成 star。
+    // 与把 CompactStar::UnpackAll 的结果交给上面的版本逐位相同
+    void drawStarMap(const std::vector<compact_star>& stars,
+                 const std::string& outputPath,
+                 int imageWidth, int imageHeight,
+                 double centerRA, double centerDec, double fovRA, double fovDec,
+                 double magnitudeThreshold = 12.0,
+                 const RenderOptions& options = RenderOptions());
+
+    // 条带渲染超大图像（海报、巨像素星图）：一次只累加 bandHeight 行，峰值内存是一个条带的累加缓冲区加上布点后的
+    // 星表，与图像高度无关。核跨过条带边界的星在相邻条带里各累加落在其中的部分，条带之间没有接缝。
+    // 归一化和 CLAHE 依赖整幅图像的亮度范围和各块直方图，所以星要累加三遍：第一遍统计亮度范围，第二遍统计直方图，
+    // 第三遍映射后逐行写出。输出是二进制 PGM（Mono）或 PPM（彩色），扩展名为 .pgm/.ppm/.pnm，16 位时每个采样
+    // 两字节大端。像素值与 drawStarMap 写出的同格式图像相同。扩展名不对或写文件失败时打印错误并返回 false
+    bool drawStarMapBanded(const std::vector<star>& stars,
+                           const std::string& outputPath,
+                           int imageWidth, int imageHeight,
+                           double centerRA, double centerDec, double fovRA, double fovDec,
+                           double magnitudeThreshold = 12.0,
+                           const RenderOptions& options = RenderOptions(),
+                           int bandHeight = 256);
+    bool drawStarMapBanded(const std::vector<compact_star>& stars,
+                           const std::string& outputPath,
+                           int imageWidth, int imageHeight,
+                           double centerRA, double centerDec, double fovRA, double fovDec,
+                           double magnitudeThreshold = 12.0,
+                           const RenderOptions& options = RenderOptions(),
+                           int bandHeight = 256);
+
+    // 增量渲染：add 把一批星交给 Executor 上的后台任务后立即返回，可以边查询边渲染（见 observer::StreamStarsInView）。
+    // 各批按 add 的顺序串行累加，批内仍按分块并行；星的编号跨批连续，finish 得到的图像与把各批拼接后
+    // 调用 drawStarMap 逐位相同。add 可以从任意线程调用，但调用方负责批次之间的顺序
+    class Accumulator {
+    public:
+        Accumulator(int imageWidth, int imageHeight,
+                    double centerRA, double centerDec, double fovRA, double fovDec,
+                    double magnitudeThreshold = 12.0,
+                    const RenderOptions& options = RenderOptions());
+        ~Accumulator(); // 等待还在累加的批次
+        Accumulator(const Accumulator&) = delete;
+        Accumulator& operator=(const Accumulator&) = delete;
+
+        void add(std::vector<star>&& stars);
+        // 等所有批次累加完，色调映射后写文件，失败返回 false。某一批累加时抛出的异常在这里重新抛出，
+        // 之后的批次被丢弃，再次调用 finish 返回 false，不会写出缺了星的图像
+        bool finish(const std::string& outputPath);
+
+    private:
+        struct State;
+        std::unique_ptr<State> state_;
+
+        friend class FrameRenderer;
+        friend void drawStarMap(const std::vector<star>&, const std::string&, int, int,
+                                double, double, double, double, double, const RenderOptions&);
+        friend void drawStarMap(const std::vector<compact_star>&, const std::string&, int, int,
+                                double, double, double, double, double, const RenderOptions&);
+    };
+
+    // 逐帧渲染同样尺寸、同样视场大小的图像（序列渲染，见 StarSequence::RenderSequence）。累加缓冲区、布点和分块
+    // 列表、色调映射的中间图像在帧之间复用，PSF 核与 drawStarMap 共用进程级缓存。render 只做到色调映射，
+    // 编码写文件交给 writeImage，可以在另一个线程上对上一帧进行。同一帧参数下 render 加 writeImage 写出的图像
+    // 与 drawStarMap 逐位相同（options.gamma 被每帧的 gamma 取代）。一个 FrameRenderer 同一时刻只能渲染一帧
+    class FrameRenderer {
+    public:
+        FrameRenderer(int imageWidth, int imageHeight, double fovRA, double fovDec,
+                      double magnitudeThreshold = 12.0,
+                      const RenderOptions& options = RenderOptions());
+        ~FrameRenderer();
+        FrameRenderer(const FrameRenderer&) = delete;
+        FrameRenderer& operator=(const FrameRenderer&) = delete;
+
+        // 以 (centerRA, centerDec) 为切点、滚转角 gamma 渲染一帧，结果写到 image；image 的尺寸和类型不变时复用它的内存
+        void render(const std::vector<star>& stars, double centerRA, double centerDec, double gamma, cv::Mat& image);
+
+    private:
+        double fovRA_;
+        double fovDec_;
+        std::unique_ptr<Accumulator::State> state_;
+    };
+
+    // 把渲染好的图像按扩展名编码写到 outputPath，目录不存在时创建，失败时打印错误并返回 false
+    bool writeImage(const cv::Mat& image, const std::string& outputPath);
 
 }
 
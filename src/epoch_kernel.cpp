@@ -0,0 +1,216 @@
+//
+// Created by viking on 2025/3/29.
+//
+
+#include "epoch_kernel.h"
+#include "fov_kernel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+void StarBatch::clear() {
+    ra.clear();
+    dec.clear();
+    magnitude.clear();
+    pm_ra.clear();
+    pm_dec.clear();
+    epoch_ra.clear();
+    epoch_dec.clear();
+    color_index.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+}
+
+void StarBatch::reserve(std::size_t n) {
+    ra.reserve(n);
+    dec.reserve(n);
+    for (std::vector<float>* column : {&magnitude, &pm_ra, &pm_dec, &epoch_ra, &epoch_dec, &color_index, &x, &y, &z}) {
+        column->reserve(n);
+    }
+}
+
+void StarBatch::append(const catalog_star* first, const catalog_star* last, const unit_vector* vectors) {
+    const std::size_t begin = size();
+    const std::size_t n = static_cast<std::size_t>(last - first);
+    ra.resize(begin + n);
+    dec.resize(begin + n);
+    for (std::vector<float>* column : {&magnitude, &pm_ra, &pm_dec, &epoch_ra, &epoch_dec, &color_index, &x, &y, &z}) {
+        column->resize(begin + n);
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        const catalog_star& s = first[i];
+        ra[begin + i] = s.ra;
+        dec[begin + i] = s.dec;
+        magnitude[begin + i] = s.magnitude;
+        pm_ra[begin + i] = s.pm_ra;
+        pm_dec[begin + i] = s.pm_dec;
+        epoch_ra[begin + i] = s.epoch_ra;
+        epoch_dec[begin + i] = s.epoch_dec;
+        color_index[begin + i] = s.color_index;
+        x[begin + i] = vectors[i].x;
+        y[begin + i] = vectors[i].y;
+        z[begin + i] = vectors[i].z;
+    }
+}
+
+void StarBatch::push_back(const catalog_star& s) {
+    push_back(s, FovKernel::UnitVector(s.ra, s.dec));
+}
+
+void StarBatch::push_back(const catalog_star& s, const unit_vector& v) {
+    ra.push_back(s.ra);
+    dec.push_back(s.dec);
+    magnitude.push_back(s.magnitude);
+    pm_ra.push_back(s.pm_ra);
+    pm_dec.push_back(s.pm_dec);
+    epoch_ra.push_back(s.epoch_ra);
+    epoch_dec.push_back(s.epoch_dec);
+    color_index.push_back(s.color_index);
+    x.push_back(v.x);
+    y.push_back(v.y);
+    z.push_back(v.z);
+}
+
+namespace EpochKernel {
+
+namespace {
+    constexpr double DEG = M_PI / 180.0;
+    constexpr double J2000_UNIX_SECONDS = 946728000.0; // 2000-01-01 12:00 UTC
+    constexpr double SECONDS_PER_JULIAN_YEAR = 365.25 * 86400.0;
+    constexpr double MAS_TO_RAD = DEG / MAS_PER_DEGREE;
+    constexpr double SMALL_ANGLE = 1e-2; // 弧度；以内用级数，截断误差小于 1e-15
+    constexpr float MIN_FAST_RHO = 0.17f; // cosδ 小于它（|δ| > 80°）时单精度向量求出的 tanδ 不够准
+
+    // 一百年内绝大多数星的位移不到 1e-3 弧度，小参数直接用级数，比调用 libm 快得多
+    double SmallAtan(double t) {
+        if (std::abs(t) >= SMALL_ANGLE) return std::atan(t);
+        double t2 = t * t;
+        return t * (1.0 - t2 * (1.0 / 3.0 - t2 * (1.0 / 5.0 - t2 / 7.0)));
+    }
+
+    double SmallAsin(double s) {
+        if (std::abs(s) >= SMALL_ANGLE) return std::asin(s);
+        double s2 = s * s;
+        return s * (1.0 + s2 * (1.0 / 6.0 + s2 * (3.0 / 40.0 + s2 * 15.0 / 336.0)));
+    }
+}
+
+double CurrentEpoch() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    double unix_seconds = std::chrono::duration<double>(now).count();
+    return 2000.0 + (unix_seconds - J2000_UNIX_SECONDS) / SECONDS_PER_JULIAN_YEAR;
+}
+
+double MaxDisplacement(double epoch) {
+    double max_dt = std::max(std::abs(epoch - MIN_MEAN_EPOCH), std::abs(epoch - MAX_MEAN_EPOCH));
+    return MAX_PROPER_MOTION * max_dt / MAS_PER_DEGREE;
+}
+
+void PropagateVector(double ra, double dec, float pm_ra, float pm_dec, float epoch_ra, float epoch_dec,
+                     double epoch, double p[3]) {
+    const double d_ra = pm_ra * (epoch - epoch_ra) * MAS_TO_RAD;   // 弧度
+    const double d_dec = pm_dec * (epoch - epoch_dec) * MAS_TO_RAD;
+    const double sin_ra = std::sin(ra * DEG), cos_ra = std::cos(ra * DEG);
+    const double sin_dec = std::sin(dec * DEG), cos_dec = std::cos(dec * DEG);
+    // p + Δα·∂p/∂α + Δδ·∂p/∂δ，其中 ∂p/∂α = cosδ·(-sinα, cosα, 0)，∂p/∂δ = (-sinδcosα, -sinδsinα, cosδ)
+    p[0] = cos_dec * cos_ra - d_ra * cos_dec * sin_ra - d_dec * sin_dec * cos_ra;
+    p[1] = cos_dec * sin_ra + d_ra * cos_dec * cos_ra - d_dec * sin_dec * sin_ra;
+    p[2] = sin_dec + d_dec * cos_dec;
+}
+
+void PropagateStar(double& ra, double& dec, float pm_ra, float pm_dec, float epoch_ra, float epoch_dec,
+                   double epoch) {
+    const double d_ra = pm_ra * (epoch - epoch_ra) * MAS_TO_RAD;
+    const double d_dec = pm_dec * (epoch - epoch_dec) * MAS_TO_RAD;
+    if (d_ra == 0.0 && d_dec == 0.0) return;
+    const double sin_dec = std::sin(dec * DEG), cos_dec = std::cos(dec * DEG);
+    // 与 PropagateVector 相同，只是在绕 z 轴转过 -α 的坐标系里算：p = (cosδ - Δδ·sinδ, Δα·cosδ, sinδ + Δδ·cosδ)，
+    // 不用算 α 的三角函数；赤经、赤纬的变化量都是小角度，用级数求
+    const double x = cos_dec - d_dec * sin_dec;
+    const double y = d_ra * cos_dec;
+    const double z = sin_dec + d_dec * cos_dec;
+    const double r = std::sqrt(x * x + y * y);
+    const double norm = std::sqrt(r * r + z * z);
+    double new_ra = ra + (x > 0.0 ? SmallAtan(y / x) : std::atan2(y, x)) / DEG; // x <= 0 只在越过天极时出现
+    new_ra += (new_ra < 0.0 ? 360.0 : 0.0) - (new_ra >= 360.0 ? 360.0 : 0.0);
+    ra = new_ra;
+    dec += SmallAsin((z * cos_dec - r * sin_dec) / norm) / DEG; // sin(δ' - δ)
+}
+
+void PropagateAt(const StarBatch& batch, std::size_t i, double epoch, double& ra, double& dec) {
+    ra = batch.ra[i];
+    dec = batch.dec[i];
+    const float rho = std::sqrt(batch.x[i] * batch.x[i] + batch.y[i] * batch.y[i]);
+    if (rho < MIN_FAST_RHO) {
+        PropagateStar(ra, dec, batch.pm_ra[i], batch.pm_dec[i], batch.epoch_ra[i], batch.epoch_dec[i], epoch);
+        return;
+    }
+    const double d_ra = batch.pm_ra[i] * (epoch - batch.epoch_ra[i]) * MAS_TO_RAD;
+    const double d_dec = batch.pm_dec[i] * (epoch - batch.epoch_dec[i]) * MAS_TO_RAD;
+    // 把 PropagateStar 的式子用 t = tanδ 改写：Δα = atan(Δα₀ / (1 - Δδ₀·t))，
+    // sin(δ' - δ) = (Δδ₀ - t·e / (1 + √(1 + e))) / ((1 + t²)·|p|)，e = Δδ₀·t·(Δδ₀·t - 2) + Δα₀²。
+    // t 的一阶项正好消掉，单精度 t 的误差只进入二阶项，一百年内引起的误差在微角秒量级
+    const double t = static_cast<double>(batch.z[i]) / rho;
+    const double q = 1.0 - d_dec * t;
+    const double e = d_dec * t * (d_dec * t - 2.0) + d_ra * d_ra;
+    const double cos2_dec = 1.0 / (1.0 + t * t);
+    const double norm = std::sqrt(1.0 + d_ra * d_ra * cos2_dec + d_dec * d_dec);
+    double new_ra = ra + (q > 0.0 ? SmallAtan(d_ra / q) : std::atan2(d_ra, q)) / DEG;
+    new_ra += (new_ra < 0.0 ? 360.0 : 0.0) - (new_ra >= 360.0 ? 360.0 : 0.0);
+    ra = new_ra;
+    dec += SmallAsin(cos2_dec * (d_dec - t * e / (1.0 + std::sqrt(1.0 + e))) / norm) / DEG;
+}
+
+void Propagate(const StarBatch& batch, double epoch, double* __restrict ra_out, double* __restrict dec_out) {
+    const std::size_t n = batch.size();
+    const double* __restrict ra = batch.ra.data();
+    const double* __restrict dec = batch.dec.data();
+    const float* __restrict pm_ra = batch.pm_ra.data();
+    const float* __restrict pm_dec = batch.pm_dec.data();
+    const float* __restrict epoch_ra = batch.epoch_ra.data();
+    const float* __restrict epoch_dec = batch.epoch_dec.data();
+    const float* __restrict x = batch.x.data();
+    const float* __restrict y = batch.y.data();
+    const float* __restrict z = batch.z.data();
+    std::vector<uint8_t> slow(n);
+    uint8_t* __restrict slow_out = slow.data();
+
+    // 第一遍对所有星无条件按 PropagateAt 的 tanδ 式子算，atan/asin 直接用级数，循环体没有分支和函数调用；
+    // 近极区、越过天极或位移超出级数范围的星只记下来，结果作废
+    for (std::size_t i = 0; i < n; ++i) {
+        const float rho = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+        const double d_ra = pm_ra[i] * (epoch - epoch_ra[i]) * MAS_TO_RAD;
+        const double d_dec = pm_dec[i] * (epoch - epoch_dec[i]) * MAS_TO_RAD;
+        const double t = static_cast<double>(z[i]) / rho;
+        const double q = 1.0 - d_dec * t;
+        const double e = d_dec * t * (d_dec * t - 2.0) + d_ra * d_ra;
+        const double cos2_dec = 1.0 / (1.0 + t * t);
+        const double norm = std::sqrt(1.0 + d_ra * d_ra * cos2_dec + d_dec * d_dec);
+        const double a = d_ra / q;
+        const double sn = cos2_dec * (d_dec - t * e / (1.0 + std::sqrt(1.0 + e))) / norm;
+        const double a2 = a * a;
+        const double s2 = sn * sn;
+        double new_ra = ra[i] + a * (1.0 - a2 * (1.0 / 3.0 - a2 * (1.0 / 5.0 - a2 / 7.0))) / DEG;
+        new_ra += (new_ra < 0.0 ? 360.0 : 0.0) - (new_ra >= 360.0 ? 360.0 : 0.0);
+        ra_out[i] = new_ra;
+        dec_out[i] = dec[i] + sn * (1.0 + s2 * (1.0 / 6.0 + s2 * (3.0 / 40.0 + s2 * 15.0 / 336.0))) / DEG;
+        slow_out[i] = static_cast<uint8_t>((rho < MIN_FAST_RHO) | !(q > 0.0) | !(std::abs(a) < SMALL_ANGLE) |
+                                           !(std::abs(sn) < SMALL_ANGLE));
+    }
+    // 第二遍逐颗改正记下来的星，一般只占百分之几
+    for (std::size_t i = 0; i < n; ++i) {
+        if (slow_out[i]) PropagateAt(batch, i, epoch, ra_out[i], dec_out[i]);
+    }
+}
+
+void Propagate(StarBatch& batch, double epoch) {
+    std::vector<double> ra(batch.size());
+    std::vector<double> dec(batch.size());
+    Propagate(batch, epoch, ra.data(), dec.data());
+    batch.ra.swap(ra);
+    batch.dec.swap(dec);
+}
+
+}
@@ -0,0 +1,68 @@
+//
+// Created by viking on 2025/3/29.
+//
+
+#ifndef EPOCH_KERNEL_H
+#define EPOCH_KERNEL_H
+
+#include <cstddef>
+#include <vector>
+#include <common.h>
+
+// 结构体数组转成数组结构体（SoA），推算历元的内核按列连续访问，便于编译器向量化
+struct StarBatch {
+    std::vector<double> ra;
+    std::vector<double> dec;
+    std::vector<float> magnitude;
+    std::vector<float> pm_ra;
+    std::vector<float> pm_dec;
+    std::vector<float> epoch_ra;
+    std::vector<float> epoch_dec;
+    std::vector<float> color_index;
+    std::vector<float> x;   // 平均位置的单位向量，视场判断用
+    std::vector<float> y;
+    std::vector<float> z;
+
+    std::size_t size() const { return ra.size(); }
+    void clear();
+    void reserve(std::size_t n);
+    void push_back(const catalog_star& s);                        // 由平均位置现算单位向量
+    void push_back(const catalog_star& s, const unit_vector& v);  // 快照里预先算好的单位向量
+    void append(const catalog_star* first, const catalog_star* last, const unit_vector* vectors); // 整段追加
+};
+
+namespace EpochKernel {
+    // Tycho-2 中最大的总自行（毫角秒/年）与平均历元范围，用来估计查询时需要外扩的范围
+    constexpr double MAX_PROPER_MOTION = 10400.0;
+    constexpr double MIN_MEAN_EPOCH = 1911.0;
+    constexpr double MAX_MEAN_EPOCH = 1993.0;
+
+    // 当前时刻的儒略历元（年），observer 的默认观测历元
+    double CurrentEpoch();
+
+    // 星表中任意一颗星在 epoch 时相对平均位置的最大角位移（度）
+    double MaxDisplacement(double epoch);
+
+    constexpr double MAS_PER_DEGREE = 3600000.0;
+
+    // 单颗星从平均历元推到 epoch：在平均位置的切平面上沿东、北方向线性移动 μα·cosδ·Δt 和 μδ·Δt，
+    // 结果是未归一化的方向向量 p。与 FovKernel::Select 的单精度向量推算是同一个模型
+    void PropagateVector(double ra, double dec, float pm_ra, float pm_dec, float epoch_ra, float epoch_dec,
+                         double epoch, double p[3]);
+
+    // 同一个模型，直接得到推算后的赤经赤纬，赤经归一化到 [0, 360)
+    void PropagateStar(double& ra, double& dec, float pm_ra, float pm_dec, float epoch_ra, float epoch_dec,
+                       double epoch);
+
+    // batch 中第 i 颗星推到 epoch，结果与 PropagateStar 相同（差别在微角秒量级）。
+    // tanδ 由 batch 里的单精度单位向量求出，不调用三角函数；近极区退回 PropagateStar
+    void PropagateAt(const StarBatch& batch, std::size_t i, double epoch, double& ra, double& dec);
+
+    // 把 batch 中所有星推到 epoch，结果写到 ra_out/dec_out（各 batch.size() 个），与逐颗调用 PropagateAt 逐位相同。
+    // 先对整批无分支地按切平面式子计算（可以向量化），再逐颗改正近极区和位移过大的少数星
+    void Propagate(const StarBatch& batch, double epoch, double* ra_out, double* dec_out);
+    // 同上，结果写回 batch 的 ra/dec
+    void Propagate(StarBatch& batch, double epoch);
+}
+
+#endif //EPOCH_KERNEL_H
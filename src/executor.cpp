@@ -0,0 +1,148 @@
+//
+// Created by viking on 2025/4/5.
+//
+
+#include "executor.h"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace {
+    // 当前线程所属的 Executor 和队列下标，非工作线程为空
+    thread_local const Executor* tls_executor = nullptr;
+    thread_local std::size_t tls_index = 0;
+}
+
+Executor::Executor(std::size_t thread_count) : worker_count_(std::max<std::size_t>(thread_count, 1)) {
+    for (std::size_t i = 0; i <= worker_count_; ++i) {
+        queues_.push_back(std::make_unique<TaskQueue>());
+    }
+    workers_.reserve(worker_count_);
+    for (std::size_t i = 0; i < worker_count_; ++i) {
+        workers_.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_.store(true);
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+Executor& Executor::Instance() {
+    static Executor executor(std::max(1u, std::thread::hardware_concurrency()));
+    return executor;
+}
+
+void Executor::submit(Task task) {
+    std::size_t index = tls_executor == this ? tls_index : worker_count_;
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+    // 先拿一下 sleep_mutex_ 再通知，避免工作线程检查完条件、还没睡下时错过这次唤醒
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    wake_.notify_one();
+}
+
+bool Executor::popTask(std::size_t self, Task& task) {
+    const std::size_t count = queues_.size();
+    // 自己的队列从尾部取
+    if (self < worker_count_) {
+        TaskQueue& own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    // 公共队列和其他线程的队列从头部取，从自己的下一个开始轮询，分散竞争。
+    // 非工作线程的 self 就是公共队列，也要从它取，否则提交任务的线程没法帮忙执行自己提交的任务
+    for (std::size_t k = 1; k <= count; ++k) {
+        std::size_t victim = (self + k) % count;
+        if (victim == self && self < worker_count_) continue;
+        TaskQueue& queue = *queues_[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Executor::runOne() {
+    if (queued_.load() == 0) return false;
+    std::size_t self = tls_executor == this ? tls_index : worker_count_;
+    Task task;
+    if (!popTask(self, task)) return false;
+    queued_.fetch_sub(1);
+    task();
+    return true;
+}
+
+void Executor::workerLoop(std::size_t index) {
+    tls_executor = this;
+    tls_index = index;
+    while (true) {
+        Task task;
+        if (popTask(index, task)) {
+            queued_.fetch_sub(1);
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stopping_.load() || queued_.load() > 0; });
+        if (stopping_.load() && queued_.load() == 0) return;
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    waitAll();
+}
+
+void TaskGroup::run(Executor::Task task) {
+    pending_.fetch_add(1);
+    executor_.submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+        // 计数归零和通知都在锁内，wait() 返回后任务不会再碰这个对象
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.fetch_sub(1) == 1) {
+            done_.notify_all();
+        }
+    });
+}
+
+void TaskGroup::waitAll() {
+    while (pending_.load() > 0) {
+        if (executor_.runOne()) continue;
+        // 队列已空，剩下的任务正在别的线程上执行；短暂睡眠后再看有没有新提交的任务可以帮忙
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending_.load() == 0; });
+    }
+    // 最后一个任务可能还持有 mutex_，拿一次锁确认它已离开
+    std::lock_guard<std::mutex> lock(mutex_);
+}
+
+void TaskGroup::wait() {
+    waitAll();
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error = std::exchange(error_, nullptr);
+    }
+    if (error) std::rethrow_exception(error);
+}
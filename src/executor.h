@@ -0,0 +1,81 @@
+//
+// Created by viking on 2025/4/5.
+//
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 进程级的工作窃取线程池，查询、入库和渲染都把细粒度任务提交到这里，不再每次调用都创建线程。
+// 每个工作线程有自己的双端队列：自己从尾部取（后进先出，缓存友好），空闲线程从别人头部偷；
+// 非工作线程提交的任务进入公共队列。
+class Executor {
+public:
+    using Task = std::function<void()>;
+
+    explicit Executor(std::size_t thread_count);
+    ~Executor();
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // 进程内共享的实例，线程数等于硬件线程数，第一次使用时创建
+    static Executor& Instance();
+
+    std::size_t threadCount() const { return worker_count_; }
+
+    void submit(Task task);
+
+    // 取一个任务在当前线程执行，没有任务时返回 false；等待任务组的线程用它帮忙干活
+    bool runOne();
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(std::size_t index);
+    bool popTask(std::size_t self, Task& task);
+
+    const std::size_t worker_count_;
+    std::vector<std::unique_ptr<TaskQueue>> queues_; // 每个工作线程一个，最后一个是公共队列
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<bool> stopping_{false};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+};
+
+// 一组相关任务，wait() 在全部完成前不返回，等待期间调用线程也执行队列里的任务，
+// 所以任务里嵌套使用 TaskGroup 不会占死线程。任务抛出的第一个异常在 wait() 里重新抛出。
+class TaskGroup {
+public:
+    explicit TaskGroup(Executor& executor = Executor::Instance()) : executor_(executor) {}
+    ~TaskGroup();
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(Executor::Task task);
+    void wait();
+    void waitAll(); // 同 wait()，但不重新抛出任务的异常，用在析构函数里
+
+private:
+
+    Executor& executor_;
+    std::atomic<std::size_t> pending_{0};
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::exception_ptr error_;
+};
+
+#endif //EXECUTOR_H
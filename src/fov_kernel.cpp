@@ -0,0 +1,260 @@
+//
+// Created by viking on 2025/4/9.
+//
+
+#include "fov_kernel.h"
+#include <algorithm>
+#include <cmath>
+
+namespace FovKernel {
+
+namespace {
+    constexpr double DEG = M_PI / 180.0;
+    constexpr double MAX_FOV = 179.9;           // 心射投影只能覆盖小于半个天球的视场
+    constexpr int EDGE_SAMPLES = 16;            // Bounds 在矩形每条边上的采样段数
+    constexpr double CONE_COVER_MAX = 4.0;      // 外接圆锥半角（度）不超过它时直接用圆锥的包围范围，多出的格子很少
+    constexpr std::size_t SELECT_BLOCK = 256;   // Select 先算一块的判断结果再压缩下标
+    constexpr float SELECT_MARGIN = 1e-5f;      // 单精度误差约 1e-7，边界内外各留远大于它的余量（约 2 角秒）
+    constexpr double CAP_MARGIN = 1e-4;         // CapOverlap 在球冠外再留的余量（弧度，约 20 角秒），远大于 SELECT_MARGIN
+
+    double Dot(const double* a, const double* b) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+}
+
+unit_vector UnitVector(double ra, double dec) {
+    double cos_dec = std::cos(dec * DEG);
+    return unit_vector{static_cast<float>(cos_dec * std::cos(ra * DEG)),
+                       static_cast<float>(cos_dec * std::sin(ra * DEG)),
+                       static_cast<float>(std::sin(dec * DEG))};
+}
+
+void ToRaDec(double x, double y, double z, double& ra, double& dec) {
+    ra = std::atan2(y, x) / DEG;
+    ra += ra < 0.0 ? 360.0 : 0.0;
+    dec = std::atan2(z, std::sqrt(x * x + y * y)) / DEG;
+}
+
+Frame MakeFrame(double ra, double dec, double gamma) {
+    const double sin_ra = std::sin(ra * DEG), cos_ra = std::cos(ra * DEG);
+    const double sin_dec = std::sin(dec * DEG), cos_dec = std::cos(dec * DEG);
+    const double sin_g = std::sin(gamma * DEG), cos_g = std::cos(gamma * DEG);
+    // 东、北两个方向在极点处仍有定义（取赤经 ra 所在的子午面）
+    const double east[3] = {-sin_ra, cos_ra, 0.0};
+    const double north[3] = {-sin_dec * cos_ra, -sin_dec * sin_ra, cos_dec};
+
+    Frame frame{};
+    frame.boresight[0] = cos_dec * cos_ra;
+    frame.boresight[1] = cos_dec * sin_ra;
+    frame.boresight[2] = sin_dec;
+    for (int k = 0; k < 3; ++k) {
+        frame.right[k] = cos_g * east[k] - sin_g * north[k];
+        frame.up[k] = cos_g * north[k] + sin_g * east[k];
+    }
+    return frame;
+}
+
+FieldOfView MakeFieldOfView(double ra, double dec, double fov_w, double fov_h, double gamma) {
+    FieldOfView fov{};
+    fov.ra = ra;
+    fov.dec = dec;
+    fov.frame = MakeFrame(ra, dec, gamma);
+    fov.tan_half_w = std::tan(std::clamp(fov_w, 0.0, MAX_FOV) / 2.0 * DEG);
+    fov.tan_half_h = std::tan(std::clamp(fov_h, 0.0, MAX_FOV) / 2.0 * DEG);
+    fov.cos_cone = 1.0 / std::sqrt(1.0 + fov.tan_half_w * fov.tan_half_w + fov.tan_half_h * fov.tan_half_h);
+    return fov;
+}
+
+bool Project(const Frame& frame, double ra, double dec, double& u, double& v) {
+    const double cos_dec = std::cos(dec * DEG);
+    const double p[3] = {cos_dec * std::cos(ra * DEG), cos_dec * std::sin(ra * DEG), std::sin(dec * DEG)};
+    double w = Dot(p, frame.boresight);
+    if (w <= 0.0) return false;
+    u = Dot(p, frame.right) / w;
+    v = Dot(p, frame.up) / w;
+    return true;
+}
+
+bool Contains(const FieldOfView& fov, double ra, double dec) {
+    const double cos_dec = std::cos(dec * DEG);
+    const double p[3] = {cos_dec * std::cos(ra * DEG), cos_dec * std::sin(ra * DEG), std::sin(dec * DEG)};
+    return Contains(fov, p);
+}
+
+bool Contains(const FieldOfView& fov, const double p[3]) {
+    double w = Dot(p, fov.frame.boresight);
+    return w > 0.0 && std::abs(Dot(p, fov.frame.right)) <= fov.tan_half_w * w &&
+           std::abs(Dot(p, fov.frame.up)) <= fov.tan_half_h * w;
+}
+
+void Bounds(const FieldOfView& fov, double& dec_min, double& dec_max, double& ra_half_width) {
+    // 小视场：外接圆锥的包围范围有解析式，比沿边采样便宜得多
+    const double cone = std::acos(std::min(fov.cos_cone, 1.0)) / DEG;
+    if (cone <= CONE_COVER_MAX) {
+        dec_min = std::max(fov.dec - cone, -90.0);
+        dec_max = std::min(fov.dec + cone, 90.0);
+        ra_half_width = std::abs(fov.dec) + cone >= 89.0
+                            ? 180.0
+                            : std::asin(std::sin(cone * DEG) / std::cos(fov.dec * DEG)) / DEG;
+        return;
+    }
+
+    // 赤纬和赤经在天球上除极点外没有内部极值，只需沿矩形边界（切平面上的直线就是大圆弧）采样
+    const double corners[4][2] = {{-fov.tan_half_w, -fov.tan_half_h}, {fov.tan_half_w, -fov.tan_half_h},
+                                  {fov.tan_half_w, fov.tan_half_h}, {-fov.tan_half_w, fov.tan_half_h}};
+    const Frame& f = fov.frame;
+    dec_min = 90.0;
+    dec_max = -90.0;
+    ra_half_width = 0.0;
+    for (int edge = 0; edge < 4; ++edge) {
+        const double* a = corners[edge];
+        const double* b = corners[(edge + 1) % 4];
+        for (int s = 0; s <= EDGE_SAMPLES; ++s) {
+            double t = static_cast<double>(s) / EDGE_SAMPLES;
+            double u = a[0] + (b[0] - a[0]) * t;
+            double v = a[1] + (b[1] - a[1]) * t;
+            double ra, dec;
+            ToRaDec(f.boresight[0] + u * f.right[0] + v * f.up[0],
+                    f.boresight[1] + u * f.right[1] + v * f.up[1],
+                    f.boresight[2] + u * f.right[2] + v * f.up[2], ra, dec);
+            dec_min = std::min(dec_min, dec);
+            dec_max = std::max(dec_max, dec);
+            double delta_ra = std::fmod(ra - fov.ra + 540.0, 360.0) - 180.0;
+            ra_half_width = std::max(ra_half_width, std::abs(delta_ra));
+        }
+    }
+
+    // 采样点之间的弧偏离折线的粗略上界：相邻采样点角距的平方
+    double step = 2.0 * std::atan(std::max(fov.tan_half_w, fov.tan_half_h)) / EDGE_SAMPLES;
+    double margin = step * step / DEG;
+    dec_min = std::max(dec_min - margin, -90.0);
+    dec_max = std::min(dec_max + margin, 90.0);
+
+    // 视场包含天极时覆盖整圈赤经
+    if (Contains(fov, 0.0, 90.0)) dec_max = 90.0;
+    if (Contains(fov, 0.0, -90.0)) dec_min = -90.0;
+    double max_abs_dec = std::max(std::abs(dec_min), std::abs(dec_max));
+    ra_half_width = max_abs_dec >= 89.0 ? 180.0
+                                        : std::min(180.0, ra_half_width + margin / std::cos(max_abs_dec * DEG));
+}
+
+void Select(const StarBatch& batch, const FieldOfView& fov, double epoch,
+            std::vector<uint32_t>& inside, std::vector<uint32_t>& boundary) {
+    const std::size_t n = batch.size();
+    const float* __restrict x = batch.x.data();
+    const float* __restrict y = batch.y.data();
+    const float* __restrict z = batch.z.data();
+    const float* __restrict pm_ra = batch.pm_ra.data();
+    const float* __restrict pm_dec = batch.pm_dec.data();
+    const float* __restrict epoch_ra = batch.epoch_ra.data();
+    const float* __restrict epoch_dec = batch.epoch_dec.data();
+
+    const Frame& f = fov.frame;
+    const float bx = static_cast<float>(f.boresight[0]), by = static_cast<float>(f.boresight[1]),
+                bz = static_cast<float>(f.boresight[2]);
+    const float rx = static_cast<float>(f.right[0]), ry = static_cast<float>(f.right[1]),
+                rz = static_cast<float>(f.right[2]);
+    const float ux = static_cast<float>(f.up[0]), uy = static_cast<float>(f.up[1]), uz = static_cast<float>(f.up[2]);
+    const float outer_w = static_cast<float>(fov.tan_half_w) + SELECT_MARGIN;
+    const float outer_h = static_cast<float>(fov.tan_half_h) + SELECT_MARGIN;
+    const float inner_w = static_cast<float>(fov.tan_half_w) - SELECT_MARGIN;
+    const float inner_h = static_cast<float>(fov.tan_half_h) - SELECT_MARGIN;
+    const float cone = static_cast<float>(fov.cos_cone) * (1.0f - SELECT_MARGIN);
+    const float t = static_cast<float>(epoch);
+    const float mas_to_rad = static_cast<float>(DEG / EpochKernel::MAS_PER_DEGREE);
+
+    uint8_t keep[SELECT_BLOCK]; // 0 视场外，1 边界余量内，2 确定在视场内
+    for (std::size_t begin = 0; begin < n; begin += SELECT_BLOCK) {
+        const std::size_t count = std::min(SELECT_BLOCK, n - begin);
+        // 循环体无分支，编译器可以按 SIMD 宽度展开
+        for (std::size_t j = 0; j < count; ++j) {
+            const std::size_t i = begin + j;
+            // 与 EpochKernel::PropagateStar 相同的推算：∂p/∂α = (-y, x, 0)，∂p/∂δ = (-zx/ρ, -zy/ρ, ρ)，
+            // 不归一化，|p| ≥ 1 不影响下面的比值判断
+            const float rho = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+            const float d_ra = pm_ra[i] * mas_to_rad * (t - epoch_ra[i]);
+            const float d_dec = pm_dec[i] * mas_to_rad * (t - epoch_dec[i]);
+            const float k = d_dec * z[i] / std::max(rho, 1e-12f);
+            const float px = x[i] - d_ra * y[i] - k * x[i];
+            const float py = y[i] + d_ra * x[i] - k * y[i];
+            const float pz = z[i] + d_dec * rho;
+
+            const float w = px * bx + py * by + pz * bz;
+            const float u = px * rx + py * ry + pz * rz;
+            const float v = px * ux + py * uy + pz * uz;
+            const bool outer = (w > cone) & (std::abs(u) <= outer_w * w) & (std::abs(v) <= outer_h * w);
+            const bool inner = (std::abs(u) <= inner_w * w) & (std::abs(v) <= inner_h * w);
+            keep[j] = static_cast<uint8_t>(outer + (outer & inner));
+        }
+        // 压缩下标也不用分支：先按整块预留，无条件写入，再按判断结果推进写指针。
+        // 视场内外的星交错出现时，分支写法几乎每颗星都会预测失败
+        const std::size_t inside_size = inside.size(), boundary_size = boundary.size();
+        inside.resize(inside_size + count);
+        boundary.resize(boundary_size + count);
+        uint32_t* __restrict inside_out = inside.data() + inside_size;
+        uint32_t* __restrict boundary_out = boundary.data() + boundary_size;
+        std::size_t inside_count = 0, boundary_count = 0;
+        for (std::size_t j = 0; j < count; ++j) {
+            const uint32_t index = static_cast<uint32_t>(begin + j);
+            inside_out[inside_count] = index;
+            boundary_out[boundary_count] = index;
+            inside_count += keep[j] >> 1;
+            boundary_count += keep[j] & 1;
+        }
+        inside.resize(inside_size + inside_count);
+        boundary.resize(boundary_size + boundary_count);
+    }
+}
+
+void Visible(const StarBatch& batch, const FieldOfView& fov, double epoch, std::vector<uint32_t>& indices) {
+    std::vector<uint32_t> boundary;
+    indices.clear();
+    Select(batch, fov, epoch, indices, boundary);
+    const std::size_t certain = indices.size();
+    for (uint32_t i : boundary) {
+        double p[3];
+        EpochKernel::PropagateVector(batch.ra[i], batch.dec[i], batch.pm_ra[i], batch.pm_dec[i],
+                                     batch.epoch_ra[i], batch.epoch_dec[i], epoch, p);
+        if (Contains(fov, p)) indices.push_back(i);
+    }
+    if (indices.size() != certain) {
+        std::inplace_merge(indices.begin(), indices.begin() + certain, indices.end());
+    }
+}
+
+void Cull(const StarBatch& batch, const FieldOfView& fov, double epoch, std::vector<star>& out,
+          double magnitude_limit) {
+    std::vector<uint32_t> inside;
+    Visible(batch, fov, epoch, inside);
+    for (uint32_t i : inside) {
+        if (batch.magnitude[i] > magnitude_limit) continue;
+        double star_ra, star_dec;
+        EpochKernel::PropagateAt(batch, i, epoch, star_ra, star_dec);
+        out.push_back(star{star_ra, star_dec, batch.magnitude[i], batch.color_index[i]});
+    }
+}
+
+Overlap CapOverlap(const FieldOfView& fov, const double center[3], double radius) {
+    const double norm = std::sqrt(Dot(center, center));
+    const double reach = radius + CAP_MARGIN;
+    if (!(norm > 0.0) || !(reach < M_PI / 2.0)) return Overlap::Partial;
+    const Frame& f = fov.frame;
+    const double w = Dot(center, f.boresight) / norm;
+    const double u = Dot(center, f.right) / norm;
+    const double v = Dot(center, f.up) / norm;
+    // 四条边所在大圆的内法向为 tan_half·boresight ∓ right 和 tan_half·boresight ∓ up，
+    // 中心到大圆的有向角距的正弦等于它与单位内法向的点积
+    const double norm_w = std::sqrt(1.0 + fov.tan_half_w * fov.tan_half_w);
+    const double norm_h = std::sqrt(1.0 + fov.tan_half_h * fov.tan_half_h);
+    const double edge[4] = {(fov.tan_half_w * w - u) / norm_w, (fov.tan_half_w * w + u) / norm_w,
+                            (fov.tan_half_h * w - v) / norm_h, (fov.tan_half_h * w + v) / norm_h};
+    const double sin_reach = std::sin(reach);
+    bool inside = true;
+    for (double d : edge) {
+        if (d <= -sin_reach) return Overlap::Outside;
+        inside = inside && d >= sin_reach;
+    }
+    return inside ? Overlap::Inside : Overlap::Partial;
+}
+
+}
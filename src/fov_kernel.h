@@ -0,0 +1,72 @@
+//
+// Created by viking on 2025/4/9.
+//
+
+#ifndef FOV_KERNEL_H
+#define FOV_KERNEL_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <common.h>
+#include <epoch_kernel.h>
+
+// 视场判断统一在单位向量上做：视轴方向和绕视轴的滚转角 gamma 确定一个正交基，星的方向做心射投影
+// 落到切平面上，再按矩形边界判断。没有赤经回绕，极区和任意滚转角都正确；drawStarMap 用同一个投影映射到像素。
+namespace FovKernel {
+    // 视场坐标系。gamma = 0 时 right 指向东（赤经增大方向），up 指向北
+    struct Frame {
+        double boresight[3];
+        double right[3];
+        double up[3];
+    };
+
+    struct FieldOfView {
+        double ra;          // 视场中心（度）
+        double dec;
+        Frame frame;
+        double tan_half_w;  // 切平面上的半宽，tan(fov_w / 2)
+        double tan_half_h;
+        double cos_cone;    // 外接圆锥（矩形四角到视轴的角距）半角的余弦
+    };
+
+    unit_vector UnitVector(double ra, double dec);
+    void ToRaDec(double x, double y, double z, double& ra, double& dec); // 向量不必归一化，赤经在 [0, 360)
+
+    // gamma 为滚转角（度），up 轴从北向东转过的角度
+    Frame MakeFrame(double ra, double dec, double gamma);
+    // 视场宽高（度）取不到 180，超出时按 179.9 处理
+    FieldOfView MakeFieldOfView(double ra, double dec, double fov_w, double fov_h, double gamma);
+
+    // 心射投影，(u, v) 是切平面坐标（视轴处为 0，单位为切平面上的弧度）；星在背面半球时返回 false
+    bool Project(const Frame& frame, double ra, double dec, double& u, double& v);
+
+    bool Contains(const FieldOfView& fov, double ra, double dec);
+    bool Contains(const FieldOfView& fov, const double p[3]); // p 是方向向量，不必归一化
+
+    // 视场矩形在赤道坐标下的包围范围：赤纬区间和以 fov.ra 为中心的赤经半宽，用来选天区格子
+    void Bounds(const FieldOfView& fov, double& dec_min, double& dec_max, double& ra_half_width);
+
+    // 批量视场判断：在单位向量上把平均位置沿自行推到 epoch，先与视轴点积做圆锥判断，再做切平面矩形判断。
+    // 按列连续访问的单精度循环，没有三角函数，可以向量化。离边界超过单精度误差余量（约 2 角秒）的星下标
+    // 追加到 inside，余量以内的追加到 boundary，调用方对 boundary 里的星再用 Contains 做双精度判断
+    void Select(const StarBatch& batch, const FieldOfView& fov, double epoch,
+                std::vector<uint32_t>& inside, std::vector<uint32_t>& boundary);
+
+    // Select 之后对 boundary 里的星做双精度判断，把视场内星的下标按升序写到 indices（先清空）
+    void Visible(const StarBatch& batch, const FieldOfView& fov, double epoch, std::vector<uint32_t>& indices);
+
+    // Visible 之后把视场内、不暗于 magnitude_limit 的星推到 epoch 换回赤经赤纬追加到 out。
+    // 结果与逐颗 PropagateStar + Contains 一致，并保持 batch 里原来的顺序
+    void Cull(const StarBatch& batch, const FieldOfView& fov, double epoch, std::vector<star>& out,
+              double magnitude_limit = std::numeric_limits<double>::infinity());
+
+    // 一组星与视场的关系，用来跳过整块判断：全在视场内、全在视场外，或者跨过边界
+    enum class Overlap { Outside, Partial, Inside };
+    // 以 center 为中心（不必归一化）、角半径 radius（弧度）的球冠与视场矩形的关系。判断是保守的：Inside 时
+    // 球冠离四条边都留有远大于 Select 误差的余量，Visible 一定保留其中所有的星；Outside 时球冠整个在某条边外侧；
+    // 拿不准时返回 Partial
+    Overlap CapOverlap(const FieldOfView& fov, const double center[3], double radius);
+}
+
+#endif //FOV_KERNEL_H
@@ -0,0 +1,157 @@
+//
+// Created by viking on 2025/4/8.
+//
+
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+namespace Metrics {
+
+namespace {
+    std::atomic<bool> g_verbose{false};
+
+    std::array<double, Histogram::BUCKET_COUNT> MakeBounds() {
+        std::array<double, Histogram::BUCKET_COUNT> bounds{};
+        const double steps[] = {1.0, 2.0, 5.0};
+        double decade = 1e-6;
+        for (std::size_t i = 0; i < bounds.size(); ++i) {
+            bounds[i] = steps[i % 3] * decade;
+            if (i % 3 == 2) decade *= 10.0;
+        }
+        return bounds;
+    }
+
+    std::string FormatDouble(double v) {
+        std::ostringstream out;
+        out << std::setprecision(9) << v;
+        return out.str();
+    }
+
+    std::string EscapeJson(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+}
+
+const std::array<double, Histogram::BUCKET_COUNT>& Histogram::UpperBounds() {
+    static const std::array<double, BUCKET_COUNT> bounds = MakeBounds();
+    return bounds;
+}
+
+void Histogram::observe(double value) {
+    const auto& bounds = UpperBounds();
+    std::size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_nanos_.fetch_add(static_cast<uint64_t>(std::llround(std::max(value, 0.0) * 1e9)), std::memory_order_relaxed);
+}
+
+double Histogram::sum() const {
+    return static_cast<double>(sum_nanos_.load(std::memory_order_relaxed)) * 1e-9;
+}
+
+void Histogram::reset() {
+    for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    sum_nanos_.store(0, std::memory_order_relaxed);
+}
+
+Registry& Registry::Global() {
+    static Registry registry;
+    return registry;
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : counters_) {
+        if (entry.name == name) return entry.metric;
+    }
+    counters_.emplace_back();
+    counters_.back().name = name;
+    counters_.back().help = help;
+    return counters_.back().metric;
+}
+
+Histogram& Registry::histogram(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : histograms_) {
+        if (entry.name == name) return entry.metric;
+    }
+    histograms_.emplace_back();
+    histograms_.back().name = name;
+    histograms_.back().help = help;
+    return histograms_.back().metric;
+}
+
+std::string Registry::toJson() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    out << "{\"counters\": {";
+    for (std::size_t i = 0; i < counters_.size(); ++i) {
+        out << (i ? ", " : "") << '"' << EscapeJson(counters_[i].name) << "\": " << counters_[i].metric.value();
+    }
+    out << "}, \"histograms\": {";
+    const auto& bounds = Histogram::UpperBounds();
+    for (std::size_t i = 0; i < histograms_.size(); ++i) {
+        const Histogram& h = histograms_[i].metric;
+        out << (i ? ", " : "") << '"' << EscapeJson(histograms_[i].name) << "\": {\"count\": " << h.count()
+            << ", \"sum\": " << FormatDouble(h.sum()) << ", \"buckets\": [";
+        for (std::size_t b = 0; b <= Histogram::BUCKET_COUNT; ++b) {
+            out << (b ? ", " : "") << "{\"le\": "
+                << (b < Histogram::BUCKET_COUNT ? FormatDouble(bounds[b]) : "\"+Inf\"")
+                << ", \"count\": " << h.bucketCount(b) << "}";
+        }
+        out << "]}";
+    }
+    out << "}}";
+    return out.str();
+}
+
+std::string Registry::toPrometheus() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    for (const auto& entry : counters_) {
+        out << "# HELP " << entry.name << ' ' << entry.help << '\n'
+            << "# TYPE " << entry.name << " counter\n"
+            << entry.name << ' ' << entry.metric.value() << '\n';
+    }
+    const auto& bounds = Histogram::UpperBounds();
+    for (const auto& entry : histograms_) {
+        const Histogram& h = entry.metric;
+        out << "# HELP " << entry.name << ' ' << entry.help << '\n'
+            << "# TYPE " << entry.name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (std::size_t b = 0; b < Histogram::BUCKET_COUNT; ++b) {
+            cumulative += h.bucketCount(b);
+            out << entry.name << "_bucket{le=\"" << FormatDouble(bounds[b]) << "\"} " << cumulative << '\n';
+        }
+        cumulative += h.bucketCount(Histogram::BUCKET_COUNT);
+        out << entry.name << "_bucket{le=\"+Inf\"} " << cumulative << '\n'
+            << entry.name << "_sum " << FormatDouble(h.sum()) << '\n'
+            << entry.name << "_count " << h.count() << '\n';
+    }
+    return out.str();
+}
+
+void Registry::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : counters_) entry.metric.reset();
+    for (auto& entry : histograms_) entry.metric.reset();
+}
+
+void SetVerbose(bool verbose) {
+    g_verbose.store(verbose, std::memory_order_relaxed);
+}
+
+bool Verbose() {
+    return g_verbose.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,94 @@
+//
+// Created by viking on 2025/4/8.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// 轻量埋点：进程级的计数器和直方图，热路径上只有 relaxed 原子加法。
+// 快照可以导出成 JSON 或 Prometheus 文本格式；原来打印到 stdout 的进度信息改为 SetVerbose(true) 时才输出。
+namespace Metrics {
+    class Counter {
+    public:
+        void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+        void reset() { value_.store(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value_{0};
+    };
+
+    // 固定桶的直方图，桶上界按 1-2-5 序列从 1 微秒到 50 秒，适合记录耗时（秒）
+    class Histogram {
+    public:
+        static constexpr std::size_t BUCKET_COUNT = 24;
+        static const std::array<double, BUCKET_COUNT>& UpperBounds();
+
+        void observe(double value);
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        double sum() const;
+        uint64_t bucketCount(std::size_t i) const { return buckets_[i].load(std::memory_order_relaxed); } // 非累计
+        void reset();
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT + 1> buckets_{}; // 最后一个是 +Inf
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> sum_nanos_{0}; // 以 1e-9 为单位累加，避免浮点原子操作
+    };
+
+    // 按名字注册的指标，返回的引用在进程生命周期内有效，调用方应缓存起来而不是每次查找
+    class Registry {
+    public:
+        static Registry& Global();
+
+        Counter& counter(const std::string& name, const std::string& help);
+        Histogram& histogram(const std::string& name, const std::string& help);
+
+        std::string toJson() const;
+        std::string toPrometheus() const;
+        void reset();
+
+    private:
+        template <typename Metric>
+        struct Entry {
+            std::string name;
+            std::string help;
+            Metric metric;
+        };
+
+        mutable std::mutex mutex_;
+        std::deque<Entry<Counter>> counters_;     // deque 保证元素地址稳定
+        std::deque<Entry<Histogram>> histograms_;
+    };
+
+    // 作用域计时，析构时把经过的秒数记入直方图
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Histogram& histogram)
+            : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            histogram_.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count());
+        }
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        Histogram& histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // 进度和统计信息是否打印到 stdout，默认关闭；错误信息始终输出到 stderr
+    void SetVerbose(bool verbose);
+    bool Verbose();
+}
+
+#endif //METRICS_H
@@ -1,176 +1,941 @@
 #include "observer.h"
+#include "compact_star.h"
+#include "sky_grid.h"
+#include "epoch_kernel.h"
+#include "fov_kernel.h"
+#include "executor.h"
+#include "metrics.h"
 #include <cmath>
 #include <hiredis/hiredis.h>
 #include <iostream>
 #include <stdexcept>
 #include <cstddef>
-#include <thread>
 #include <vector>
 #include <string>
 #include <mutex>
 #include <algorithm> // For std::move
 #include <atomic>   // For std::atomic
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
 
 std::atomic<std::size_t> g_processed_star_count = 0; // 全局原子计数器
 
-bool observer::isStarInFOV(double star_ra, double star_dec) const {
-    double delta_ra = std::fmod(star_ra - ra + 360.0, 360.0);
-    if (delta_ra > 180.0) {
-        delta_ra -= 360.0;
+namespace {
+    constexpr std::size_t CELL_PIPELINE_WINDOW = 64; // 一次流水线发送的格子数
+
+    // 快照后端每批最多这么多候选星。一批约 50 KB，留在 L2 里，也低于 glibc 归还堆顶内存的阈值，
+    // 否则每次查询都要重新触发缺页
+    constexpr std::size_t SNAPSHOT_BATCH_SIZE = 1024;
+
+    constexpr std::size_t STREAM_CHUNK_STARS = 2048;     // 流式查询攒够这么多颗星交付一次
+
+    constexpr std::size_t TASKS_PER_THREAD = 4;          // 多线程查询时每个线程平均分到的任务数，便于负载均衡
+    constexpr std::size_t SNAPSHOT_CELLS_PER_TASK = 16;  // 快照后端每个任务最多扫描的格子数
+
+    // 查询路径的指标，第一次用到时注册
+    struct QueryMetrics {
+        Metrics::Counter& stars_scanned;
+        Metrics::Counter& stars_returned;
+        Metrics::Counter& redis_roundtrips;
+        Metrics::Counter& redis_bytes_read;
+        Metrics::Counter& snapshot_bytes_read;
+        Metrics::Histogram& query_seconds;
+    };
+
+    QueryMetrics& query_metrics() {
+        static QueryMetrics metrics{
+            Metrics::Registry::Global().counter("starsim_stars_scanned_total", "Candidate stars propagated and tested against the field of view"),
+            Metrics::Registry::Global().counter("starsim_stars_returned_total", "Stars returned by field-of-view queries"),
+            Metrics::Registry::Global().counter("starsim_redis_roundtrips_total", "Redis replies read, one per pipelined command"),
+            Metrics::Registry::Global().counter("starsim_redis_bytes_read_total", "Payload bytes in Redis replies"),
+            Metrics::Registry::Global().counter("starsim_snapshot_bytes_read_total", "Bytes of snapshot records scanned"),
+            Metrics::Registry::Global().histogram("starsim_query_seconds", "Wall time of one field-of-view query"),
+        };
+        return metrics;
+    }
+
+    void count_reply(const redisReply* reply) {
+        if (reply == nullptr) return; // 连接出错，没有收到回复
+        query_metrics().redis_roundtrips.add();
+        query_metrics().redis_bytes_read.add(CellStore::ReplyBytes(reply));
     }
-    double delta_dec = star_dec - dec;
-    return std::abs(delta_ra) <= fov_w / 2.0 && std::abs(delta_dec) <= fov_h / 2.0;
-}
 
-redisContext* observer::connectRedis() const {
-    redisContext* connection = redisConnect(redis_host.c_str(), redis_port);
-    if (connection == nullptr || connection->err) {
-        if (connection) {
-            std::cerr << "Redis connection error: " << connection->errstr << std::endl;
-            redisFree(connection);
+    // 查询结束时记录返回星数，verbose 时打印汇总
+    void finish_query(std::size_t star_count, const char* note) {
+        query_metrics().stars_returned.add(star_count);
+        if (Metrics::Verbose()) {
+            std::cout << "星星筛选完成，共找到 " << star_count << " 颗视野内的星星" << note << std::endl;
+        }
+    }
+
+    // 查询结果的出口：cull_batch 往 stars 里追加；有 sink 时攒够 STREAM_CHUNK_STARS 颗就交付一次，
+    // 没有 sink 时一直攒着由调用方处理。compact 时每批筛选完就打包进 packed，stars 只放一批的临时结果，
+    // 交付给 compact_sink。多个出口共用一个 sink 时用 sink_mutex 保证 sink 不被并发调用
+    struct StarOutput {
+        std::vector<star> stars;
+        const observer::StarSink* sink = nullptr;
+        std::mutex* sink_mutex = nullptr;
+        bool compact = false;
+        std::vector<compact_star> packed;
+        const observer::CompactStarSink* compact_sink = nullptr;
+
+        std::size_t size() const { return compact ? packed.size() : stars.size(); }
+
+        void flush() {
+            if (compact ? compact_sink == nullptr || packed.empty() : sink == nullptr || stars.empty()) return;
+            std::unique_lock<std::mutex> lock;
+            if (sink_mutex != nullptr) lock = std::unique_lock<std::mutex>(*sink_mutex);
+            if (compact) {
+                (*compact_sink)(std::move(packed));
+                packed.clear();
+            } else {
+                (*sink)(std::move(stars));
+                stars.clear();
+            }
+        }
+    };
+
+    // 先在单位向量上批量判断视场，只把视场内、不暗于星等极限的星推到观测历元换回赤经赤纬（FovKernel::Cull），
+    // 结果按候选星原来的顺序追加到 out，与分批方式无关。最后清空 batch
+    void cull_batch(StarBatch& batch, const observer& obs, StarOutput& out) {
+        query_metrics().stars_scanned.add(batch.size());
+        FovKernel::Cull(batch, obs.fieldOfView(), obs.getEpoch(), out.stars, obs.getMagnitudeLimit());
+        batch.clear();
+        if (out.compact) {
+            CompactStar::PackAll(out.stars, out.packed);
+            out.stars.clear();
+        }
+        if (out.size() >= STREAM_CHUNK_STARS) out.flush();
+    }
+
+    // 每个格子一个请求，只读星等极限需要的那一层：Hash 布局用 SORT ... BY nosort GET 一次取出该层所有星的存储字段，
+    // PackedCells 布局 GET skyblob:<cell>:m<layer>，直接从回复缓冲区解码
+    void append_cell_command(redisContext* redis_conn, StorageLayout layout, int cell, int layer) {
+        if (layout == StorageLayout::PackedCells) {
+            std::string blob_key = CellStore::BlobKey(cell, layer);
+            redisAppendCommand(redis_conn, "GET %b", blob_key.data(), blob_key.size());
         } else {
-            std::cerr << "Can't allocate Redis context" << std::endl;
+            std::string cell_key = CellStore::CellKey(cell, layer);
+            redisAppendCommand(redis_conn, CellStore::CELL_FIELDS_COMMAND, cell_key.c_str());
         }
-        return nullptr;
     }
-    return connection;
-}
 
-observer::observer(double initial_ra, double initial_dec, double initial_fov_w, double initial_fov_h,
-                   double initial_gamma, double initial_exposure,
-                   const std::string& redis_host_addr, int redis_port_num)
-    : ra(initial_ra), dec(initial_dec), fov_w(initial_fov_w), fov_h(initial_fov_h),
-      gamma(initial_gamma), exposure(initial_exposure), redis_host(redis_host_addr), redis_port(redis_port_num) {}
+    // 按窗口流水线读取格子，fetch_cells_by_layout、批量查询和增量查询共用。cell_at(i) 返回第 i 个格子的编号和
+    // 星等极限（决定读哪一层、按什么过滤）。有格子缓存时先查缓存，只对未命中的格子发请求，解码后的格子（已按星等
+    // 极限过滤）放回缓存；缓存按查询开始时读到的布局和入库代数 store 区分，重新入库后不会取到旧的格子。每读完一个窗口调用一次 on_window(begin, tiles)，tiles[k] 对应第 begin + k 个格子。
+    // Redis 对某个格子回复错误（内存不足、重新入库时的 WRONGTYPE 等）时打印错误，这个格子的 tile 为空指针，
+    // 也不放进缓存，免得一个空格子在缓存里把它的星藏起来。连接出错返回 false，读了一半的窗口不交给 on_window
+    template <typename CellAt, typename OnWindow>
+    bool read_cell_windows(redisContext* redis_conn, const CellStore::Source& store,
+                           const std::shared_ptr<TileCache>& cache, std::size_t count, CellAt cell_at,
+                           OnWindow on_window) {
+        std::vector<TileCache::TilePtr> tiles;
+        std::vector<char> requested;
+        for (std::size_t begin = 0; begin < count; begin += CELL_PIPELINE_WINDOW) {
+            const std::size_t end = std::min(begin + CELL_PIPELINE_WINDOW, count);
+            tiles.assign(end - begin, nullptr);
+            requested.assign(end - begin, 0);
+            for (std::size_t i = begin; i < end; ++i) {
+                const auto [cell, magnitude_limit] = cell_at(i);
+                if (cache) tiles[i - begin] = cache->get(store, cell, magnitude_limit);
+                if (tiles[i - begin]) continue;
+                append_cell_command(redis_conn, store.layout, cell, CellStore::LayerFor(magnitude_limit));
+                requested[i - begin] = 1;
+            }
+            for (std::size_t i = begin; i < end; ++i) {
+                if (!requested[i - begin]) continue;
+                const auto [cell, magnitude_limit] = cell_at(i);
+                redisReply* reply = nullptr;
+                if (redisGetReply(redis_conn, reinterpret_cast<void**>(&reply)) != REDIS_OK) {
+                    std::cerr << "Redis error while fetching sky cells: " << redis_conn->errstr << std::endl;
+                    return false;
+                }
+                count_reply(reply);
+                if (reply->type == REDIS_REPLY_ERROR) {
+                    std::cerr << "Redis error while fetching sky cell " << cell << ": " << reply->str << std::endl;
+                    freeReplyObject(reply);
+                    continue;
+                }
+                auto decoded = std::make_shared<TileCache::Tile>();
+                CellStore::ForEachCellRecord(reply, store.layout, [&](const catalog_star& record) {
+                    if (record.magnitude <= magnitude_limit) decoded->push_back(record);
+                });
+                freeReplyObject(reply);
+                if (cache) cache->put(store, cell, magnitude_limit, decoded);
+                tiles[i - begin] = std::move(decoded);
+            }
+            on_window(begin, tiles);
+        }
+        return true;
+    }
 
-std::vector<star> observer::FileterStarInView() {
-    std::vector<star> visible_stars;
-    redisContext* redis_conn = connectRedis();
-    if (redis_conn == nullptr) return visible_stars;
-    redisReply* keys_reply = static_cast<redisReply*>(redisCommand(redis_conn, "KEYS *"));
-    if (!keys_reply || keys_reply->type != REDIS_REPLY_ARRAY) { if (keys_reply) freeReplyObject(keys_reply); redisFree(redis_conn); return visible_stars; }
-    std::cout << "开始筛选视野内的星星，总共找到 " << keys_reply->elements << " 个潜在目标..." << std::endl;
-    for (std::size_t i = 0; i < keys_reply->elements; ++i) {
-        redisReply* key_reply = keys_reply->element[i];
-        if (key_reply->type == REDIS_REPLY_STRING) {
-            std::string star_id = key_reply->str;
-            if ((i + 1) % 10000 == 0) std::cout << "已处理 " << (i + 1) << " 个星星，当前处理 ID: " << star_id << std::endl;
-            redisReply* star_data_reply = static_cast<redisReply*>(redisCommand(redis_conn, "HGETALL %s", star_id.c_str()));
-            if (!star_data_reply) std::cerr << "Error executing Redis HGETALL command for key: " << star_id << ": " << redis_conn->errstr << std::endl;
-            else if (star_data_reply->type == REDIS_REPLY_ARRAY && star_data_reply->elements >= 6) {
-                star current_star; bool ra_found = false; bool dec_found = false; bool mag_found = false;
-                for (std::size_t j = 0; j < star_data_reply->elements; j += 2) {
-                    std::string field = star_data_reply->element[j]->str;
-                    std::string value = star_data_reply->element[j + 1]->str;
-                    if (field == "ra") { current_star.ra = std::stod(value); ra_found = true; }
-                    else if (field == "dec") { current_star.dec = std::stod(value); dec_found = true; }
-                    else if (field == "magnitude") { current_star.magnitude = std::stod(value); mag_found = true; }
+    // 每个窗口按格子顺序拼起来筛选一次；结果与不用缓存时相同
+    void fetch_cells_by_layout(redisContext* redis_conn, const CellStore::Source& store, const std::vector<int>& cells,
+                               const observer& obs, StarOutput& out) {
+        const double magnitude_limit = obs.getMagnitudeLimit();
+        StarBatch batch;
+        read_cell_windows(redis_conn, store, obs.getTileCache(), cells.size(),
+                          [&](std::size_t i) { return std::make_pair(cells[i], magnitude_limit); },
+                          [&](std::size_t, const std::vector<TileCache::TilePtr>& tiles) {
+            for (const TileCache::TilePtr& tile : tiles) {
+                if (!tile) continue;
+                batch.append(tile->stars.data(), tile->stars.data() + tile->stars.size(), tile->vectors.data());
+            }
+            cull_batch(batch, obs, out);
+        });
+    }
+
+    void scan_snapshot_cells(const StarSnapshot& snapshot, const std::vector<int>& cells, const observer& obs,
+                             StarOutput& out) {
+        const double magnitude_limit = obs.getMagnitudeLimit();
+        StarBatch batch;
+        batch.reserve(SNAPSHOT_BATCH_SIZE);
+        for (std::size_t k = 0; k < cells.size();) {
+            // 编号连续的格子在快照里也首尾相接（同一赤纬带内相邻），合成一段追加；
+            // 一个格子平均只有几颗到几十颗星，逐格追加时调整列长度的开销比复制还大
+            // 格子内从亮到暗，有星等极限时只取前缀；前缀到格子末尾时下一个格子仍然首尾相接
+            const catalog_star* begin = snapshot.cellBegin(cells[k]);
+            const catalog_star* end = snapshot.cellEnd(cells[k], magnitude_limit);
+            std::size_t run_end = k + 1;
+            while (run_end < cells.size() && cells[run_end] == cells[run_end - 1] + 1 &&
+                   end == snapshot.cellEnd(cells[run_end - 1])) {
+                end = snapshot.cellEnd(cells[run_end], magnitude_limit);
+                ++run_end;
+            }
+            const unit_vector* vectors = snapshot.cellVectors(cells[k]);
+            query_metrics().snapshot_bytes_read.add(
+                static_cast<std::size_t>(end - begin) * (sizeof(catalog_star) + sizeof(unit_vector)));
+            while (begin != end) {
+                std::size_t take = std::min(static_cast<std::size_t>(end - begin), SNAPSHOT_BATCH_SIZE - batch.size());
+                batch.append(begin, begin + take, vectors);
+                begin += take;
+                vectors += take;
+                if (batch.size() >= SNAPSHOT_BATCH_SIZE) {
+                    cull_batch(batch, obs, out);
+                }
+            }
+            k = run_end;
+        }
+        cull_batch(batch, obs, out);
+    }
+
+    // 把格子切成小任务提交到进程级 Executor，空闲线程自动分担不均匀的格子。某个任务完成、且它之前的任务都已交付时
+    // 立即按任务顺序交给 sink，交付在锁内进行，sink 不会被并发调用，拼起来的结果与任务完成的先后无关。
+    // 任务数约为 num_threads 的 TASKS_PER_THREAD 倍，每个任务最多 max_cells_per_task 个格子。
+    // pool 不为空时每个任务的连接在提交线程上借好再交给 worker（没有空余名额时帮 Executor 执行任务而不是阻塞），
+    // 在途任务数不超过连接池大小，任务里不会阻塞在连接池上；借不到连接时不再提交后面的任务
+    void split_cells_threaded(const std::vector<int>& cells, int num_threads, std::size_t max_cells_per_task,
+                              RedisPool* pool,
+                              const std::function<void(redisContext*, const std::vector<int>&, StarOutput&)>& worker,
+                              const StarOutput& delivery) {
+        std::size_t parallelism = num_threads > 0 ? static_cast<std::size_t>(num_threads) : Executor::Instance().threadCount();
+        std::size_t target_tasks = std::max<std::size_t>(1, parallelism * TASKS_PER_THREAD);
+        std::size_t cells_per_task = std::clamp<std::size_t>((cells.size() + target_tasks - 1) / target_tasks,
+                                                             1, max_cells_per_task);
+        std::size_t task_count = (cells.size() + cells_per_task - 1) / cells_per_task;
+
+        std::vector<StarOutput> task_results(task_count);
+        for (StarOutput& result : task_results) result.compact = delivery.compact;
+        std::vector<char> finished(task_count, 0);
+        std::size_t next_delivery = 0;
+        std::mutex delivery_mutex;
+        Executor& executor = Executor::Instance();
+        TaskGroup tasks(executor);
+        for (std::size_t i = 0; i < task_count; ++i) {
+            std::shared_ptr<RedisPool::Lease> conn;
+            if (pool != nullptr) {
+                conn = std::make_shared<RedisPool::Lease>(pool->acquire(executor));
+                if (!*conn) break;
+            }
+            tasks.run([&, conn, cells_per_task, i] {
+                // 移到任务的局部变量里，worker 抛出异常时随展开析构，回复没读完的连接不会还回池里
+                RedisPool::Lease redis_conn = conn ? std::move(*conn) : RedisPool::Lease();
+                auto begin = cells.begin() + i * cells_per_task;
+                auto end = cells.begin() + std::min(cells.size(), (i + 1) * cells_per_task);
+                worker(redis_conn.get(), std::vector<int>(begin, end), task_results[i]);
+                redis_conn.release();
+                std::lock_guard<std::mutex> lock(delivery_mutex);
+                finished[i] = 1;
+                for (; next_delivery < task_count && finished[next_delivery]; ++next_delivery) {
+                    StarOutput& result = task_results[next_delivery];
+                    if (result.compact) {
+                        if (!result.packed.empty()) (*delivery.compact_sink)(std::move(result.packed));
+                        std::vector<compact_star>().swap(result.packed);
+                    } else {
+                        if (!result.stars.empty()) (*delivery.sink)(std::move(result.stars));
+                        std::vector<star>().swap(result.stars);
+                    }
                 }
-                if (ra_found && dec_found && mag_found && isStarInFOV(current_star.ra, current_star.dec)) {
-                    visible_stars.push_back(current_star);
+            });
+        }
+        tasks.wait();
+    }
+
+    // 对一批 key 流水线发送 HMGET 取存储字段，再依次取回结果
+    void fetch_keys_pipelined(redisContext* redis_conn, const std::vector<std::string>& keys, const observer& obs,
+                              StarOutput& out) {
+        for (const auto& key : keys) {
+            redisAppendCommand(redis_conn, "HMGET %b ra dec magnitude pmra pmdec epra epdec bv", key.data(), key.size());
+        }
+        StarBatch batch;
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            redisReply* reply = nullptr;
+            if (redisGetReply(redis_conn, reinterpret_cast<void**>(&reply)) != REDIS_OK) {
+                std::cerr << "Redis error while fetching stars: " << redis_conn->errstr << std::endl;
+                return;
+            }
+            count_reply(reply);
+            catalog_star record;
+            if (reply->type == REDIS_REPLY_ARRAY && reply->elements == CellStore::STORED_FIELD_COUNT &&
+                CellStore::ParseStoredFields(reply->element, record)) {
+                batch.push_back(record);
+            }
+            freeReplyObject(reply);
+        }
+        cull_batch(batch, obs, out);
+    }
+
+    // 用 SCAN 游标遍历所有星的 hash（TYPE hash 跳过天区索引等其他键），每攒够 count_hint 个 key 调用一次 on_batch，
+    // on_batch 返回 false 时停止扫描并返回 false。SCAN 出错时抛出 std::runtime_error，不把扫了一半的库当成完整结果
+    bool scan_star_keys(redisContext* redis_conn, std::size_t count_hint,
+                        const std::function<bool(std::vector<std::string>&&)>& on_batch) {
+        std::string cursor = "0";
+        std::vector<std::string> batch;
+        do {
+            redisReply* reply = static_cast<redisReply*>(
+                redisCommand(redis_conn, "SCAN %s COUNT %llu TYPE hash", cursor.c_str(),
+                             static_cast<unsigned long long>(count_hint)));
+            count_reply(reply);
+            if (reply == nullptr || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+                std::string error = reply && reply->type == REDIS_REPLY_ERROR ? reply->str : redis_conn->errstr;
+                if (reply) freeReplyObject(reply);
+                throw std::runtime_error("Redis SCAN error: " + error);
+            }
+            cursor.assign(reply->element[0]->str, reply->element[0]->len);
+            redisReply* keys = reply->element[1];
+            for (std::size_t i = 0; i < keys->elements; ++i) {
+                if (keys->element[i]->type == REDIS_REPLY_STRING) {
+                    batch.emplace_back(keys->element[i]->str, keys->element[i]->len);
                 }
             }
-            freeReplyObject(star_data_reply);
+            freeReplyObject(reply);
+            if (batch.size() >= count_hint) {
+                if (!on_batch(std::move(batch))) return false;
+                batch.clear();
+            }
+        } while (cursor != "0");
+        if (!batch.empty()) {
+            return on_batch(std::move(batch));
         }
+        return true;
     }
-    std::cout << "星星筛选完成，共找到 " << visible_stars.size() << " 颗视野内的星星。" << std::endl;
-    freeReplyObject(keys_reply);
-    redisFree(redis_conn);
-    return visible_stars;
-}
 
-void process_star_keys_threaded(const std::vector<std::string>& keys, const observer& obs, std::vector<star>& local_visible_stars) {
-    redisContext* redis_conn = obs.connectRedis();
-    if (redis_conn == nullptr) {
-        return;
+    void report_scan_progress(std::size_t batch_size) {
+        std::size_t before = g_processed_star_count.fetch_add(batch_size);
+        if (Metrics::Verbose() && (before + batch_size) / 100000 != before / 100000) {
+            std::cout << "已扫描 " << before + batch_size << " 颗星星..." << std::endl;
+        }
+    }
+
+    // --- 批量查询 ---
+
+    // 批量查询里的一个视场：筛选参数预先算好，每段格子只用不再算
+    struct BatchView {
+        FovKernel::FieldOfView fov;
+        double epoch;
+        double magnitude_limit;
+    };
+
+    // 与某个格子相交的一个视场，position 是格子在该视场 cellsInView 里的位置
+    struct ViewSlot {
+        std::size_t view;
+        std::size_t position;
+    };
+
+    // 各视场格子的并集里的一个格子。magnitude_limit 是相交视场里最深的星等极限，格子按它读取一次
+    struct UnionCell {
+        int cell;
+        double magnitude_limit;
+        std::vector<ViewSlot> views; // 按视场序号排列
+    };
+
+    // 每个视场的结果按格子位置分开存放，最后按位置拼起来，与单独查询的顺序相同
+    using ViewResults = std::vector<std::vector<std::vector<star>>>;
+
+    // 把所有视场的格子合并去重，记下每个格子与哪些视场相交
+    std::vector<UnionCell> union_cells(const std::vector<std::vector<int>>& view_cells,
+                                       const std::vector<BatchView>& views) {
+        struct Entry {
+            int cell;
+            ViewSlot slot;
+        };
+        std::vector<Entry> entries;
+        for (std::size_t v = 0; v < view_cells.size(); ++v) {
+            for (std::size_t p = 0; p < view_cells[v].size(); ++p) entries.push_back(Entry{view_cells[v][p], {v, p}});
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+            return a.cell != b.cell ? a.cell < b.cell : a.slot.view < b.slot.view;
+        });
+        std::vector<UnionCell> cells;
+        for (const Entry& entry : entries) {
+            if (cells.empty() || cells.back().cell != entry.cell) {
+                cells.push_back(UnionCell{entry.cell, -std::numeric_limits<double>::infinity(), {}});
+            }
+            cells.back().magnitude_limit = std::max(cells.back().magnitude_limit, views[entry.slot.view].magnitude_limit);
+            cells.back().views.push_back(entry.slot);
+        }
+        return cells;
     }
 
-    size_t processed_count = 0;
-    for (const auto& star_id : keys) {
-        redisReply* star_data_reply = static_cast<redisReply*>(redisCommand(redis_conn, "HGETALL %s", star_id.c_str()));
-        if (star_data_reply != nullptr && star_data_reply->type == REDIS_REPLY_ARRAY && star_data_reply->elements >= 6) {
-            star current_star;
-            bool ra_found = false;
-            bool dec_found = false;
-            bool mag_found = false;
+    // 一次扫描里连续的一段格子：它们与同一组视场相交，在每个视场里的位置也连续。候选星拼成一批，
+    // 每个视场筛选一次，结果追加到该视场在这段第一个格子的位置上
+    struct SweepRun {
+        const UnionCell* first = nullptr;
+        const UnionCell* last = nullptr;
+        StarBatch batch;
+    };
 
-            for (std::size_t j = 0; j < star_data_reply->elements; j += 2) {
-                std::string field = star_data_reply->element[j]->str;
-                std::string value = star_data_reply->element[j + 1]->str;
-                if (field == "ra") {current_star.ra = std::stod(value);ra_found = true;}
-                else if (field == "dec") {current_star.dec = std::stod(value);dec_found = true;}
-                else if (field == "magnitude") {current_star.magnitude = std::stod(value);mag_found = true;}
+    bool continues_run(const UnionCell& prev, const UnionCell& next) {
+        if (prev.views.size() != next.views.size()) return false;
+        for (std::size_t k = 0; k < prev.views.size(); ++k) {
+            if (next.views[k].view != prev.views[k].view || next.views[k].position != prev.views[k].position + 1) {
+                return false;
             }
+        }
+        return true;
+    }
 
-            if (ra_found && dec_found && mag_found && obs.isStarInFOV(current_star.ra, current_star.dec)) {
-                local_visible_stars.push_back(current_star);
+    void cull_run(SweepRun& run, const std::vector<BatchView>& views, ViewResults& results) {
+        if (run.first == nullptr) return;
+        query_metrics().stars_scanned.add(run.batch.size() * run.first->views.size());
+        for (const ViewSlot& slot : run.first->views) {
+            const BatchView& view = views[slot.view];
+            FovKernel::Cull(run.batch, view.fov, view.epoch, results[slot.view][slot.position], view.magnitude_limit);
+        }
+        run.batch.clear();
+        run.first = nullptr;
+    }
+
+    void sweep_cell(SweepRun& run, const UnionCell& cell, const catalog_star* begin, const catalog_star* end,
+                    const unit_vector* vectors, const std::vector<BatchView>& views, ViewResults& results) {
+        if (run.first != nullptr && (!continues_run(*run.last, cell) || run.batch.size() >= SNAPSHOT_BATCH_SIZE)) {
+            cull_run(run, views, results);
+        }
+        if (run.first == nullptr) run.first = &cell;
+        run.last = &cell;
+        run.batch.append(begin, end, vectors);
+    }
+
+    // 每个格子按相交视场里最深的星等极限读取
+    void sweep_redis_cells(redisContext* redis_conn, const CellStore::Source& store,
+                           const std::shared_ptr<TileCache>& cache, const UnionCell* first, const UnionCell* last,
+                           const std::vector<BatchView>& views, ViewResults& results) {
+        SweepRun run;
+        read_cell_windows(redis_conn, store, cache, static_cast<std::size_t>(last - first),
+                          [first](std::size_t i) { return std::make_pair(first[i].cell, first[i].magnitude_limit); },
+                          [&](std::size_t begin, const std::vector<TileCache::TilePtr>& tiles) {
+            for (std::size_t k = 0; k < tiles.size(); ++k) {
+                const TileCache::TilePtr& tile = tiles[k];
+                if (!tile) continue;
+                sweep_cell(run, first[begin + k], tile->stars.data(), tile->stars.data() + tile->stars.size(),
+                           tile->vectors.data(), views, results);
             }
+            // 这个窗口的格子在 tiles 里，离开窗口前筛选完
+            cull_run(run, views, results);
+        });
+    }
+
+    // --- 增量查询 ---
+
+    // 增量查询保留的一个格子。候选星和推算结果与视场无关，视场移动后仍然可用
+    struct IncrementalCell {
+        StarBatch batch;         // 候选星（已按星等极限过滤）
+        std::vector<star> stars; // 每颗候选星推到观测历元的结果，与 batch 一一对应
+        double center[3] = {0.0, 0.0, 0.0}; // 包住所有候选星推算后位置的球冠，交给 FovKernel::CapOverlap
+        double radius = 0.0;
+    };
+
+    // 新读入的格子：推算每颗候选星，算出包围球冠
+    void seal_incremental_cell(IncrementalCell& cell, double epoch) {
+        const StarBatch& batch = cell.batch;
+        std::vector<double> star_ra(batch.size());
+        std::vector<double> star_dec(batch.size());
+        EpochKernel::Propagate(batch, epoch, star_ra.data(), star_dec.data());
+        cell.stars.clear();
+        cell.stars.reserve(batch.size());
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            cell.stars.push_back(star{star_ra[i], star_dec[i], batch.magnitude[i], batch.color_index[i]});
+            cell.center[0] += batch.x[i];
+            cell.center[1] += batch.y[i];
+            cell.center[2] += batch.z[i];
         }
-        freeReplyObject(star_data_reply);
-        processed_count++;
-        g_processed_star_count++; // 增加全局计数器
-        if (processed_count % 10000 == 0) { // 每处理 1000 颗星星打印一次进度（可以调整）
-            std::cout << "线程 " << std::this_thread::get_id() << " 已处理 " << processed_count << " 颗星星，总共处理 " << g_processed_star_count << " 颗..." << std::endl;
+        // 半径取离中心最远的平均位置，再加上推到观测历元的最大位移（切平面上的位移不小于对应的角距）
+        const double norm = std::sqrt(cell.center[0] * cell.center[0] + cell.center[1] * cell.center[1] +
+                                      cell.center[2] * cell.center[2]);
+        const double mas_to_rad = M_PI / 180.0 / EpochKernel::MAS_PER_DEGREE;
+        double min_cos = 1.0, max_shift = 0.0;
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            min_cos = std::min(min_cos, (batch.x[i] * cell.center[0] + batch.y[i] * cell.center[1] +
+                                         batch.z[i] * cell.center[2]) / norm);
+            max_shift = std::max(max_shift, std::hypot(batch.pm_ra[i] * (epoch - batch.epoch_ra[i]),
+                                                       batch.pm_dec[i] * (epoch - batch.epoch_dec[i])) * mas_to_rad);
         }
+        cell.radius = std::acos(std::clamp(min_cos, -1.0, 1.0)) + max_shift;
+    }
+
+    // 读取全部格子，tiles 与 cells 一一对应，Redis 回复错误的格子为空指针。连接出错返回 false
+    bool read_cell_tiles(redisContext* redis_conn, const CellStore::Source& store, const std::vector<int>& cells,
+                         double magnitude_limit, const std::shared_ptr<TileCache>& cache,
+                         std::vector<TileCache::TilePtr>& tiles) {
+        tiles.assign(cells.size(), nullptr);
+        return read_cell_windows(redis_conn, store, cache, cells.size(),
+                                 [&](std::size_t i) { return std::make_pair(cells[i], magnitude_limit); },
+                                 [&](std::size_t begin, const std::vector<TileCache::TilePtr>& window) {
+            std::copy(window.begin(), window.end(), tiles.begin() + begin);
+        });
     }
-    redisFree(redis_conn);
+}
+
+bool observer::isStarInFOV(double star_ra, double star_dec) const {
+    return FovKernel::Contains(fieldOfView(), star_ra, star_dec);
+}
+
+FovKernel::FieldOfView observer::fieldOfView() const {
+    return FovKernel::MakeFieldOfView(ra, dec, fov_w, fov_h, gamma);
+}
+
+RedisPool::Lease observer::connectRedis() const {
+    return redis_pool->acquire(Executor::Instance());
+}
+
+StorageLayout observer::storageLayout(redisContext* redis_conn) const {
+    return storageSource(redis_conn).layout;
+}
+
+CellStore::Source observer::storageSource(redisContext* redis_conn) const {
+    redisReply* reply = static_cast<redisReply*>(redisCommand(redis_conn, "MGET %s %s %s", SkyGrid::GRID_KEY,
+                                                              CellStore::LAYOUT_KEY, CellStore::GENERATION_KEY));
+    count_reply(reply);
+    CellStore::Source store = CellStore::SourceFromReply(reply);
+    if (reply) freeReplyObject(reply);
+    return store;
+}
+
+std::vector<int> observer::cellsInView() const {
+    // 视场矩形（含滚转）在赤道坐标下的包围范围；星按平均位置入格，观测历元下可能已经移出原格子，
+    // 查询范围再按最大自行位移外扩
+    double dec_min, dec_max, ra_half_width;
+    FovKernel::Bounds(fieldOfView(), dec_min, dec_max, ra_half_width);
+    double pad = EpochKernel::MaxDisplacement(epoch);
+    dec_min -= pad;
+    dec_max += pad;
+    double max_abs_dec = std::max(std::abs(dec_min), std::abs(dec_max));
+    double ra_pad = max_abs_dec >= 89.0 ? 180.0 : pad / std::cos(max_abs_dec * M_PI / 180.0);
+    return SkyGrid::CellsInRect(ra, ra_half_width + ra_pad, dec_min, dec_max);
+}
+
+observer::observer(double initial_ra, double initial_dec, double initial_fov_w, double initial_fov_h,
+                   double initial_gamma, double initial_exposure,
+                   const std::string& redis_host_addr, int redis_port_num)
+    : ra(initial_ra), dec(initial_dec), fov_w(initial_fov_w), fov_h(initial_fov_h),
+      gamma(initial_gamma), exposure(initial_exposure), epoch(EpochKernel::CurrentEpoch()),
+      redis_host(redis_host_addr), redis_port(redis_port_num),
+      redis_pool(RedisPool::Shared(redis_host_addr, redis_port_num)) {}
+
+void observer::useSnapshot(std::shared_ptr<const StarSnapshot> snapshot_catalog) {
+    snapshot = std::move(snapshot_catalog);
+}
+
+std::vector<star> observer::FileterStarInView() {
+    std::vector<star> visible_stars;
+    StreamStarsInView([&visible_stars](std::vector<star>&& stars) {
+        if (visible_stars.empty()) {
+            visible_stars = std::move(stars);
+        } else {
+            visible_stars.insert(visible_stars.end(), stars.begin(), stars.end());
+        }
+    });
+    return visible_stars;
 }
 
 std::vector<star> observer::FileterStarInViewMultithreaded(int num_threads) {
     std::vector<star> all_visible_stars;
+    // num_threads 为 1 时也走多线程路径（单个工作连接），与原来的行为一致
+    const StarSink sink = [&all_visible_stars](std::vector<star>&& stars) {
+        if (all_visible_stars.empty()) {
+            all_visible_stars = std::move(stars);
+        } else {
+            all_visible_stars.insert(all_visible_stars.end(), stars.begin(), stars.end());
+        }
+    };
+    stream_stars(true, num_threads, &sink, nullptr);
+    return all_visible_stars;
+}
+
+std::vector<compact_star> observer::FileterStarInViewCompact(int num_threads) {
+    std::vector<compact_star> all_visible_stars;
+    const CompactStarSink sink = [&all_visible_stars](std::vector<compact_star>&& stars) {
+        if (all_visible_stars.empty()) {
+            all_visible_stars = std::move(stars);
+        } else {
+            all_visible_stars.insert(all_visible_stars.end(), stars.begin(), stars.end());
+        }
+    };
+    stream_stars(num_threads != 1, num_threads, nullptr, &sink);
+    return all_visible_stars;
+}
+
+std::size_t observer::StreamStarsInView(const StarSink& sink, int num_threads) {
+    return stream_stars(num_threads != 1, num_threads, &sink, nullptr);
+}
+
+std::size_t observer::stream_stars(bool threaded, int num_threads, const StarSink* sink,
+                                   const CompactStarSink* compact_sink) {
+    Metrics::ScopedTimer timer(query_metrics().query_seconds);
+    std::size_t delivered = 0;
+    const StarSink counted = [sink, &delivered](std::vector<star>&& stars) {
+        delivered += stars.size();
+        (*sink)(std::move(stars));
+    };
+    const CompactStarSink counted_compact = [compact_sink, &delivered](std::vector<compact_star>&& stars) {
+        delivered += stars.size();
+        (*compact_sink)(std::move(stars));
+    };
+    // 交付给调用方的出口，结果形式由给的是哪个 sink 决定
+    auto make_output = [&](std::mutex* sink_mutex) {
+        StarOutput output;
+        output.sink_mutex = sink_mutex;
+        output.compact = compact_sink != nullptr;
+        output.sink = &counted;
+        output.compact_sink = &counted_compact;
+        return output;
+    };
+    StarOutput out = make_output(nullptr);
     g_processed_star_count = 0; // 重置计数器
 
-    redisContext* redis_conn = connectRedis();
-    if (redis_conn == nullptr) {
-        return all_visible_stars;
+    if (snapshot) {
+        if (threaded) {
+            split_cells_threaded(cellsInView(), num_threads, SNAPSHOT_CELLS_PER_TASK, nullptr, [this](redisContext*, const std::vector<int>& cells_chunk, StarOutput& result) {
+                scan_snapshot_cells(*snapshot, cells_chunk, *this, result);
+            }, out);
+        } else {
+            scan_snapshot_cells(*snapshot, cellsInView(), *this, out);
+            out.flush();
+        }
+        finish_query(delivered, threaded ? " (快照, 多线程)." : " (快照)。");
+        return delivered;
     }
 
-    redisReply* keys_reply = static_cast<redisReply*>(redisCommand(redis_conn, "KEYS *"));
-    if (keys_reply == nullptr || keys_reply->type != REDIS_REPLY_ARRAY) {
-        if (keys_reply) freeReplyObject(keys_reply);
-        redisFree(redis_conn);
-        return all_visible_stars;
+    RedisPool::Lease redis_conn = connectRedis();
+    if (!redis_conn) {
+        return delivered;
     }
 
-    std::vector<std::string> all_keys;
-    for (size_t i = 0; i < keys_reply->elements; ++i) {
-        if (keys_reply->element[i]->type == REDIS_REPLY_STRING) {
-            all_keys.push_back(keys_reply->element[i]->str);
+    const CellStore::Source store = storageSource(redis_conn.get());
+    if (store.layout != StorageLayout::None) {
+        std::vector<int> cells = cellsInView();
+        if (Metrics::Verbose()) {
+            std::cout << (threaded ? "开始多线程筛选视野内的星星，需要读取 " : "开始筛选视野内的星星，需要读取 ")
+                      << cells.size() << " 个天区格子..." << std::endl;
         }
+        if (threaded) {
+            redis_conn.release(); // 归还给工作线程使用
+            split_cells_threaded(cells, num_threads, CELL_PIPELINE_WINDOW, redis_pool.get(), [this, store](redisContext* worker_conn, const std::vector<int>& cells_chunk, StarOutput& result) {
+                fetch_cells_by_layout(worker_conn, store, cells_chunk, *this, result);
+            }, out);
+        } else {
+            fetch_cells_by_layout(redis_conn.get(), store, cells, *this, out);
+            out.flush();
+        }
+        finish_query(delivered, threaded ? " (多线程)." : "。");
+        return delivered;
     }
-    freeReplyObject(keys_reply);
-    redisFree(redis_conn);
 
-    if (all_keys.empty()) {
-        return all_visible_stars;
+    // 旧数据库没有天区索引，退回全库扫描：当前线程用 SCAN 游标分批取 key。单线程时边扫边取；
+    // 多线程时放进有界队列，每个工作连接一个消费任务，取出后流水线 HMGET，客户端同时持有的 key 不超过
+    // 队列容量 × pipeline_window。SCAN 连接一直占着，工作连接不等待空余名额，连接池借不到时在当前线程里边扫边取
+    std::vector<RedisPool::Lease> worker_conns;
+    for (int i = 0; threaded && i < std::max(num_threads, 1); ++i) {
+        RedisPool::Lease worker_conn = redis_pool->tryAcquire();
+        if (!worker_conn) break;
+        worker_conns.push_back(std::move(worker_conn));
+    }
+    if (worker_conns.empty()) {
+        if (Metrics::Verbose()) {
+            std::cout << (threaded ? "连接池没有空余连接，改为单线程全库扫描..." : "开始全库扫描筛选视野内的星星...") << std::endl;
+        }
+        scan_star_keys(redis_conn.get(), pipeline_window, [&](std::vector<std::string>&& batch) {
+            fetch_keys_pipelined(redis_conn.get(), batch, *this, out);
+            report_scan_progress(batch.size());
+            return true;
+        });
+        out.flush();
+        finish_query(delivered, "。");
+        return delivered;
     }
 
-    std::cout << "开始多线程筛选视野内的星星，总共找到 " << all_keys.size() << " 个潜在目标..." << std::endl;
+    if (Metrics::Verbose()) {
+        std::cout << "开始多线程全库扫描筛选视野内的星星，" << worker_conns.size() << " 个线程..." << std::endl;
+    }
 
-    int keys_per_thread = all_keys.size() / num_threads;
-    int remaining_keys = all_keys.size() % num_threads;
-    std::vector<std::thread> threads;
-    std::vector<std::vector<star>> thread_results(num_threads);
-    int start_index = 0;
+    // 当前线程继续 SCAN，每批 key 交给一个任务，任务借一个空闲的工作连接流水线 HMGET，结果按完成先后交付，
+    // 顺序不固定。在途的批次不超过工作连接数；没有空闲连接时当前线程帮 Executor 执行任务（多半就是这些批次），
+    // 而不是阻塞等待，所以在 Executor 的任务里调用、或者工作线程都在忙时也能完成。
+    // 某一批抛出异常后不再提交新的批次并停止扫描，由 wait() 重新抛出
+    std::mutex delivery_mutex;
+    std::vector<StarOutput> worker_results;
+    std::vector<std::size_t> idle_workers;
+    for (std::size_t i = 0; i < worker_conns.size(); ++i) {
+        worker_results.push_back(make_output(&delivery_mutex));
+        idle_workers.push_back(i);
+    }
+    std::mutex idle_mutex;
+    std::condition_variable worker_idle;
+    bool failed = false;
+    Executor& executor = Executor::Instance();
+    TaskGroup consumers(executor); // 放在最后，提前返回时先等任务结束
+    scan_star_keys(redis_conn.get(), pipeline_window, [&](std::vector<std::string>&& batch) {
+        std::size_t worker;
+        {
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            while (idle_workers.empty() && !failed) {
+                lock.unlock();
+                const bool ran = executor.runOne();
+                lock.lock();
+                if (!ran) {
+                    worker_idle.wait_for(lock, std::chrono::milliseconds(1),
+                                         [&] { return !idle_workers.empty() || failed; });
+                }
+            }
+            if (failed) return false;
+            worker = idle_workers.back();
+            idle_workers.pop_back();
+        }
+        consumers.run([&, worker, batch = std::move(batch)] {
+            try {
+                fetch_keys_pipelined(worker_conns[worker].get(), batch, *this, worker_results[worker]);
+                report_scan_progress(batch.size());
+            } catch (...) {
+                worker_conns[worker].discard(); // 流水线的回复可能没有读完
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                failed = true;
+                worker_idle.notify_all();
+                throw;
+            }
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            idle_workers.push_back(worker);
+            worker_idle.notify_all();
+        });
+        return true;
+    });
+    redis_conn.release();
+    consumers.wait();
+    for (std::size_t i = 0; i < worker_conns.size(); ++i) {
+        worker_results[i].flush();
+        worker_conns[i].release();
+    }
 
-    for (int i = 0; i < num_threads; ++i) {
-        int end_index = start_index + keys_per_thread + (i < remaining_keys ? 1 : 0);
-        std::vector<std::string> keys_chunk(all_keys.begin() + start_index, all_keys.begin() + end_index);
-        threads.emplace_back(process_star_keys_threaded, keys_chunk, *this, std::ref(thread_results[i]));
-        start_index = end_index;
+    finish_query(delivered, " (多线程).");
+    return delivered;
+}
+
+std::vector<std::vector<star>> observer::FileterStarsInViews(const std::vector<observer>& views, int num_threads) {
+    Metrics::ScopedTimer timer(query_metrics().query_seconds);
+    std::vector<std::vector<star>> view_stars(views.size());
+    if (views.empty()) return view_stars;
+    const observer& source = views.front();
+    auto query_each_view = [&] {
+        for (std::size_t v = 0; v < views.size(); ++v) {
+            observer view = views[v];
+            view.useSnapshot(source.snapshot);
+            view.setRedisPool(source.redis_pool);
+            view.setTileCache(source.tile_cache);
+            view_stars[v] = num_threads == 1 ? view.FileterStarInView()
+                                             : view.FileterStarInViewMultithreaded(num_threads);
+        }
+    };
+
+    // 快照已经是解码好的内存映射，没有可以分摊的读取和解码，逐个视场查询连续的格子反而更快
+    if (source.snapshot) {
+        query_each_view();
+        return view_stars;
+    }
+    RedisPool::Lease redis_conn = source.connectRedis();
+    if (!redis_conn) {
+        return view_stars;
+    }
+    const CellStore::Source store = source.storageSource(redis_conn.get());
+    redis_conn.release();
+    if (store.layout == StorageLayout::None) {
+        // 没有天区索引只能全库扫描，逐个视场查询
+        query_each_view();
+        return view_stars;
+    }
+
+    std::vector<BatchView> batch_views;
+    std::vector<std::vector<int>> view_cells;
+    for (const observer& view : views) {
+        batch_views.push_back(BatchView{view.fieldOfView(), view.epoch, view.magnitude_limit});
+        view_cells.push_back(view.cellsInView());
+    }
+    const std::vector<UnionCell> cells = union_cells(view_cells, batch_views);
+    ViewResults results(views.size());
+    for (std::size_t v = 0; v < views.size(); ++v) results[v].resize(view_cells[v].size());
+    if (Metrics::Verbose()) {
+        std::cout << "开始批量筛选 " << views.size() << " 个视场，需要读取 " << cells.size() << " 个天区格子..." << std::endl;
     }
 
-    for (auto& thread : threads) {
-        thread.join();
+    // 每段格子的结果写到各自的位置上，不同任务之间不冲突
+    auto sweep = [&](redisContext* sweep_conn, const UnionCell* first, const UnionCell* last) {
+        sweep_redis_cells(sweep_conn, store, source.tile_cache, first, last, batch_views, results);
+    };
+    if (num_threads == 1) {
+        RedisPool::Lease sweep_conn = source.connectRedis();
+        if (sweep_conn) sweep(sweep_conn.get(), cells.data(), cells.data() + cells.size());
+    } else {
+        std::size_t parallelism = num_threads > 0 ? static_cast<std::size_t>(num_threads) : Executor::Instance().threadCount();
+        std::size_t target_tasks = std::max<std::size_t>(1, parallelism * TASKS_PER_THREAD);
+        std::size_t cells_per_task = std::clamp<std::size_t>((cells.size() + target_tasks - 1) / target_tasks,
+                                                             1, CELL_PIPELINE_WINDOW);
+        // 与 split_cells_threaded 相同，连接在提交线程上借好交给任务，在途任务数不超过连接池大小
+        Executor& executor = Executor::Instance();
+        TaskGroup tasks(executor);
+        for (std::size_t begin = 0; begin < cells.size(); begin += cells_per_task) {
+            std::size_t end = std::min(begin + cells_per_task, cells.size());
+            auto conn = std::make_shared<RedisPool::Lease>(source.redis_pool->acquire(executor));
+            if (!*conn) break;
+            tasks.run([&, conn, begin, end] {
+                RedisPool::Lease sweep_conn = std::move(*conn);
+                sweep(sweep_conn.get(), cells.data() + begin, cells.data() + end);
+            });
+        }
+        tasks.wait();
     }
 
-    // 合并所有线程的结果
-    for (auto& result_list : thread_results) {
-        all_visible_stars.insert(all_visible_stars.end(), result_list.begin(), result_list.end());
+    std::size_t total = 0;
+    for (std::size_t v = 0; v < views.size(); ++v) {
+        for (std::vector<star>& part : results[v]) {
+            view_stars[v].insert(view_stars[v].end(), part.begin(), part.end());
+            std::vector<star>().swap(part);
+        }
+        total += view_stars[v].size();
     }
+    finish_query(total, " (批量)。");
+    return view_stars;
+}
 
-    std::cout << "星星筛选完成，共找到 " << all_visible_stars.size() << " 颗视野内的星星 (多线程)." << std::endl;
+// 保留的格子只与数据库、观测历元和星等极限有关，与视场无关
+struct observer::IncrementalState {
+    std::mutex mutex;
+    std::shared_ptr<const StarSnapshot> snapshot;
+    std::shared_ptr<RedisPool> redis_pool;
+    CellStore::Source store; // 数据库布局和入库代数，重新入库后从头读取
+    double epoch = std::numeric_limits<double>::quiet_NaN();
+    double magnitude_limit = std::numeric_limits<double>::quiet_NaN();
+    std::unordered_map<int, IncrementalCell> cells;
+};
 
-    return all_visible_stars;
+std::vector<star> observer::FileterStarInViewIncremental() {
+    std::vector<star> visible_stars;
+    RedisPool::Lease redis_conn;
+    CellStore::Source store;
+    if (!snapshot) {
+        redis_conn = connectRedis();
+        if (!redis_conn) {
+            return visible_stars;
+        }
+        store = storageSource(redis_conn.get());
+        if (store.layout == StorageLayout::None) {
+            // 没有天区索引只能全库扫描，没有可以保留的格子
+            redis_conn.release();
+            return FileterStarInView();
+        }
+    }
+
+    Metrics::ScopedTimer timer(query_metrics().query_seconds);
+    if (!incremental) incremental = std::make_shared<IncrementalState>();
+    IncrementalState& state = *incremental;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.snapshot != snapshot || state.redis_pool != redis_pool || state.store != store ||
+        !(state.epoch == epoch) || !(state.magnitude_limit == magnitude_limit)) {
+        state.cells.clear();
+        state.snapshot = snapshot;
+        state.redis_pool = redis_pool;
+        state.store = store;
+        state.epoch = epoch;
+        state.magnitude_limit = magnitude_limit;
+    }
+
+    // 移出视场的格子丢掉，只读新露出的格子
+    const std::vector<int> cells = cellsInView();
+    const std::unordered_set<int> in_view(cells.begin(), cells.end());
+    for (auto it = state.cells.begin(); it != state.cells.end();) {
+        it = in_view.count(it->first) ? std::next(it) : state.cells.erase(it);
+    }
+    std::vector<int> exposed;
+    for (int cell : cells) {
+        if (!state.cells.count(cell)) exposed.push_back(cell);
+    }
+    if (snapshot) {
+        for (int cell : exposed) {
+            const catalog_star* begin = snapshot->cellBegin(cell);
+            const catalog_star* end = snapshot->cellEnd(cell, magnitude_limit);
+            query_metrics().snapshot_bytes_read.add(
+                static_cast<std::size_t>(end - begin) * (sizeof(catalog_star) + sizeof(unit_vector)));
+            state.cells[cell].batch.append(begin, end, snapshot->cellVectors(cell));
+        }
+    } else {
+        std::vector<TileCache::TilePtr> tiles;
+        if (!read_cell_tiles(redis_conn.get(), store, exposed, magnitude_limit, tile_cache, tiles)) {
+            return visible_stars;
+        }
+        redis_conn.release();
+        // 回复错误的格子不保留，下次查询重新读取
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < exposed.size(); ++i) {
+            if (!tiles[i]) continue;
+            const TileCache::Tile& tile = *tiles[i];
+            state.cells[exposed[i]].batch.append(tile.stars.data(), tile.stars.data() + tile.stars.size(),
+                                                 tile.vectors.data());
+            exposed[kept++] = exposed[i];
+        }
+        exposed.resize(kept);
+    }
+    for (int cell : exposed) {
+        seal_incremental_cell(state.cells[cell], epoch);
+    }
+
+    // 按 cellsInView 的顺序拼起来，与 FileterStarInView 的结果相同
+    const FovKernel::FieldOfView fov = fieldOfView();
+    std::vector<uint32_t> indices;
+    for (int cell : cells) {
+        auto found = state.cells.find(cell);
+        if (found == state.cells.end()) continue;
+        const IncrementalCell& kept = found->second;
+        if (kept.batch.size() == 0) continue;
+        switch (FovKernel::CapOverlap(fov, kept.center, kept.radius)) {
+            case FovKernel::Overlap::Inside:
+                visible_stars.insert(visible_stars.end(), kept.stars.begin(), kept.stars.end());
+                break;
+            case FovKernel::Overlap::Outside:
+                break;
+            case FovKernel::Overlap::Partial:
+                query_metrics().stars_scanned.add(kept.batch.size());
+                FovKernel::Visible(kept.batch, fov, epoch, indices);
+                for (uint32_t i : indices) visible_stars.push_back(kept.stars[i]);
+                break;
+        }
+    }
+    finish_query(visible_stars.size(), " (增量)。");
+    return visible_stars;
+}
+
+void observer::resetIncremental() {
+    incremental.reset();
 }
 
 void observer::setRa(double new_ra) { ra = new_ra; }
@@ -184,4 +949,14 @@ double observer::getFovH() const { return fov_h; }
 void observer::setGamma(double new_gamma) { gamma = new_gamma; }
 double observer::getGamma() const { return gamma; }
 void observer::setExposure(double new_exposure) { exposure = new_exposure; }
-double observer::getExposure() const { return exposure; }
\ No newline at end of file
+double observer::getExposure() const { return exposure; }
+void observer::setEpoch(double new_epoch) { epoch = new_epoch; }
+double observer::getEpoch() const { return epoch; }
+void observer::setMagnitudeLimit(double new_magnitude_limit) { magnitude_limit = new_magnitude_limit; }
+double observer::getMagnitudeLimit() const { return magnitude_limit; }
+void observer::setPipelineWindow(std::size_t new_pipeline_window) { pipeline_window = std::max<std::size_t>(1, new_pipeline_window); }
+std::size_t observer::getPipelineWindow() const { return pipeline_window; }
+void observer::setRedisPool(std::shared_ptr<RedisPool> new_redis_pool) { redis_pool = std::move(new_redis_pool); }
+std::shared_ptr<RedisPool> observer::getRedisPool() const { return redis_pool; }
+void observer::setTileCache(std::shared_ptr<TileCache> new_tile_cache) { tile_cache = std::move(new_tile_cache); }
+std::shared_ptr<TileCache> observer::getTileCache() const { return tile_cache; }
@@ -4,21 +4,62 @@
 
 #ifndef OBSERVER_H
 #define OBSERVER_H
+#include <functional>
+#include <limits>
+#include <memory>
 #include <vector>
 #include <string>
 #include <common.h>
+#include <star_snapshot.h>
+#include <cell_store.h>
+#include <redis_pool.h>
+#include <tile_cache.h>
+#include <fov_kernel.h>
 #include <hiredis/hiredis.h>
 
 class observer {
 public:
+    // 流式查询的回调，每次交付一批视场内的星
+    using StarSink = std::function<void(std::vector<star>&&)>;
+    using CompactStarSink = std::function<void(std::vector<compact_star>&&)>;
+
     observer(double initial_ra, double initial_dec, double initial_fov_w, double initial_fov_h,
          double initial_gamma = 0.0, double initial_exposure = 0.0,
          const std::string& redis_host_addr = "127.0.0.1", int redis_port_num = 6379);
 
-    bool isStarInFOV(double star_ra, double star_dec) const;
-    redisContext* connectRedis() const;
+    bool isStarInFOV(double star_ra, double star_dec) const; // 心射投影后的矩形视场，考虑滚转角 gamma
+    FovKernel::FieldOfView fieldOfView() const;
+    RedisPool::Lease connectRedis() const; // 从连接池借一个连接，Lease 析构时归还
+    StorageLayout storageLayout(redisContext* redis_conn) const; // 数据库的存储布局，没有一致的天区索引时为 None
+    CellStore::Source storageSource(redisContext* redis_conn) const; // 存储布局加入库代数，每次入库都不同
+    std::vector<int> cellsInView() const;             // 与视场相交的天区格子
+    void useSnapshot(std::shared_ptr<const StarSnapshot> snapshot_catalog); // 改从 mmap 快照查询，传 nullptr 切回 Redis
+    // 没有天区索引的数据库退回全库 SCAN，SCAN 出错时以下各查询抛出 std::runtime_error，而不是返回扫了一半的结果
     std::vector<star> FileterStarInView(); // 原始的单线程版本
     std::vector<star> FileterStarInViewMultithreaded(int num_threads); // 多线程版本
+    // 流式查询：边查询边把视场内的星分批交给 sink，调用方可以在后面的批次还在读取时处理已到达的批次
+    // （例如交给 StarMapDrawer::Accumulator 渲染）。num_threads 为 1 时在调用线程串行查询，其他值与
+    // FileterStarInViewMultithreaded 相同。sink 不会被并发调用；有天区索引时各批按固定顺序交付，
+    // 拼起来与对应的非流式版本结果相同。返回交付的星数
+    std::size_t StreamStarsInView(const StarSink& sink, int num_threads = 1);
+    // 紧凑结果（大视场、要保存或传输的结果）：每批筛选完就打包成 12 字节的 compact_star，各任务攒着的中间结果
+    // 和最后合并的结果都是紧凑记录，内存和搬运量约为 star 的 3/8。位置和星等按 compact_star.h 的精度量化，
+    // 渲染时直接交给 drawStarMap 的 compact_star 重载。星的顺序与 FileterStarInViewMultithreaded 相同；
+    // num_threads 为 1 时在调用线程串行查询，其他值与 FileterStarInViewMultithreaded 相同
+    std::vector<compact_star> FileterStarInViewCompact(int num_threads = 0);
+    // 批量查询（相机阵列、巡天拼接）：各视场格子的并集只从 Redis 读取、解码一次，每段候选星依次交给与它相交的
+    // 各视场筛选，开销随覆盖天区的并集增长，而不是随视场数增长。结果与 views 一一对应，每个视场的星与它单独查询
+    // 相同；格子按相交视场里最深的星等极限读取，星等极限不同的视场顺序可能不同。快照后端和没有天区索引的数据库
+    // 逐个视场查询。所有视场都查第一个视场的数据库（快照或连接池，以及格子缓存）。num_threads 为 1 时在调用线程
+    // 串行执行，其他值与 FileterStarInViewMultithreaded 相同
+    static std::vector<std::vector<star>> FileterStarsInViews(const std::vector<observer>& views, int num_threads = 0);
+    // 增量查询（跟踪目标、慢速转动）：保留上次查询读过的格子，即解码后的候选星和它们推到观测历元的位置。
+    // setRa/setDec/setFovW/setFovH/setGamma 之后再查时只读取新露出的格子，移出视场的格子直接丢掉；完全在视场内
+    // 或视场外的格子整块取用或跳过，只有跨过视场边界的格子逐颗判断。每帧的读取和推算量随扫过的天区增长，
+    // 而不是随整个视场。结果与 FileterStarInView 相同。换了数据库、观测历元或星等极限，以及数据库重新入库后
+    // 从头读取。复制出来的 observer 共用保留的格子
+    std::vector<star> FileterStarInViewIncremental();
+    void resetIncremental(); // 丢掉增量查询保留的格子
 
     void setRa(double new_ra);
     double getRa() const;
@@ -32,21 +73,55 @@ public:
     void setFovH(double new_fov_h);
     double getFovH() const;
 
+    // 滚转角（度）：视场上方从北向东转过的角度
     void setGamma(double new_gamma);
     double getGamma() const;
 
     void setExposure(double new_exposure);
     double getExposure() const;
 
+    // 观测历元（儒略年，例如 2025.5），查询时把星从平均历元推到这里；默认为构造时的当前时刻
+    void setEpoch(double new_epoch);
+    double getEpoch() const;
+
+    // 星等极限：只返回不暗于它的星，默认不限。设成 drawStarMap 的 magnitudeThreshold 时，Redis 每个格子只读
+    // 够用的最内一个星等层（见 CellStore::MAGNITUDE_LAYER_LIMITS），快照只读每个格子从亮到暗的前缀
+    void setMagnitudeLimit(double new_magnitude_limit);
+    double getMagnitudeLimit() const;
+
+    // 全库扫描时每次 SCAN 的 COUNT 以及一次流水线发送的 HMGET 数
+    void setPipelineWindow(std::size_t new_pipeline_window);
+    std::size_t getPipelineWindow() const;
+
+    // 查询使用的连接池，默认是按 redis_host:redis_port 共享的进程级连接池
+    void setRedisPool(std::shared_ptr<RedisPool> new_redis_pool);
+    std::shared_ptr<RedisPool> getRedisPool() const;
+
+    // 解码后的格子缓存，多个 observer 可以共用一个；默认没有，每次查询都读 Redis。快照后端不使用
+    void setTileCache(std::shared_ptr<TileCache> new_tile_cache);
+    std::shared_ptr<TileCache> getTileCache() const;
+
 private:
+    struct IncrementalState; // 增量查询保留的格子，见 observer.cpp
+
+    // sink 和 compact_sink 恰好给一个，决定结果的形式
+    std::size_t stream_stars(bool threaded, int num_threads, const StarSink* sink, const CompactStarSink* compact_sink);
+
     double ra;
     double dec;
     double fov_w;
     double fov_h;
     double gamma;
     double exposure;
+    double epoch;
+    double magnitude_limit = std::numeric_limits<double>::infinity();
     std::string redis_host;
     int redis_port;
+    std::shared_ptr<RedisPool> redis_pool;
+    std::shared_ptr<const StarSnapshot> snapshot; // 非空时查询走快照后端
+    std::shared_ptr<TileCache> tile_cache;
+    std::shared_ptr<IncrementalState> incremental;
+    std::size_t pipeline_window = 1000;
 };
 
 #endif //OBSERVER_H
@@ -0,0 +1,90 @@
+//
+// Created by viking on 2025/4/2.
+//
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Philox4x32-10 计数器随机数（Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"）。
+// 输出只由 (key, counter) 决定，没有内部状态：同一个种子和计数器在任何线程、任何调用顺序下得到同样的结果，
+// 适合按 (星号, 像素) 直接取噪声，渲染结果和线程数、分块方式无关。
+namespace Philox {
+    using Counter = std::array<uint32_t, 4>;
+    using Key = std::array<uint32_t, 2>;
+
+    constexpr uint32_t M0 = 0xD2511F53;
+    constexpr uint32_t M1 = 0xCD9E8D57;
+    constexpr uint32_t W0 = 0x9E3779B9; // 黄金分割
+    constexpr uint32_t W1 = 0xBB67AE85; // sqrt(3) - 1
+    constexpr int ROUNDS = 10;
+
+    inline Key KeyFromSeed(uint64_t seed) {
+        return Key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+    }
+
+    // 对一个计数器块做 10 轮 Philox，得到 4 个 32 位随机数
+    inline Counter Generate(Counter ctr, Key key) {
+        for (int round = 0; round < ROUNDS; ++round) {
+            uint64_t p0 = static_cast<uint64_t>(M0) * ctr[0];
+            uint64_t p1 = static_cast<uint64_t>(M1) * ctr[2];
+            ctr = Counter{static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0], static_cast<uint32_t>(p1),
+                          static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1], static_cast<uint32_t>(p0)};
+            key[0] += W0;
+            key[1] += W1;
+        }
+        return ctr;
+    }
+
+    // 32 位随机数的高 24 位映射到 [0, 1) 的 float，不会取到 1
+    inline float ToUniform(uint32_t bits) {
+        return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // 批量生成：计数器 {first_block + b, c1, c2, c3}（b = 0..blocks-1）依次展开，
+    // out[4*b + lane] 是第 b 块的第 lane 个输出，映射到 [lo, hi)。
+    // 一次处理 LANES 个块，轮函数按列写成定长循环，编译器可以向量化 32x32->64 乘法
+    inline void UniformBatch(Key key, uint32_t first_block, uint32_t c1, uint32_t c2, uint32_t c3,
+                             std::size_t blocks, float lo, float hi, float* out) {
+        constexpr std::size_t LANES = 8;
+        const float scale = hi - lo;
+        for (std::size_t base = 0; base < blocks; base += LANES) {
+            uint32_t x0[LANES], x1[LANES], x2[LANES], x3[LANES];
+            for (std::size_t i = 0; i < LANES; ++i) {
+                x0[i] = first_block + static_cast<uint32_t>(base + i);
+                x1[i] = c1;
+                x2[i] = c2;
+                x3[i] = c3;
+            }
+            uint32_t k0 = key[0];
+            uint32_t k1 = key[1];
+            for (int round = 0; round < ROUNDS; ++round) {
+                for (std::size_t i = 0; i < LANES; ++i) {
+                    uint64_t p0 = static_cast<uint64_t>(M0) * x0[i];
+                    uint64_t p1 = static_cast<uint64_t>(M1) * x2[i];
+                    uint32_t y0 = static_cast<uint32_t>(p1 >> 32) ^ x1[i] ^ k0;
+                    uint32_t y2 = static_cast<uint32_t>(p0 >> 32) ^ x3[i] ^ k1;
+                    x1[i] = static_cast<uint32_t>(p1);
+                    x3[i] = static_cast<uint32_t>(p0);
+                    x0[i] = y0;
+                    x2[i] = y2;
+                }
+                k0 += W0;
+                k1 += W1;
+            }
+            std::size_t count = blocks - base < LANES ? blocks - base : LANES;
+            for (std::size_t i = 0; i < count; ++i) {
+                float* o = out + 4 * (base + i);
+                o[0] = lo + scale * ToUniform(x0[i]);
+                o[1] = lo + scale * ToUniform(x1[i]);
+                o[2] = lo + scale * ToUniform(x2[i]);
+                o[3] = lo + scale * ToUniform(x3[i]);
+            }
+        }
+    }
+}
+
+#endif //PHILOX_H
@@ -0,0 +1,148 @@
+//
+// Created by viking on 2025/4/3.
+//
+
+#include "redis_pool.h"
+#include "executor.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <utility>
+
+RedisPool::Lease::Lease(Lease&& other) noexcept
+    : pool_(other.pool_), conn_(other.conn_), broken_(other.broken_) {
+    other.pool_ = nullptr;
+    other.conn_ = nullptr;
+}
+
+RedisPool::Lease& RedisPool::Lease::operator=(Lease&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        conn_ = std::exchange(other.conn_, nullptr);
+        broken_ = other.broken_;
+    }
+    return *this;
+}
+
+void RedisPool::Lease::release() {
+    if (pool_ != nullptr && conn_ != nullptr) {
+        pool_->giveBack(conn_, broken_);
+    }
+    pool_ = nullptr;
+    conn_ = nullptr;
+    broken_ = false;
+}
+
+RedisPool::RedisPool(std::string host, int port, std::size_t max_connections)
+    : host_(std::move(host)), port_(port), max_connections_(std::max<std::size_t>(max_connections, 1)) {}
+
+RedisPool::~RedisPool() {
+    for (auto& idle : idle_) {
+        redisFree(idle.conn);
+    }
+}
+
+RedisPool::Lease RedisPool::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    available_.wait(lock, [this] { return !idle_.empty() || leased_ < max_connections_; });
+    return checkout(lock);
+}
+
+RedisPool::Lease RedisPool::acquire(Executor& executor) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (idle_.empty() && leased_ >= max_connections_) {
+        lock.unlock();
+        const bool ran = executor.runOne();
+        lock.lock();
+        if (!ran) {
+            available_.wait_for(lock, std::chrono::milliseconds(1),
+                                [this] { return !idle_.empty() || leased_ < max_connections_; });
+        }
+    }
+    return checkout(lock);
+}
+
+RedisPool::Lease RedisPool::tryAcquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (idle_.empty() && leased_ >= max_connections_) {
+        return Lease();
+    }
+    return checkout(lock);
+}
+
+// 调用时已持有锁且确认有空闲连接或空余名额；建连和健康检查在锁外进行
+RedisPool::Lease RedisPool::checkout(std::unique_lock<std::mutex>& lock) {
+    redisContext* conn = nullptr;
+    bool needs_check = false;
+    if (!idle_.empty()) {
+        IdleConnection idle = idle_.back();
+        idle_.pop_back();
+        conn = idle.conn;
+        needs_check = std::chrono::steady_clock::now() - idle.since >= HEALTH_CHECK_IDLE;
+    }
+    ++leased_;
+    lock.unlock();
+
+    if (conn != nullptr && needs_check && !ping(conn)) {
+        redisFree(conn);
+        conn = nullptr;
+    }
+    if (conn == nullptr) {
+        conn = connect();
+    }
+    if (conn == nullptr) {
+        giveBack(nullptr, true);
+        return Lease();
+    }
+    return Lease(this, conn);
+}
+
+redisContext* RedisPool::connect() {
+    connect_count_.fetch_add(1, std::memory_order_relaxed);
+    redisContext* connection = redisConnect(host_.c_str(), port_);
+    if (connection == nullptr || connection->err) {
+        if (connection) {
+            std::cerr << "Redis connection error: " << connection->errstr << std::endl;
+            redisFree(connection);
+        } else {
+            std::cerr << "Can't allocate Redis context" << std::endl;
+        }
+        return nullptr;
+    }
+    return connection;
+}
+
+bool RedisPool::ping(redisContext* conn) {
+    redisReply* reply = static_cast<redisReply*>(redisCommand(conn, "PING"));
+    bool ok = reply != nullptr && reply->type == REDIS_REPLY_STATUS;
+    if (reply) freeReplyObject(reply);
+    return ok;
+}
+
+void RedisPool::giveBack(redisContext* conn, bool broken) {
+    if (conn != nullptr && (broken || conn->err)) {
+        redisFree(conn);
+        conn = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --leased_;
+        if (conn != nullptr) {
+            idle_.push_back(IdleConnection{conn, std::chrono::steady_clock::now()});
+        }
+    }
+    available_.notify_one();
+}
+
+std::shared_ptr<RedisPool> RedisPool::Shared(const std::string& host, int port, std::size_t max_connections) {
+    // 进程生命周期内一直持有，临时创建的 observer 也能复用已有连接
+    static std::mutex registry_mutex;
+    static std::map<std::pair<std::string, int>, std::shared_ptr<RedisPool>> registry;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto& pool = registry[{host, port}];
+    if (!pool) {
+        pool = std::make_shared<RedisPool>(host, port, max_connections);
+    }
+    return pool;
+}
@@ -0,0 +1,98 @@
+//
+// Created by viking on 2025/4/3.
+//
+
+#ifndef REDIS_POOL_H
+#define REDIS_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <hiredis/hiredis.h>
+
+class Executor;
+
+// 线程安全的 Redis 连接池，observer 查询和 Tycho2Dataset 入库共用。
+// 借出的连接用 Lease 持有，析构时归还；出错的连接（context->err 非零、被标记为 discard，或者 Lease 因为异常
+// 展开而析构，这时流水线的回复可能没有读完）归还时直接关闭，下次借用时重新连接。空闲超过 HEALTH_CHECK_IDLE 的连接借出前先 PING 一次，失败则重连。
+class RedisPool {
+public:
+    static constexpr std::size_t DEFAULT_POOL_SIZE = 16;
+    static constexpr std::chrono::seconds HEALTH_CHECK_IDLE{5};
+
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() {
+            if (std::uncaught_exceptions() > uncaught_) broken_ = true;
+            release();
+        }
+
+        redisContext* get() const { return conn_; }
+        explicit operator bool() const { return conn_ != nullptr; }
+
+        void release();                   // 提前归还
+        void discard() { broken_ = true; } // 连接状态不可信（例如流水线回复没有读完），归还时关闭
+
+    private:
+        friend class RedisPool;
+        Lease(RedisPool* pool, redisContext* conn) : pool_(pool), conn_(conn) {}
+
+        RedisPool* pool_ = nullptr;
+        redisContext* conn_ = nullptr;
+        bool broken_ = false;
+        int uncaught_ = std::uncaught_exceptions(); // 创建时正在展开的异常数，析构时更多说明是被异常展开的
+    };
+
+    RedisPool(std::string host, int port, std::size_t max_connections = DEFAULT_POOL_SIZE);
+    ~RedisPool();
+    RedisPool(const RedisPool&) = delete;
+    RedisPool& operator=(const RedisPool&) = delete;
+
+    // 借一个连接，池中名额用完时阻塞等待；连接失败打印错误并返回空 Lease
+    Lease acquire();
+    // 在 Executor 的任务里（或者会等待这些任务的线程上）借连接：名额用完时不阻塞，帮 executor 执行排队的任务，
+    // 直到有连接归还。持有连接的任务在别的工作线程上排队时，阻塞的 acquire 会占住工作线程等不到它们归还
+    Lease acquire(Executor& executor);
+    // 不等待的版本，名额用完时直接返回空 Lease
+    Lease tryAcquire();
+
+    // 进程内按 host:port 共享的连接池，max_connections 只在第一次创建时生效
+    static std::shared_ptr<RedisPool> Shared(const std::string& host, int port,
+                                             std::size_t max_connections = DEFAULT_POOL_SIZE);
+
+    std::size_t maxConnections() const { return max_connections_; }
+    std::size_t connectCount() const { return connect_count_.load(std::memory_order_relaxed); } // 累计新建连接数
+
+private:
+    struct IdleConnection {
+        redisContext* conn;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    Lease checkout(std::unique_lock<std::mutex>& lock);
+    redisContext* connect();
+    static bool ping(redisContext* conn);
+    void giveBack(redisContext* conn, bool broken);
+
+    const std::string host_;
+    const int port_;
+    const std::size_t max_connections_;
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<IdleConnection> idle_; // 后进先出，最近用过的连接最先被复用
+    std::size_t leased_ = 0;           // 已借出（含正在建立）的连接数
+    std::atomic<std::size_t> connect_count_{0};
+};
+
+#endif //REDIS_POOL_H
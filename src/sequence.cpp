@@ -0,0 +1,234 @@
+//
+// Created by viking on 2025/4/12.
+//
+
+#include "sequence.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <opencv2/core/mat.hpp>
+
+namespace StarSequence {
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // 输出图像缓冲区数：一个在编码，一个在渲染
+    constexpr std::size_t IMAGE_BUFFERS = 2;
+
+    double SecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // 相邻阶段之间的有界队列，满时生产者阻塞；close 之后 pop 取完剩下的元素再返回 false。
+    // cancel 丢掉剩下的元素并唤醒两端，之后 push 和 pop 都立即返回 false，用于某个阶段失败时停下整条流水线
+    template <typename T>
+    class Handoff {
+    public:
+        explicit Handoff(std::size_t capacity) : capacity_(capacity) {}
+
+        bool push(T&& item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] { return items_.size() < capacity_ || closed_; });
+            if (closed_) return false;
+            items_.push_back(std::move(item));
+            not_empty_.notify_one();
+            return true;
+        }
+
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+            if (items_.empty()) return false;
+            item = std::move(items_.front());
+            items_.pop_front();
+            not_full_.notify_one();
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+        void cancel() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            items_.clear();
+            not_empty_.notify_all();
+            not_full_.notify_all();
+        }
+
+    private:
+        std::size_t capacity_;
+        std::deque<T> items_;
+        bool closed_ = false;
+        std::mutex mutex_;
+        std::condition_variable not_full_;
+        std::condition_variable not_empty_;
+    };
+
+    struct QueriedFrame {
+        std::size_t index = 0;
+        Pose pose{};
+        std::vector<star> stars;
+    };
+
+    struct RenderedFrame {
+        std::size_t index = 0;
+        cv::Mat image;
+    };
+
+    // 渲染、编码阶段的线程。还有线程没结束就离开作用域时（调用线程的查询抛出异常）先 cancel 各个队列，
+    // 让阻塞在队列上的阶段退出，再等线程结束
+    class StageThreads {
+    public:
+        explicit StageThreads(std::function<void()> cancel) : cancel_(std::move(cancel)) {}
+        StageThreads(const StageThreads&) = delete;
+        StageThreads& operator=(const StageThreads&) = delete;
+
+        ~StageThreads() {
+            for (const std::thread& thread : threads_) {
+                if (thread.joinable()) {
+                    cancel_();
+                    break;
+                }
+            }
+            join();
+        }
+
+        void start(std::function<void()> stage) { threads_.emplace_back(std::move(stage)); }
+
+        void join() {
+            for (std::thread& thread : threads_) {
+                if (thread.joinable()) thread.join();
+            }
+        }
+
+    private:
+        std::function<void()> cancel_;
+        std::vector<std::thread> threads_;
+    };
+}
+
+std::string FramePath(const std::string& pattern, std::size_t frame) {
+    int length = std::snprintf(nullptr, 0, pattern.c_str(), static_cast<int>(frame));
+    if (length < 0) return pattern;
+    std::string path(static_cast<std::size_t>(length) + 1, '\0');
+    std::snprintf(path.data(), path.size(), pattern.c_str(), static_cast<int>(frame));
+    path.resize(static_cast<std::size_t>(length));
+    return path;
+}
+
+Stats RenderSequence(observer& obs, const std::vector<Pose>& trajectory, const Options& options) {
+    Stats stats;
+    const Clock::time_point start = Clock::now();
+    StarMapDrawer::FrameRenderer renderer(options.imageWidth, options.imageHeight, obs.getFovW(), obs.getFovH(),
+                                          options.magnitudeThreshold, options.render);
+
+    // 各阶段的耗时只由该阶段的线程累加，结束后再读
+    auto query = [&](const Pose& pose) {
+        const Clock::time_point begin = Clock::now();
+        obs.setRa(pose.ra);
+        obs.setDec(pose.dec);
+        obs.setGamma(pose.gamma);
+        std::vector<star> stars = obs.FileterStarInViewIncremental();
+        stats.querySeconds += SecondsSince(begin);
+        return stars;
+    };
+    auto render = [&](const QueriedFrame& frame, cv::Mat& image) {
+        const Clock::time_point begin = Clock::now();
+        renderer.render(frame.stars, frame.pose.ra, frame.pose.dec, frame.pose.gamma, image);
+        stats.renderSeconds += SecondsSince(begin);
+    };
+    auto encode = [&](const RenderedFrame& frame) {
+        const Clock::time_point begin = Clock::now();
+        if (StarMapDrawer::writeImage(frame.image, FramePath(options.outputPattern, frame.index))) {
+            ++stats.framesWritten;
+        }
+        stats.encodeSeconds += SecondsSince(begin);
+    };
+
+    if (!options.pipelined) {
+        RenderedFrame rendered;
+        for (std::size_t i = 0; i < trajectory.size(); ++i) {
+            QueriedFrame frame{i, trajectory[i], query(trajectory[i])};
+            render(frame, rendered.image);
+            rendered.index = i;
+            encode(rendered);
+        }
+        stats.wallSeconds = SecondsSince(start);
+        return stats;
+    }
+
+    // 查询 -> 渲染 -> 编码，各隔一个容量为 1 的队列；渲染好的图像用完后经 free_images 还给渲染线程。
+    // 渲染和编码用专门的线程而不是 Executor 的任务：这两个阶段在整个序列期间阻塞在队列上，放进 Executor
+    // 会一直占住工作线程，只有一个工作线程时编码任务排在渲染任务后面永远轮不到，渲染等空闲图像、
+    // 查询等渲染，整条流水线卡死；渲染（render.threads != 1）和查询自己提交的细粒度任务仍然交给 Executor
+    Handoff<QueriedFrame> queried(1);
+    Handoff<RenderedFrame> rendered(1);
+    Handoff<cv::Mat> free_images(IMAGE_BUFFERS);
+    for (std::size_t k = 0; k < IMAGE_BUFFERS; ++k) {
+        free_images.push(cv::Mat());
+    }
+
+    // 某个阶段抛出异常时记下第一个，取消全部队列让其他阶段退出，结束后在调用线程重新抛出
+    auto cancel = [&] {
+        queried.cancel();
+        rendered.cancel();
+        free_images.cancel();
+    };
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto guarded = [&](auto stage) {
+        return [&, stage] {
+            try {
+                stage();
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+                cancel();
+            }
+        };
+    };
+
+    StageThreads stages(cancel); // 放在队列之后，先于队列析构
+    stages.start(guarded([&] {
+        QueriedFrame frame;
+        while (queried.pop(frame)) {
+            RenderedFrame output{frame.index, {}};
+            if (!free_images.pop(output.image)) break;
+            render(frame, output.image);
+            if (!rendered.push(std::move(output))) break;
+        }
+        rendered.close();
+    }));
+    stages.start(guarded([&] {
+        RenderedFrame frame;
+        while (rendered.pop(frame)) {
+            encode(frame);
+            free_images.push(std::move(frame.image));
+        }
+    }));
+
+    for (std::size_t i = 0; i < trajectory.size(); ++i) {
+        if (!queried.push(QueriedFrame{i, trajectory[i], query(trajectory[i])})) break; // 后面的阶段失败了
+    }
+    queried.close();
+    stages.join();
+    if (error) std::rethrow_exception(error);
+    stats.wallSeconds = SecondsSince(start);
+    return stats;
+}
+
+}
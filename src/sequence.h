@@ -0,0 +1,52 @@
+//
+// Created by viking on 2025/4/12.
+//
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <draw.h>
+#include <observer.h>
+
+// 图像序列渲染（慢速转动、星敏感器测试视频）：沿一条轨迹逐帧查询、渲染、编码写文件。三个阶段在相邻帧之间重叠，
+// 调用线程查询后面的帧时，渲染线程累加第 N+1 帧，编码线程写第 N 帧，持续帧率取决于最慢的一个阶段，
+// 而不是三个阶段之和。查询用 observer 的增量查询，只读新露出的格子；渲染用一个 StarMapDrawer::FrameRenderer，
+// 累加缓冲区和色调映射的中间图像在帧之间复用，输出图像在两个缓冲区之间轮换。
+namespace StarSequence {
+    // 轨迹上的一帧：视场中心和滚转角（度）
+    struct Pose {
+        double ra;
+        double dec;
+        double gamma = 0.0;
+    };
+
+    struct Options {
+        int imageWidth = 1024;
+        int imageHeight = 1024;
+        double magnitudeThreshold = 12.0;
+        StarMapDrawer::RenderOptions render; // render.gamma 不使用，每帧取 Pose::gamma
+        std::string outputPattern = "output/frame_%05d.png"; // printf 格式，唯一的参数是帧号
+        bool pipelined = true; // false 时逐帧依次查询、渲染、写文件，便于对比
+    };
+
+    struct Stats {
+        std::size_t framesWritten = 0;
+        double querySeconds = 0.0; // 各阶段累计的耗时
+        double renderSeconds = 0.0;
+        double encodeSeconds = 0.0;
+        double wallSeconds = 0.0;
+    };
+
+    std::string FramePath(const std::string& pattern, std::size_t frame);
+
+    // 按 trajectory 渲染图像序列，第 k 帧写到 FramePath(options.outputPattern, k)。视场大小、历元、数据库和星等极限
+    // 取自 obs，每帧改它的赤经、赤纬和滚转角，结束后 obs 停在最后一帧；把 obs 的星等极限设成 magnitudeThreshold
+    // 可以少读暗星。每帧的图像与用同样参数调用 drawStarMap 逐位相同。任一阶段抛出的异常停下整条流水线，
+    // 等渲染、编码线程结束后在调用线程重新抛出
+    Stats RenderSequence(observer& obs, const std::vector<Pose>& trajectory, const Options& options = Options());
+}
+
+#endif //SEQUENCE_H
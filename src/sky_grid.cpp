@@ -0,0 +1,93 @@
+//
+// Created by viking on 2025/3/20.
+//
+
+#include "sky_grid.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace SkyGrid {
+
+namespace {
+    struct ZoneTable {
+        std::array<int, ZONE_COUNT + 1> first_cell{}; // 每条带第一个格子的编号
+        std::array<int, ZONE_COUNT> ra_cells{};       // 每条带的赤经格子数
+
+        ZoneTable() {
+            int next = 0;
+            for (int z = 0; z < ZONE_COUNT; ++z) {
+                // 以带中心的 cos(dec) 缩放赤经格宽，使格子面积接近 ZONE_HEIGHT^2
+                double mid_dec = -90.0 + (z + 0.5) * ZONE_HEIGHT;
+                double circumference = 360.0 * std::cos(mid_dec * M_PI / 180.0);
+                ra_cells[z] = std::max(1, static_cast<int>(std::ceil(circumference / ZONE_HEIGHT)));
+                first_cell[z] = next;
+                next += ra_cells[z];
+            }
+            first_cell[ZONE_COUNT] = next;
+        }
+    };
+
+    const ZoneTable& Zones() {
+        static const ZoneTable table;
+        return table;
+    }
+
+    int ZoneOf(double dec) {
+        int z = static_cast<int>(std::floor((dec + 90.0) / ZONE_HEIGHT));
+        return std::clamp(z, 0, ZONE_COUNT - 1); // dec = +90 归入最后一条带
+    }
+
+    double NormalizeRa(double ra) {
+        ra = std::fmod(ra, 360.0);
+        if (ra < 0) ra += 360.0;
+        return ra;
+    }
+}
+
+int CellCount() {
+    return Zones().first_cell[ZONE_COUNT];
+}
+
+int CellOf(double ra, double dec) {
+    const ZoneTable& zones = Zones();
+    int z = ZoneOf(dec);
+    int n = zones.ra_cells[z];
+    int k = static_cast<int>(NormalizeRa(ra) / 360.0 * n);
+    return zones.first_cell[z] + std::min(k, n - 1);
+}
+
+std::string CellKey(int cell) {
+    return CELL_KEY_PREFIX + std::to_string(cell);
+}
+
+std::vector<int> CellsInRect(double ra_center, double ra_half_width, double dec_min, double dec_max) {
+    const ZoneTable& zones = Zones();
+    std::vector<int> cells;
+
+    dec_min = std::max(dec_min, -90.0);
+    dec_max = std::min(dec_max, 90.0);
+    if (dec_min > dec_max) return cells;
+
+    for (int z = ZoneOf(dec_min); z <= ZoneOf(dec_max); ++z) {
+        int n = zones.ra_cells[z];
+        int first = zones.first_cell[z];
+        if (ra_half_width >= 180.0) {
+            for (int k = 0; k < n; ++k) cells.push_back(first + k);
+            continue;
+        }
+
+        // 从区间起点所在格子开始向东数，跨过 360 时回绕；最多取满一整圈
+        double cell_width = 360.0 / n;
+        double ra_lo = NormalizeRa(ra_center - ra_half_width);
+        int k_lo = std::min(static_cast<int>(ra_lo / cell_width), n - 1);
+        int k_hi = static_cast<int>(std::floor((ra_lo + 2.0 * ra_half_width) / cell_width));
+        int count = std::min(k_hi - k_lo + 1, n);
+        for (int i = 0; i < count; ++i) {
+            cells.push_back(first + (k_lo + i) % n);
+        }
+    }
+    return cells;
+}
+
+}
@@ -0,0 +1,29 @@
+//
+// Created by viking on 2025/3/20.
+//
+
+#ifndef SKY_GRID_H
+#define SKY_GRID_H
+
+#include <string>
+#include <vector>
+
+// 天区划分：按赤纬切成等高的带，每条带再按赤经切成近似等面积的格子。
+// 入库时每颗星记录所属格子，查询时只取与视场相交的格子。
+namespace SkyGrid {
+    constexpr double ZONE_HEIGHT = 2.0;                 // 赤纬带高度（度）
+    constexpr int ZONE_COUNT = static_cast<int>(180.0 / ZONE_HEIGHT);
+    constexpr const char* GRID_TAG = "zones-2deg-v1";   // 写入 Redis 的划分标识，格式变化时必须修改
+    constexpr const char* GRID_KEY = "sky:grid";        // 存放 GRID_TAG 的键
+    constexpr const char* CELL_KEY_PREFIX = "sky:";     // 格子成员集合 sky:<cell>
+
+    int CellCount();
+    int CellOf(double ra, double dec);
+    std::string CellKey(int cell);
+
+    // 与赤经区间 [ra_center - ra_half_width, ra_center + ra_half_width]（可跨 0/360）
+    // 和赤纬区间 [dec_min, dec_max] 相交的所有格子，结果无重复
+    std::vector<int> CellsInRect(double ra_center, double ra_half_width, double dec_min, double dec_max);
+}
+
+#endif //SKY_GRID_H
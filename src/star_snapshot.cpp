@@ -0,0 +1,96 @@
+//
+// Created by viking on 2025/3/22.
+//
+
+#include "star_snapshot.h"
+#include "sky_grid.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace StarSnapshotFormat;
+
+std::shared_ptr<const StarSnapshot> StarSnapshot::Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open snapshot: " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        std::cerr << "Snapshot too small: " << path << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    // MAP_SHARED 只读映射，同一台机器上的进程共享页缓存
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Failed to mmap snapshot: " << path << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    std::shared_ptr<StarSnapshot> snapshot(new StarSnapshot());
+    snapshot->mapping_ = mapping;
+    snapshot->mapping_size_ = size;
+
+    const auto* header = static_cast<const SnapshotHeader*>(mapping);
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION) {
+        std::cerr << "Unsupported snapshot format: " << path << std::endl;
+        return nullptr;
+    }
+    if (header->cell_count != static_cast<uint32_t>(SkyGrid::CellCount()) ||
+        std::strncmp(header->grid_tag, SkyGrid::GRID_TAG, sizeof(header->grid_tag)) != 0) {
+        std::cerr << "Snapshot sky grid mismatch: " << path << std::endl;
+        return nullptr;
+    }
+
+    // star_count 来自文件，先按文件剩余的字节数限定范围再做乘法，伪造的星数不会乘法溢出后恰好凑出文件大小
+    std::size_t index_bytes = (header->cell_count + 1) * sizeof(uint64_t);
+    if (size < sizeof(SnapshotHeader) + index_bytes ||
+        header->star_count > (size - sizeof(SnapshotHeader) - index_bytes) / (sizeof(catalog_star) + sizeof(unit_vector))) {
+        std::cerr << "Snapshot size mismatch: " << path << std::endl;
+        return nullptr;
+    }
+    std::size_t records_bytes = header->star_count * sizeof(catalog_star);
+    std::size_t expected = sizeof(SnapshotHeader) + index_bytes + records_bytes + header->star_count * sizeof(unit_vector);
+    if (size != expected) {
+        std::cerr << "Snapshot size mismatch: " << path << std::endl;
+        return nullptr;
+    }
+
+    const char* base = static_cast<const char*>(mapping);
+    snapshot->cell_offsets_ = reinterpret_cast<const uint64_t*>(base + sizeof(SnapshotHeader));
+    snapshot->records_ = reinterpret_cast<const catalog_star*>(base + sizeof(SnapshotHeader) + index_bytes);
+    snapshot->vectors_ = reinterpret_cast<const unit_vector*>(base + sizeof(SnapshotHeader) + index_bytes + records_bytes);
+    snapshot->star_count_ = header->star_count;
+    // 每个格子的区间都要落在记录数组内：偏移从 0 开始单调不减，最后一个等于星数
+    const uint64_t* offsets = snapshot->cell_offsets_;
+    bool index_ok = offsets[0] == 0 && offsets[header->cell_count] == header->star_count;
+    for (uint32_t i = 0; index_ok && i < header->cell_count; ++i) {
+        index_ok = offsets[i] <= offsets[i + 1];
+    }
+    if (!index_ok) {
+        std::cerr << "Snapshot cell index corrupt: " << path << std::endl;
+        return nullptr;
+    }
+    return snapshot;
+}
+
+const catalog_star* StarSnapshot::cellEnd(int cell, double magnitude_limit) const {
+    return std::partition_point(cellBegin(cell), cellEnd(cell),
+                                [magnitude_limit](const catalog_star& s) { return s.magnitude <= magnitude_limit; });
+}
+
+StarSnapshot::~StarSnapshot() {
+    if (mapping_ != nullptr) {
+        munmap(mapping_, mapping_size_);
+    }
+}
@@ -0,0 +1,65 @@
+//
+// Created by viking on 2025/3/22.
+//
+
+#ifndef STAR_SNAPSHOT_H
+#define STAR_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <common.h>
+
+// 星表二进制快照，Redis 之外的另一种后端。文件布局：
+//   SnapshotHeader
+//   uint64_t cell_offsets[cell_count + 1]   第 i 个格子的星是 records[cell_offsets[i], cell_offsets[i+1])
+//   catalog_star records[star_count]         按 SkyGrid 格子排序的定长记录（平均位置、自行、历元、色指数），
+//                                            格子内按星等从亮到暗
+//   unit_vector vectors[star_count]          与 records 一一对应的平均位置单位向量，查询时直接做视场判断
+// 所有字段按本机字节序（小端）存放，整个文件 mmap 后直接使用，不做任何解析。
+namespace StarSnapshotFormat {
+    constexpr char MAGIC[8] = {'T', 'Y', 'C', '2', 'S', 'N', 'A', 'P'};
+    constexpr uint32_t VERSION = 5; // v4 格子内不按星等排序
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t cell_count;
+        uint64_t star_count;
+        char grid_tag[32];   // SkyGrid::GRID_TAG，划分不一致的快照拒绝打开
+    };
+
+    static_assert(sizeof(SnapshotHeader) % alignof(uint64_t) == 0, "cell index must stay 8-byte aligned");
+    static_assert(sizeof(catalog_star) == 40, "snapshot records are raw catalog_star structs");
+    static_assert(sizeof(unit_vector) == 12, "snapshot vectors are raw unit_vector structs");
+}
+
+class StarSnapshot {
+public:
+    // 打开并 mmap 快照文件，格式不符时打印错误并返回 nullptr
+    static std::shared_ptr<const StarSnapshot> Open(const std::string& path);
+
+    StarSnapshot(const StarSnapshot&) = delete;
+    StarSnapshot& operator=(const StarSnapshot&) = delete;
+    ~StarSnapshot();
+
+    const catalog_star* cellBegin(int cell) const { return records_ + cell_offsets_[cell]; }
+    const catalog_star* cellEnd(int cell) const { return records_ + cell_offsets_[cell + 1]; }
+    // 格子内不暗于 magnitude_limit 的星的末尾，二分查找
+    const catalog_star* cellEnd(int cell, double magnitude_limit) const;
+    const unit_vector* cellVectors(int cell) const { return vectors_ + cell_offsets_[cell]; } // 与 cellBegin 对齐
+    std::size_t starCount() const { return star_count_; }
+
+private:
+    StarSnapshot() = default;
+
+    void* mapping_ = nullptr;
+    std::size_t mapping_size_ = 0;
+    const uint64_t* cell_offsets_ = nullptr;
+    const catalog_star* records_ = nullptr;
+    const unit_vector* vectors_ = nullptr;
+    std::size_t star_count_ = 0;
+};
+
+#endif //STAR_SNAPSHOT_H
@@ -0,0 +1,112 @@
+//
+// Created by viking on 2025/4/11.
+//
+
+#include "tile_cache.h"
+#include "fov_kernel.h"
+#include "metrics.h"
+#include <functional>
+
+namespace {
+    constexpr std::size_t ENTRY_OVERHEAD_BYTES = 96; // 链表节点、哈希表节点和 Tile 本身的大致开销
+
+    struct CacheMetrics {
+        Metrics::Counter& hits;
+        Metrics::Counter& misses;
+        Metrics::Counter& evictions;
+    };
+
+    CacheMetrics& cache_metrics() {
+        static CacheMetrics metrics{
+            Metrics::Registry::Global().counter("starsim_tile_cache_hits_total", "Sky cell lookups served from the tile cache"),
+            Metrics::Registry::Global().counter("starsim_tile_cache_misses_total", "Sky cell lookups that had to read Redis"),
+            Metrics::Registry::Global().counter("starsim_tile_cache_evictions_total", "Sky cells evicted to stay within the cache budget"),
+        };
+        return metrics;
+    }
+}
+
+void TileCache::Tile::push_back(const catalog_star& s) {
+    stars.push_back(s);
+    vectors.push_back(FovKernel::UnitVector(s.ra, s.dec));
+}
+
+std::size_t TileCache::Tile::bytes() const {
+    return stars.capacity() * sizeof(catalog_star) + vectors.capacity() * sizeof(unit_vector) + ENTRY_OVERHEAD_BYTES;
+}
+
+std::size_t TileCache::KeyHash::operator()(const Key& key) const {
+    std::size_t h = std::hash<uint64_t>()(key.source.generation) * 31 + static_cast<std::size_t>(key.source.layout);
+    h = h * 31 + std::hash<int>()(key.cell);
+    return h * 31 + std::hash<double>()(key.magnitude_limit);
+}
+
+TileCache::TileCache(std::size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+TileCache::TilePtr TileCache::get(const CellStore::Source& source, int cell, double magnitude_limit) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(Key{source, cell, magnitude_limit});
+    if (it == index_.end()) {
+        ++misses_;
+        cache_metrics().misses.add();
+        return nullptr;
+    }
+    ++hits_;
+    cache_metrics().hits.add();
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->tile;
+}
+
+void TileCache::put(const CellStore::Source& source, int cell, double magnitude_limit, TilePtr tile) {
+    const std::size_t bytes = tile->bytes();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes > budget_bytes_) return;
+    const Key key{source, cell, magnitude_limit};
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        // 并发查询可能同时读了同一个格子，保留后到的
+        bytes_ -= it->second->bytes;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    lru_.push_front(Entry{key, std::move(tile), bytes});
+    index_.emplace(key, lru_.begin());
+    bytes_ += bytes;
+    evictToBudget();
+}
+
+void TileCache::evictToBudget() {
+    while (bytes_ > budget_bytes_ && !lru_.empty()) {
+        const Entry& victim = lru_.back();
+        bytes_ -= victim.bytes;
+        index_.erase(victim.key);
+        lru_.pop_back();
+        ++evictions_;
+        cache_metrics().evictions.add();
+    }
+}
+
+void TileCache::setBudget(std::size_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_bytes_ = budget_bytes;
+    evictToBudget();
+}
+
+void TileCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+TileCache::Stats TileCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    stats.entries = index_.size();
+    stats.bytes = bytes_;
+    stats.budget_bytes = budget_bytes_;
+    return stats;
+}
@@ -0,0 +1,85 @@
+//
+// Created by viking on 2025/4/11.
+//
+
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <common.h>
+#include <cell_store.h>
+
+// 进程内的天区格子缓存：存放从 Redis 解码出来的格子（星表条目和单位向量），按 (数据库布局和入库代数, 格子, 星等极限)
+// 索引，总大小超过内存预算时淘汰最近最少使用的格子。跟踪目标、巡天拼接、换曝光重渲染时反复查询同一片天区，
+// 命中的格子不再读 Redis、不再解码。一个缓存只对应一个数据库；重新入库或换布局后入库代数不同，旧的格子不再命中，
+// 留在缓存里等着被淘汰。线程安全
+class TileCache {
+public:
+    static constexpr std::size_t DEFAULT_BUDGET_BYTES = std::size_t{256} << 20;
+
+    struct Tile {
+        std::vector<catalog_star> stars;
+        std::vector<unit_vector> vectors; // 与 stars 一一对应，命中时省掉三角函数
+
+        void push_back(const catalog_star& s);
+        std::size_t bytes() const;
+    };
+    using TilePtr = std::shared_ptr<const Tile>; // 淘汰时正在使用格子的查询不受影响
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+        std::size_t budget_bytes = 0;
+    };
+
+    explicit TileCache(std::size_t budget_bytes = DEFAULT_BUDGET_BYTES);
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    TilePtr get(const CellStore::Source& source, int cell, double magnitude_limit); // 未命中返回空指针
+    void put(const CellStore::Source& source, int cell, double magnitude_limit, TilePtr tile); // 比整个预算还大的格子不缓存
+
+    void setBudget(std::size_t budget_bytes); // 缩小时立即淘汰到预算以内
+    void clear();
+    Stats stats() const;
+
+private:
+    struct Key {
+        CellStore::Source source;
+        int cell;
+        double magnitude_limit;
+        bool operator==(const Key& other) const {
+            return source == other.source && cell == other.cell && magnitude_limit == other.magnitude_limit;
+        }
+    };
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const;
+    };
+    struct Entry {
+        Key key;
+        TilePtr tile;
+        std::size_t bytes;
+    };
+
+    void evictToBudget(); // 调用方持有 mutex_
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // 头部是最近用过的
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+    std::size_t budget_bytes_;
+    std::size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+};
+
+#endif //TILE_CACHE_H